@@ -28,11 +28,1556 @@
  *
  ****************************************************************/
 
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "potfit.h"
 
 #include "config.h"
 #include "utils.h"
 
+/* candidate neighbor: atom, periodic image, distance vector and length */
+typedef struct {
+  int   nr;			/* number of neighboring atom */
+  int   ix, iy, iz;		/* periodic image of the neighbor */
+  vector dd;			/* distance vector */
+  double r;			/* length of the distance vector */
+} neigh_cand_t;
+
+/* linked cell list of a single configuration */
+typedef struct {
+  int   nc[3];			/* number of cells along each box vector */
+  int   range[3];		/* number of cells to search in each direction */
+  int  *head;			/* first atom in each cell */
+  int  *next;			/* next atom in the same cell */
+  int  *cell;			/* cell coordinates of each atom */
+  int  *wrap;			/* box vectors needed to fold each atom into the box */
+} cell_list_t;
+
+/****************************************************************
+ *
+ *  append atom j in image (ix,iy,iz) to the candidate list
+ *
+ ****************************************************************/
+
+static void add_candidate(int j, int ix, int iy, int iz, vector dd, double r,
+  neigh_cand_t **cand, int *len, int *size)
+{
+  if (*len == *size) {
+    *size = MAX(2 * *size, 64);
+    *cand = (neigh_cand_t *) realloc(*cand, *size * sizeof(neigh_cand_t));
+    if (NULL == *cand)
+      error(1, "Cannot allocate memory for neighbor candidates");
+  }
+  (*cand)[*len].nr = j;
+  (*cand)[*len].ix = ix;
+  (*cand)[*len].iy = iy;
+  (*cand)[*len].iz = iz;
+  (*cand)[*len].dd = dd;
+  (*cand)[*len].r = r;
+  (*len)++;
+
+  return;
+}
+
+/****************************************************************
+ *
+ *  find the neighbors of atom i by checking all atoms
+ *  of the configuration in all periodic images,
+ *  they are appended to the len candidates already in the list
+ *
+ ****************************************************************/
+
+static int find_neighbors_all(int i, int first, int count, int *cell_scale, int len,
+  neigh_cand_t **cand, int *size)
+{
+  int   j, ix, iy, iz;
+  double r, rc;
+  vector d, dd;
+
+  /* loop over all atoms for threebody interactions */
+#ifdef THREEBODY
+  for (j = first; j < first + count; j++) {
+#else
+  for (j = i; j < first + count; j++) {
+#endif /* THREEBODY */
+    rc = rcut[atoms[i].type * ntypes + atoms[j].type];
+    d.x = atoms[j].pos.x - atoms[i].pos.x;
+    d.y = atoms[j].pos.y - atoms[i].pos.y;
+    d.z = atoms[j].pos.z - atoms[i].pos.z;
+    for (ix = -cell_scale[0]; ix <= cell_scale[0]; ix++) {
+      for (iy = -cell_scale[1]; iy <= cell_scale[1]; iy++) {
+	for (iz = -cell_scale[2]; iz <= cell_scale[2]; iz++) {
+	  if ((i == j) && (ix == 0) && (iy == 0) && (iz == 0))
+	    continue;
+	  dd.x = d.x + ix * box_x.x + iy * box_y.x + iz * box_z.x;
+	  dd.y = d.y + ix * box_x.y + iy * box_y.y + iz * box_z.y;
+	  dd.z = d.z + ix * box_x.z + iy * box_y.z + iz * box_z.z;
+	  r = sqrt(SPROD(dd, dd));
+	  if (r <= rc)
+	    add_candidate(j, ix, iy, iz, dd, r, cand, &len, size);
+	}
+      }
+    }
+  }
+
+  return len;
+}
+
+/****************************************************************
+ *
+ *  sort the neighbor candidates by atom and periodic image,
+ *  the same order in which find_neighbors_all() finds them
+ *
+ ****************************************************************/
+
+static int compare_candidates(const void *a, const void *b)
+{
+  const neigh_cand_t *ca = (const neigh_cand_t *)a;
+  const neigh_cand_t *cb = (const neigh_cand_t *)b;
+
+  if (ca->nr != cb->nr)
+    return (ca->nr < cb->nr) ? -1 : 1;
+  if (ca->ix != cb->ix)
+    return (ca->ix < cb->ix) ? -1 : 1;
+  if (ca->iy != cb->iy)
+    return (ca->iy < cb->iy) ? -1 : 1;
+  if (ca->iz != cb->iz)
+    return (ca->iz < cb->iz) ? -1 : 1;
+  return 0;
+}
+
+/****************************************************************
+ *
+ *  sort the atoms of a configuration into a linked cell list,
+ *  the box is divided along the (possibly triclinic) box vectors
+ *  into cells which are at least rcutmax wide
+ *
+ ****************************************************************/
+
+static void make_cell_list(cell_list_t *cl, int first, int count, vector iheight)
+{
+  int   i, k, c, ncells;
+  int  *cell, *wrap;
+  double s[3], ih[3];
+
+  ih[0] = iheight.x;
+  ih[1] = iheight.y;
+  ih[2] = iheight.z;
+
+  for (k = 0; k < 3; k++) {
+    /* keep a small margin, so rounding never hides a neighbor */
+    cl->nc[k] = (int)floor(1.0 / (rcutmax * ih[k] * (1.0 + 1e-9)));
+    cl->nc[k] = MAX(cl->nc[k], 1);
+  }
+  /* do not use many more cells than atoms */
+  while (cl->nc[0] * cl->nc[1] * cl->nc[2] > MAX(count, 8)) {
+    k = (cl->nc[0] >= cl->nc[1]) ? 0 : 1;
+    k = (cl->nc[k] >= cl->nc[2]) ? k : 2;
+    cl->nc[k] = (cl->nc[k] + 1) / 2;
+  }
+  for (k = 0; k < 3; k++)
+    cl->range[k] = (int)ceil(rcutmax * ih[k] * cl->nc[k]);
+
+  ncells = cl->nc[0] * cl->nc[1] * cl->nc[2];
+  cl->head = (int *)malloc(ncells * sizeof(int));
+  cl->next = (int *)malloc(count * sizeof(int));
+  cl->cell = (int *)malloc(3 * count * sizeof(int));
+  cl->wrap = (int *)malloc(3 * count * sizeof(int));
+  if (NULL == cl->head || NULL == cl->next || NULL == cl->cell || NULL == cl->wrap)
+    error(1, "Cannot allocate memory for cell list");
+
+  for (c = 0; c < ncells; c++)
+    cl->head[c] = -1;
+
+  /* insert in reverse order, so every cell lists its atoms in ascending order */
+  for (i = count - 1; i >= 0; i--) {
+    cell = cl->cell + 3 * i;
+    wrap = cl->wrap + 3 * i;
+    s[0] = SPROD(atoms[first + i].pos, tbox_x);
+    s[1] = SPROD(atoms[first + i].pos, tbox_y);
+    s[2] = SPROD(atoms[first + i].pos, tbox_z);
+    for (k = 0; k < 3; k++) {
+      wrap[k] = (int)floor(s[k]);
+      cell[k] = (int)((s[k] - wrap[k]) * cl->nc[k]);
+      cell[k] = MIN(MAX(cell[k], 0), cl->nc[k] - 1);
+    }
+    c = (cell[0] * cl->nc[1] + cell[1]) * cl->nc[2] + cell[2];
+    cl->next[i] = cl->head[c];
+    cl->head[c] = i;
+  }
+
+  return;
+}
+
+/****************************************************************
+ *
+ *  free the arrays of a cell list
+ *
+ ****************************************************************/
+
+static void free_cell_list(cell_list_t *cl)
+{
+  free(cl->head);
+  free(cl->next);
+  free(cl->cell);
+  free(cl->wrap);
+
+  return;
+}
+
+/****************************************************************
+ *
+ *  find the neighbors of atom i with a cell list, only the
+ *  surrounding cells are searched, the result is identical
+ *  to find_neighbors_all()
+ *
+ ****************************************************************/
+
+static int find_neighbors_cells(cell_list_t *cl, int i, int first, int *cell_scale, int len,
+  neigh_cand_t **cand, int *size)
+{
+  int   j, k, c, ix, iy, iz;
+  int   dc[3], nb[3], w[3];
+  int   start = len;
+  int  *cell = cl->cell + 3 * (i - first);
+  int  *wrap = cl->wrap + 3 * (i - first);
+  double r;
+  vector d, dd;
+
+  for (dc[0] = -cl->range[0]; dc[0] <= cl->range[0]; dc[0]++) {
+    for (dc[1] = -cl->range[1]; dc[1] <= cl->range[1]; dc[1]++) {
+      for (dc[2] = -cl->range[2]; dc[2] <= cl->range[2]; dc[2]++) {
+	/* neighboring cell and the box vectors to get there */
+	for (k = 0; k < 3; k++) {
+	  nb[k] = cell[k] + dc[k];
+	  w[k] = (nb[k] >= 0) ? nb[k] / cl->nc[k] : -((cl->nc[k] - 1 - nb[k]) / cl->nc[k]);
+	  nb[k] -= w[k] * cl->nc[k];
+	}
+	c = (nb[0] * cl->nc[1] + nb[1]) * cl->nc[2] + nb[2];
+	for (j = cl->head[c]; j >= 0; j = cl->next[j]) {
+#ifndef THREEBODY
+	  if (first + j < i)
+	    continue;
+#endif /* THREEBODY */
+	  /* periodic image of atom j in terms of the unfolded positions */
+	  ix = w[0] - cl->wrap[3 * j] + wrap[0];
+	  iy = w[1] - cl->wrap[3 * j + 1] + wrap[1];
+	  iz = w[2] - cl->wrap[3 * j + 2] + wrap[2];
+	  if (abs(ix) > cell_scale[0] || abs(iy) > cell_scale[1] || abs(iz) > cell_scale[2])
+	    continue;
+	  if ((i == first + j) && (ix == 0) && (iy == 0) && (iz == 0))
+	    continue;
+	  d.x = atoms[first + j].pos.x - atoms[i].pos.x;
+	  d.y = atoms[first + j].pos.y - atoms[i].pos.y;
+	  d.z = atoms[first + j].pos.z - atoms[i].pos.z;
+	  dd.x = d.x + ix * box_x.x + iy * box_y.x + iz * box_z.x;
+	  dd.y = d.y + ix * box_x.y + iy * box_y.y + iz * box_z.y;
+	  dd.z = d.z + ix * box_x.z + iy * box_y.z + iz * box_z.z;
+	  r = sqrt(SPROD(dd, dd));
+	  if (r <= rcut[atoms[i].type * ntypes + atoms[first + j].type])
+	    add_candidate(first + j, ix, iy, iz, dd, r, cand, &len, size);
+	}
+      }
+    }
+  }
+
+  qsort(*cand + start, len - start, sizeof(neigh_cand_t), compare_candidates);
+
+  return len;
+}
+
+/* header of the binary configuration cache */
+#define CACHE_MAGIC "potfitcc"
+#define CACHE_VERSION 2
+
+typedef struct {
+  char  magic[8];		/* CACHE_MAGIC */
+  int   version;		/* CACHE_VERSION */
+  int   ntypes;			/* number of atom types */
+  uint64_t key;			/* hash of the config file and the settings */
+  int   nconf;			/* number of configurations */
+  int   natoms;			/* number of atoms */
+  int   total_neigh;		/* number of neighbors */
+  int   total_angl;		/* number of angles */
+  int   maxneigh;		/* maximum number of neighbors */
+  int   max_type;		/* largest atom type */
+  int   w_force;		/* configurations with forces */
+  int   w_stress;		/* configurations with stresses */
+  int   have_elements;		/* element names were given */
+  int   have_small_box;		/* additional periodic images are needed */
+} cache_header_t;
+
+/****************************************************************
+ *
+ *  FNV-1a hash of len bytes, continuing from hash h
+ *
+ ****************************************************************/
+
+static uint64_t fnv_hash(uint64_t h, const void *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+
+  return h;
+}
+
+/****************************************************************
+ *
+ *  config_cache_key: hash of everything the neighbor tables
+ *	depend on - the contents of the config file, the cutoff
+ *	radii, the layout of the data structures and the sampling
+ *	points of the potential table used for the slots
+ *
+ ****************************************************************/
+
+static uint64_t config_cache_key(FILE *infile)
+{
+  char  buffer[65536];
+  int   settings[8];
+  size_t len;
+  uint64_t h = 14695981039346656037ULL;
+
+  while (0 < (len = fread(buffer, 1, sizeof(buffer), infile)))
+    h = fnv_hash(h, buffer, len);
+  if (ferror(infile))
+    error(1, "Error while reading the config file %s", config);
+  rewind(infile);
+
+  settings[0] = ntypes;
+  settings[1] = SLOTS;
+  settings[2] = sizeof(atom_t);
+  settings[3] = sizeof(neigh_t);
+#ifdef THREEBODY
+  settings[4] = sizeof(angl);
+#else
+  settings[4] = 0;
+#endif /* THREEBODY */
+  settings[5] = neigh_cells;
+  settings[6] = format;
+  settings[7] = calc_pot.ncols;
+  h = fnv_hash(h, settings, sizeof(settings));
+  h = fnv_hash(h, interaction_name, strlen(interaction_name));
+  h = fnv_hash(h, rcut, ntypes * ntypes * sizeof(double));
+  h = fnv_hash(h, rmin, ntypes * ntypes * sizeof(double));
+  h = fnv_hash(h, calc_pot.begin, calc_pot.ncols * sizeof(double));
+  h = fnv_hash(h, calc_pot.end, calc_pot.ncols * sizeof(double));
+  h = fnv_hash(h, calc_pot.step, calc_pot.ncols * sizeof(double));
+  h = fnv_hash(h, calc_pot.invstep, calc_pot.ncols * sizeof(double));
+  h = fnv_hash(h, calc_pot.first, calc_pot.ncols * sizeof(int));
+  h = fnv_hash(h, calc_pot.last, calc_pot.ncols * sizeof(int));
+  if (4 == format)
+    h = fnv_hash(h, calc_pot.xcoord, calc_pot.len * sizeof(double));
+
+  return h;
+}
+
+/****************************************************************
+ *
+ *  size of the neighbor (or angle) block of configuration h
+ *
+ ****************************************************************/
+
+static int conf_neighbors(int h)
+{
+  int   i, n = 0;
+
+  for (i = cnfstart[h]; i < cnfstart[h] + inconf[h]; i++)
+    n += atoms[i].num_neigh;
+
+  return n;
+}
+
+#ifdef THREEBODY
+
+static int conf_angles(int h)
+{
+  int   i, n = 0;
+
+  for (i = cnfstart[h]; i < cnfstart[h] + inconf[h]; i++)
+    n += atoms[i].num_angl;
+
+  return n;
+}
+
+#endif /* THREEBODY */
+
+/****************************************************************
+ *
+ *  write_config_cache: store the configurations and their
+ *	neighbor tables in the file config_cache, failures are
+ *	not fatal since the cache is only an optimization
+ *
+ ****************************************************************/
+
+static void write_config_cache(cache_header_t *hdr, double *mindist)
+{
+  int   i, h, ok = 1;
+  FILE *outfile;
+
+  outfile = fopen(config_cache, "wb");
+  if (NULL == outfile) {
+    warning(1, "Could not open the config cache %s for writing", config_cache);
+    return;
+  }
+
+  memcpy(hdr->magic, CACHE_MAGIC, 8);
+  hdr->version = CACHE_VERSION;
+  hdr->ntypes = ntypes;
+  hdr->nconf = nconf;
+  hdr->natoms = natoms;
+  hdr->maxneigh = maxneigh;
+  hdr->have_elements = have_elements;
+
+  ok &= (1 == fwrite(hdr, sizeof(cache_header_t), 1, outfile));
+  for (i = 0; i < ntypes; i++)
+    ok &= (3 == fwrite(elements[i], 1, 3, outfile));
+  ok &= (ntypes * ntypes == fwrite(mindist, sizeof(double), ntypes * ntypes, outfile));
+  ok &= (nconf == fwrite(coheng, sizeof(double), nconf, outfile));
+  ok &= (nconf == fwrite(conf_weight, sizeof(double), nconf, outfile));
+  ok &= (nconf == fwrite(volume, sizeof(double), nconf, outfile));
+#ifdef COULOMB
+  ok &= (3 * nconf == fwrite(boxes, sizeof(vector), 3 * nconf, outfile));
+#endif /* COULOMB */
+  ok &= (nconf == fwrite(stress, sizeof(sym_tens), nconf, outfile));
+  ok &= (nconf == fwrite(inconf, sizeof(int), nconf, outfile));
+  ok &= (nconf == fwrite(cnfstart, sizeof(int), nconf, outfile));
+  ok &= (nconf == fwrite(useforce, sizeof(int), nconf, outfile));
+  ok &= (nconf == fwrite(usestress, sizeof(int), nconf, outfile));
+  for (h = 0; h < nconf; h++)
+    ok &= (ntypes == fwrite(na_type[h], sizeof(int), ntypes, outfile));
+  /* the pointers in atom_t are restored from num_neigh and num_angl */
+  ok &= (natoms == fwrite(atoms, sizeof(atom_t), natoms, outfile));
+  for (h = 0; h < nconf; h++) {
+    i = conf_neighbors(h);
+    ok &= (i == fwrite(atoms[cnfstart[h]].neigh, sizeof(neigh_t), i, outfile));
+  }
+#ifdef THREEBODY
+  for (h = 0; h < nconf; h++) {
+    i = conf_angles(h);
+    ok &= (i == fwrite(atoms[cnfstart[h]].angl_part, sizeof(angl), i, outfile));
+  }
+#endif /* THREEBODY */
+
+  if (0 != fclose(outfile))
+    ok = 0;
+  if (!ok) {
+    remove(config_cache);
+    warning(1, "Could not write the config cache %s", config_cache);
+  }
+
+  return;
+}
+
+/****************************************************************
+ *
+ *  read_config_cache: restore the configurations from the file
+ *	config_cache if it matches the given key, returns 0 if it
+ *	does not exist or is outdated
+ *
+ *	The file is mapped into memory and copied, the tables have
+ *	to live in separate blocks since they are modified and
+ *	released later on.
+ *
+ ****************************************************************/
+
+static int read_config_cache(uint64_t key, cache_header_t *hdr, double *mindist)
+{
+  int   fd, h, i, n;
+  char *map, *ptr;
+  size_t size;
+  struct stat st;
+  neigh_t *neigh_block;
+#ifdef THREEBODY
+  angl *angl_block;
+#endif /* THREEBODY */
+
+  fd = open(config_cache, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(cache_header_t)) {
+    close(fd);
+    return 0;
+  }
+  map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == map)
+    return 0;
+
+  memcpy(hdr, map, sizeof(cache_header_t));
+  if (0 != memcmp(hdr->magic, CACHE_MAGIC, 8) || CACHE_VERSION != hdr->version
+    || ntypes != hdr->ntypes || key != hdr->key) {
+    munmap(map, st.st_size);
+    return 0;
+  }
+
+  nconf = hdr->nconf;
+  natoms = hdr->natoms;
+  size = sizeof(cache_header_t) + 3 * ntypes + ntypes * ntypes * sizeof(double);
+  size += nconf * (3 * sizeof(double) + sizeof(sym_tens) + 4 * sizeof(int));
+  size += nconf * ntypes * sizeof(int) + natoms * sizeof(atom_t);
+#ifdef COULOMB
+  size += 3 * nconf * sizeof(vector);
+#endif /* COULOMB */
+  size += (size_t) hdr->total_neigh * sizeof(neigh_t);
+#ifdef THREEBODY
+  size += (size_t) hdr->total_angl * sizeof(angl);
+#endif /* THREEBODY */
+  if (size != (size_t) st.st_size) {
+    munmap(map, st.st_size);
+    nconf = 0;
+    natoms = 0;
+    warning(1, "The config cache %s is corrupt, it will be rebuilt", config_cache);
+    return 0;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  ptr = map + sizeof(cache_header_t);
+
+  for (i = 0; i < ntypes; i++) {
+    memcpy(elements[i], ptr, 3);
+    ptr += 3;
+  }
+  have_elements = hdr->have_elements;
+  maxneigh = hdr->maxneigh;
+  memcpy(mindist, ptr, ntypes * ntypes * sizeof(double));
+  ptr += ntypes * ntypes * sizeof(double);
+
+  coheng = (double *)malloc(nconf * sizeof(double));
+  conf_weight = (double *)malloc(nconf * sizeof(double));
+  volume = (double *)malloc(nconf * sizeof(double));
+  stress = (sym_tens *)malloc(nconf * sizeof(sym_tens));
+  inconf = (int *)malloc(nconf * sizeof(int));
+  cnfstart = (int *)malloc(nconf * sizeof(int));
+  useforce = (int *)malloc(nconf * sizeof(int));
+  usestress = (int *)malloc(nconf * sizeof(int));
+  na_type = (int **)malloc((nconf + 1) * sizeof(int *));
+  atoms = (atom_t *)malloc(natoms * sizeof(atom_t));
+  if (NULL == coheng || NULL == conf_weight || NULL == volume || NULL == stress || NULL == inconf
+    || NULL == cnfstart || NULL == useforce || NULL == usestress || NULL == na_type || NULL == atoms)
+    error(1, "Cannot allocate memory for the configurations");
+#ifdef COULOMB
+  boxes = (vector *)malloc(3 * nconf * sizeof(vector));
+  if (NULL == boxes)
+    error(1, "Cannot allocate memory for the box vectors");
+#endif /* COULOMB */
+
+  memcpy(coheng, ptr, nconf * sizeof(double));
+  ptr += nconf * sizeof(double);
+  memcpy(conf_weight, ptr, nconf * sizeof(double));
+  ptr += nconf * sizeof(double);
+  memcpy(volume, ptr, nconf * sizeof(double));
+  ptr += nconf * sizeof(double);
+#ifdef COULOMB
+  memcpy(boxes, ptr, 3 * nconf * sizeof(vector));
+  ptr += 3 * nconf * sizeof(vector);
+#endif /* COULOMB */
+  memcpy(stress, ptr, nconf * sizeof(sym_tens));
+  ptr += nconf * sizeof(sym_tens);
+  memcpy(inconf, ptr, nconf * sizeof(int));
+  ptr += nconf * sizeof(int);
+  memcpy(cnfstart, ptr, nconf * sizeof(int));
+  ptr += nconf * sizeof(int);
+  memcpy(useforce, ptr, nconf * sizeof(int));
+  ptr += nconf * sizeof(int);
+  memcpy(usestress, ptr, nconf * sizeof(int));
+  ptr += nconf * sizeof(int);
+  for (h = 0; h < nconf; h++) {
+    na_type[h] = (int *)malloc(ntypes * sizeof(int));
+    if (NULL == na_type[h])
+      error(1, "Cannot allocate memory for na_type");
+    reg_for_free(na_type[h], "na_type[%d]", h);
+    memcpy(na_type[h], ptr, ntypes * sizeof(int));
+    ptr += ntypes * sizeof(int);
+  }
+  memcpy(atoms, ptr, natoms * sizeof(atom_t));
+  ptr += natoms * sizeof(atom_t);
+
+  /* one neighbor block per configuration, as in read_config() */
+  for (h = 0; h < nconf; h++) {
+    n = conf_neighbors(h);
+    neigh_block = (neigh_t *)malloc(MAX(n, 1) * sizeof(neigh_t));
+    if (NULL == neigh_block)
+      error(1, "Cannot allocate memory for neighbor table of configuration %d", h);
+#if !defined NEIGH_TABLE && !defined MPI
+    reg_for_free(neigh_block, "neighbor table configuration %d", h);
+#endif /* !NEIGH_TABLE && !MPI */
+    memcpy(neigh_block, ptr, n * sizeof(neigh_t));
+    ptr += n * sizeof(neigh_t);
+    for (i = cnfstart[h]; i < cnfstart[h] + inconf[h]; i++) {
+      atoms[i].neigh = neigh_block;
+      neigh_block += atoms[i].num_neigh;
+    }
+  }
+
+#ifdef THREEBODY
+  for (h = 0; h < nconf; h++) {
+    n = conf_angles(h);
+    angl_block = (angl *) malloc(MAX(n, 1) * sizeof(angl));
+    if (NULL == angl_block)
+      error(1, "Cannot allocate memory for angular part of configuration %d", h);
+#ifndef MPI
+    reg_for_free(angl_block, "angular part configuration %d", h);
+#endif /* !MPI */
+    memcpy(angl_block, ptr, n * sizeof(angl));
+    ptr += n * sizeof(angl);
+    for (i = cnfstart[h]; i < cnfstart[h] + inconf[h]; i++) {
+      atoms[i].angl_part = angl_block;
+      angl_block += atoms[i].num_angl;
+    }
+  }
+#endif /* THREEBODY */
+
+  munmap(map, st.st_size);
+
+  return 1;
+}
+
+/* position of a configuration in the config file */
+typedef struct {
+  long  offset;			/* byte offset of the first line */
+  int   line;			/* number of the first line */
+  int   count;			/* number of atoms */
+  int   use_force;		/* use the forces of this configuration */
+  int   tag_format;		/* new file format (with tags) */
+} conf_pos_t;
+
+/* results of read_conf(), combined over all configurations of a thread */
+typedef struct {
+  int   total_neigh;		/* number of neighbors */
+  int   total_angl;		/* number of angles */
+  int   max_neigh;		/* maximum number of neighbors */
+  int   max_type;		/* largest atom type */
+  int   w_force;		/* configurations with forces */
+  int   w_stress;		/* configurations with stresses */
+  int   have_small_box;		/* additional periodic images are needed */
+  int   sh_dist;		/* last configuration with a short distance */
+  double t_neigh;		/* time spent on the neighbor tables */
+  double *mindist;		/* minimal distances */
+  neigh_cand_t *cand;		/* candidate list, reused for all configurations */
+  int   cand_size;		/* allocated size of the candidate list */
+} conf_reader_t;
+
+/****************************************************************
+ *
+ *  check_elements: compare the element names of a #C line with
+ *	those of the previous configurations, the first one sets
+ *	the element names
+ *
+ ****************************************************************/
+
+static void check_elements(char *res, int conf, int line, int *fixed_elements)
+{
+  char  msg[255];
+  char *ptr, *tmp, *res_tmp;
+  int   i, j, str_len;
+
+  if (!have_elements) {
+    i = 0;
+    for (j = 0; j < ntypes; j++) {
+      res_tmp = res + 3 + i;
+      if (strchr(res_tmp, ' ') != NULL && strlen(res_tmp) > 0) {
+	tmp = strchr(res_tmp, ' ');
+	str_len = tmp - res_tmp + 1;
+	strncpy(elements[j], res_tmp, str_len - 1);
+	elements[j][str_len - 1] = '\0';
+	i += str_len;
+      } else if (strlen(res_tmp) >= 1) {
+	if ((ptr = strchr(res_tmp, '\n')) != NULL)
+	  *ptr = '\0';
+	strcpy(elements[j], res_tmp);
+	i += strlen(res_tmp);
+	*fixed_elements = j;
+      } else
+	break;
+    }
+    have_elements = 1;
+  } else {
+    i = 0;
+    for (j = 0; j < ntypes; j++) {
+      res_tmp = res + 3 + i;
+      if (strchr(res_tmp, ' ') != NULL && strlen(res_tmp) > 0) {
+	/* more than one element left */
+	tmp = strchr(res_tmp, ' ');
+	str_len = tmp - res_tmp + 1;
+	strncpy(msg, res_tmp, str_len - 1);
+	msg[str_len - 1] = '\0';
+	i += str_len;
+	if (strcmp(msg, elements[j]) != 0) {
+	  if (atoi(elements[j]) == j && j > *fixed_elements) {
+	    strcpy(elements[j], msg);
+	    (*fixed_elements)++;
+	  } else {
+	    /* Fix newline at the end of a string */
+	    if ((ptr = strchr(msg, '\n')) != NULL)
+	      *ptr = '\0';
+	    error(0, "Mismatch found in configuration %d, line %d.\n", conf, line);
+	    error(0, "Expected element >> %s << but found element >> %s <<.\n", elements[j], msg);
+	    error(0, "You can use list_config to identify that configuration.\n");
+	    error(1, "Please check your configuration files!\n");
+	  }
+	}
+      } else if (strlen(res_tmp) > 1) {
+	strcpy(msg, res_tmp);
+	if ((ptr = strchr(msg, '\n')) != NULL)
+	  *ptr = '\0';
+	i += strlen(msg);
+	if (strcmp(msg, elements[j]) != 0) {
+	  if (atoi(elements[j]) == j && j > *fixed_elements) {
+	    strcpy(elements[j], msg);
+	    (*fixed_elements)++;
+	  } else {
+	    /* Fix newline at the end of a string */
+	    if ((ptr = strchr(msg, '\n')) != NULL)
+	      *ptr = '\0';
+	    error(0, "Mismatch found in configuration %d on line %d.\n", conf, line);
+	    error(0, "Expected element >> %s << but found element >> %s <<.\n", elements[j], msg);
+	    error(0, "You can use list_config to identify that configuration.\n");
+	    error(1, "Please check your configuration files!");
+	  }
+	}
+      } else
+	break;
+    }
+  }
+
+  return;
+}
+
+/****************************************************************
+ *
+ *  scan_config: first pass over the config file, records where
+ *	each configuration starts and how many atoms it has.
+ *	Only the header lines are interpreted, the element names
+ *	are checked here since this depends on the order of the
+ *	configurations. Returns the number of configurations.
+ *
+ ****************************************************************/
+
+static int scan_config(FILE *infile, char *filename, conf_pos_t **pos)
+{
+  char  buffer[1024];
+  char *res, *ptr;
+  int   i, n = 0, size = 0;
+  int   line = 0;
+  int   fixed_elements = 0;
+  long  offset;
+  conf_pos_t *p;
+
+  while (1) {
+    /* skip empty lines between configurations */
+    do {
+      offset = ftell(infile);
+      res = fgets(buffer, 1024, infile);
+      line++;
+    } while (NULL != res && strspn(res, " \t\r\n") == strlen(res));
+    if (NULL == res) {
+      if (0 == n)
+	error(1, "Unexpected end of file in %s", filename);
+      break;
+    }
+
+    if (n == size) {
+      size = MAX(2 * size, 64);
+      *pos = (conf_pos_t *) realloc(*pos, size * sizeof(conf_pos_t));
+      if (NULL == *pos)
+	error(1, "Cannot allocate memory for the configuration offsets");
+    }
+    p = *pos + n;
+    p->offset = offset;
+    p->line = line;
+
+    if (res[0] == '#') {	/* new file format (with tags) */
+      p->tag_format = 1;
+      if (res[1] == 'N') {	/* Atom number line */
+	if (sscanf(res + 3, "%d %d", &p->count, &p->use_force) < 2)
+	  error(1, "%s: Error in atom number specification on line %d\n", filename, line);
+      } else
+	error(1, "%s: Number of atoms missing on line %d\n", filename, line);
+      /* header lines up to #F */
+      do {
+	res = fgets(buffer, 1024, infile);
+	line++;
+	if (NULL == res)
+	  error(1, "Unexpected end of file in %s", filename);
+	if ((ptr = strchr(res, '\n')) != NULL)
+	  *ptr = '\0';
+	if (res[1] == 'C')
+	  check_elements(res, n, line, &fixed_elements);
+      } while (res[1] != 'F');
+    } else {
+      /* number of atoms in this configuration */
+      p->tag_format = 0;
+      p->use_force = 1;
+      if (1 > sscanf(buffer, "%d", &p->count))
+	error(1, "Unexpected end of file in %s", filename);
+      /* box vectors, cohesive energy and stress tensor */
+      for (i = 0; i < 5; i++) {
+	if (NULL == fgets(buffer, 1024, infile))
+	  error(1, "Unexpected end of file in %s", filename);
+	line++;
+      }
+    }
+
+    /* check if there are enough atoms, 2 for pair and 3 for manybody potentials */
+#ifndef THREEBODY
+    if (2 > p->count)
+      error(1, "The configuration %d (starting on line %d) has not enough atoms. Please remove it.",
+	n + 1, p->line);
+#else
+    if (3 > p->count)
+      error(1, "The configuration %d (starting on line %d) has not enough atoms. Please remove it.",
+	n + 1, p->line);
+#endif /* THREEBODY */
+
+    /* skip the atoms */
+    for (i = 0; i < p->count;) {
+      if (NULL == fgets(buffer, 1024, infile))
+	error(1, "Unexpected end of file in %s", filename);
+      line++;
+      if (strspn(buffer, " \t\r\n") < strlen(buffer))
+	i++;
+    }
+    n++;
+  }
+
+  return n;
+}
+
+/****************************************************************
+ *
+ *  read_conf: second pass, read configuration h at position pos
+ *	and compute its neighbor tables. The configurations are
+ *	independent of each other, the arrays for all of them
+ *	are allocated by read_config().
+ *
+ ****************************************************************/
+
+static void read_conf(FILE *infile, char *filename, int h, conf_pos_t *pos, conf_reader_t *rd)
+{
+  atom_t *atom;
+  char  buffer[1024];
+  char *res, *ptr;
+  int   count = pos->count, first = cnfstart[h];
+  int   i, j, k, n;
+  int   type1, type2, col, slot, klo, khi;
+  int   cell_scale[3];
+  int   ncand;
+  int  *cand_start;
+  int   h_stress = 0, h_eng = 0, h_boxx = 0, h_boxy = 0, h_boxz = 0;
+#ifdef CONTRIB
+  int   have_contrib = 0;
+#endif /* CONTRIB */
+  int   line = pos->line;
+  int   sh_dist = 0;		/* short distance flag */
+  double r, rr, istep, shift, step;
+  double t_start;
+  sym_tens *stresses;
+  vector dd, iheight;
+  neigh_t *neigh_block;
+  cell_list_t cells = { {1, 1, 1}, {0, 0, 0}, NULL, NULL, NULL, NULL };
+#ifdef THREEBODY
+  int   ijk;
+  int   nnn;
+  int   nangl;
+  double ccos;
+  angl *angl_block;
+#endif /* THREEBODY */
+
+  /* the first line was already interpreted by scan_config() */
+  fseek(infile, pos->offset, SEEK_SET);
+  if (NULL == fgets(buffer, 1024, infile))
+    error(1, "Unexpected end of file in %s", filename);
+
+  for (i = first; i < first + count; i++) {
+    atoms[i].type = 0;
+    atoms[i].num_neigh = 0;
+    atoms[i].pos.x = 0.0;
+    atoms[i].pos.y = 0.0;
+    atoms[i].pos.z = 0.0;
+    atoms[i].force.x = 0.0;
+    atoms[i].force.y = 0.0;
+    atoms[i].force.z = 0.0;
+    atoms[i].absforce = 0.0;
+    atoms[i].conf = 0;
+
+#ifdef CONTRIB
+    atoms[i].contrib = 0;
+#endif /* CONTRIB */
+
+#if defined EAM || defined ADP || defined MEAM
+    atoms[i].rho = 0.0;
+    atoms[i].gradF = 0.0;
+#endif /* EAM || ADP || MEAM */
+
+#ifdef ADP
+    atoms[i].mu.x = 0.0;
+    atoms[i].mu.y = 0.0;
+    atoms[i].mu.z = 0.0;
+    atoms[i].lambda.xx = 0.0;
+    atoms[i].lambda.yy = 0.0;
+    atoms[i].lambda.zz = 0.0;
+    atoms[i].lambda.xy = 0.0;
+    atoms[i].lambda.yz = 0.0;
+    atoms[i].lambda.zx = 0.0;
+#endif /* ADP */
+
+#ifdef DIPOLE
+    atoms[i].E_stat.x = 0.0;
+    atoms[i].E_stat.y = 0.0;
+    atoms[i].E_stat.z = 0.0;
+    atoms[i].p_sr.x = 0.0;
+    atoms[i].p_sr.y = 0.0;
+    atoms[i].p_sr.z = 0.0;
+    atoms[i].E_ind.x = 0.0;
+    atoms[i].E_ind.y = 0.0;
+    atoms[i].E_ind.z = 0.0;
+    atoms[i].p_ind.x = 0.0;
+    atoms[i].p_ind.y = 0.0;
+    atoms[i].p_ind.z = 0.0;
+#endif /* DIPOLE */
+
+#ifdef THREEBODY
+    atoms[i].num_angl = 0;
+#ifdef MEAM
+    atoms[i].rho_eam = 0.0;
+#endif /* MEAM */
+#endif /* MANYBODY */
+
+    atoms[i].neigh = NULL;
+#ifdef THREEBODY
+    atoms[i].angl_part = NULL;
+#endif /* THREEBODY */
+  }
+
+  for (i = 0; i < ntypes; i++)
+    na_type[h][i] = 0;
+
+  useforce[h] = pos->use_force;
+  stresses = stress + h;
+#ifdef CONTRIB
+  have_contrib = 0;
+  have_contrib_box = 0;
+#endif /* CONTRIB */
+
+  if (pos->tag_format) {
+    do {
+      res = fgets(buffer, 1024, infile);
+      if ((ptr = strchr(res, '\n')) != NULL)
+	*ptr = '\0';
+      line++;
+      /* read the box vectors */
+      if (res[1] == 'X') {
+	if (sscanf(res + 3, "%lf %lf %lf\n", &box_x.x, &box_x.y, &box_x.z) == 3)
+	  h_boxx++;
+	else
+	  error(1, "%s: Error in box vector x, line %d\n", filename, line);
+      } else if (res[1] == 'Y') {
+	if (sscanf(res + 3, "%lf %lf %lf\n", &box_y.x, &box_y.y, &box_y.z) == 3)
+	  h_boxy++;
+	else
+	  error(1, "%s: Error in box vector y, line %d\n", filename, line);
+      } else if (res[1] == 'Z') {
+	if (sscanf(res + 3, "%lf %lf %lf\n", &box_z.x, &box_z.y, &box_z.z) == 3)
+	  h_boxz++;
+	else
+	  error(1, "%s: Error in box vector z, line %d\n", filename, line);
+
+#ifdef CONTRIB
+	/* box of contributing particles */
+      } else if (strncmp(res + 1, "B_O", 3) == 0) {
+	if (1 == have_contrib_box) {
+	  error(0, "There can only be one box of contributing atoms\n");
+	  error(1, "This occured in %s on line %d", filename, line);
+	}
+	if (sscanf(res + 5, "%lf %lf %lf\n", &cbox_o.x, &cbox_o.y, &cbox_o.z) == 3) {
+	  have_contrib_box = 1;
+	  have_contrib++;
+	} else
+	  error(1, "%s: Error in box of contributing atoms, line %d\n", filename, line);
+      } else if (strncmp(res + 1, "B_A", 3) == 0) {
+	if (sscanf(res + 5, "%lf %lf %lf\n", &cbox_a.x, &cbox_a.y, &cbox_a.z) == 3) {
+	  have_contrib++;
+	} else
+	  error(1, "%s: Error in box of contributing atoms, line %d\n", filename, line);
+      } else if (strncmp(res + 1, "B_B", 3) == 0) {
+	if (sscanf(res + 5, "%lf %lf %lf\n", &cbox_b.x, &cbox_b.y, &cbox_b.z) == 3) {
+	  have_contrib++;
+	} else
+	  error(1, "%s: Error in box of contributing atoms, line %d\n", filename, line);
+      } else if (strncmp(res + 1, "B_C", 3) == 0) {
+	if (sscanf(res + 5, "%lf %lf %lf\n", &cbox_c.x, &cbox_c.y, &cbox_c.z) == 3) {
+	  have_contrib++;
+	} else
+	  error(1, "%s: Error in box of contributing atoms, line %d\n", filename, line);
+
+	/* sphere of contributing particles */
+      } else if (strncmp(res + 1, "B_S", 3) == 0) {
+	sphere_centers = (vector *)realloc(sphere_centers, (n_spheres + 1) * sizeof(vector));
+	r_spheres = (double *)realloc(r_spheres, (n_spheres + 1) * sizeof(double));
+	if (sscanf(res + 5, "%lf %lf %lf %lf\n", &sphere_centers[n_spheres].x,
+	    &sphere_centers[n_spheres].y, &sphere_centers[n_spheres].z, &r_spheres[n_spheres]) == 4) {
+	  n_spheres++;
+	} else
+	  error(1, "%s: Error in sphere of contributing atoms, line %d\n", filename, line);
+#endif /* CONTRIB */
+
+	/* energy */
+      } else if (res[1] == 'E') {
+	if (sscanf(res + 3, "%lf\n", &(coheng[h])) == 1)
+	  h_eng++;
+	else
+	  error(1, "%s: Error in energy on line %d\n", filename, line);
+
+	/* configuration weight */
+      } else if (res[1] == 'W') {
+	if (sscanf(res + 3, "%lf\n", &(conf_weight[h])) != 1)
+	  error(1, "%s: Error in configuration weight on line %d\n", filename, line);
+      }
+#ifdef STRESS
+      /* read stress */
+      else if (res[1] == 'S') {
+	if (sscanf(res + 3, "%lf %lf %lf %lf %lf %lf\n", &(stresses->xx),
+	    &(stresses->yy), &(stresses->zz), &(stresses->xy), &(stresses->yz), &(stresses->zx)) == 6)
+	  h_stress++;
+	else
+	  error(1, "Error in stress tensor on line %d\n", line);
+      }
+#endif /* STRESS */
+
+    } while (res[1] != 'F');
+    if (!(h_eng && h_boxx && h_boxy && h_boxz))
+      error(1, "Incomplete box vectors for config %d!", h);
+#ifdef CONTRIB
+    if (have_contrib_box && have_contrib != 4)
+      error(1, "Incomplete box of contributing atoms for config %d!", h);
+#endif /* CONTRIB */
+    usestress[h] = h_stress;	/* no stress tensor available */
+  } else {
+    /* read the box vectors */
+    fscanf(infile, "%lf %lf %lf\n", &box_x.x, &box_x.y, &box_x.z);
+    fscanf(infile, "%lf %lf %lf\n", &box_y.x, &box_y.y, &box_y.z);
+    fscanf(infile, "%lf %lf %lf\n", &box_z.x, &box_z.y, &box_z.z);
+    line += 3;
+
+    /* read cohesive energy */
+    if (1 != fscanf(infile, "%lf\n", &(coheng[h])))
+      error(1, "Configuration file without cohesive energy -- old format!");
+    line++;
+
+    /* read stress tensor */
+    if (6 != fscanf(infile, "%lf %lf %lf %lf %lf %lf\n", &(stresses->xx),
+	&(stresses->yy), &(stresses->zz), &(stresses->xy), &(stresses->yz), &(stresses->zx)))
+      error(1, "No stresses given -- old format");
+    usestress[h] = 1;
+    line++;
+  }
+
+  if (usestress[h])
+    rd->w_stress++;
+  if (useforce[h])
+    rd->w_force++;
+
+  volume[h] = make_box();
+#ifdef COULOMB
+  boxes[3 * h + 0] = box_x;
+  boxes[3 * h + 1] = box_y;
+  boxes[3 * h + 2] = box_z;
+#endif /* COULOMB */
+
+  /* read the atoms */
+  for (i = 0; i < count; i++) {
+    atom = atoms + first + i;
+    if (7 > fscanf(infile, "%d %lf %lf %lf %lf %lf %lf\n", &(atom->type),
+	&(atom->pos.x), &(atom->pos.y), &(atom->pos.z), &(atom->force.x), &(atom->force.y),
+	&(atom->force.z)))
+      error(1, "Corrupt configuration file on line %d\n", line + 1);
+    line++;
+    if (atom->type >= ntypes || atom->type < 0)
+      error(1, "Corrupt configuration file on line %d: Incorrect atom type (%d)\n", line, atom->type);
+    atom->absforce = sqrt(dsquare(atom->force.x) + dsquare(atom->force.y) + dsquare(atom->force.z));
+    atom->conf = h;
+#ifdef CONTRIB
+    if (have_contrib_box || n_spheres != 0)
+      atom->contrib = does_contribute(atom->pos);
+    else
+      atom->contrib = 1;
+#endif
+    na_type[h][atom->type] += 1;
+    rd->max_type = MAX(rd->max_type, atom->type);
+  }
+
+  /* check cell size */
+  /* inverse height in direction */
+  iheight.x = sqrt(SPROD(tbox_x, tbox_x));
+  iheight.y = sqrt(SPROD(tbox_y, tbox_y));
+  iheight.z = sqrt(SPROD(tbox_z, tbox_z));
+
+  if ((ceil(rcutmax * iheight.x) > 30000)
+    || (ceil(rcutmax * iheight.y) > 30000)
+    || (ceil(rcutmax * iheight.z) > 30000))
+    error(1, "Very bizarre small cell size - aborting");
+
+  cell_scale[0] = (int)ceil(rcutmax * iheight.x);
+  cell_scale[1] = (int)ceil(rcutmax * iheight.y);
+  cell_scale[2] = (int)ceil(rcutmax * iheight.z);
+
+  if (cell_scale[0] > 1 || cell_scale[1] > 1 || cell_scale[2] > 1)
+    rd->have_small_box = 1;
+
+#ifdef DEBUG
+  fprintf(stderr, "Checking cell size for configuration %d:\n", h);
+  fprintf(stderr, "Box dimensions:\n");
+  fprintf(stderr, "     %10.6f %10.6f %10.6f\n", box_x.x, box_x.y, box_x.z);
+  fprintf(stderr, "     %10.6f %10.6f %10.6f\n", box_y.x, box_y.y, box_y.z);
+  fprintf(stderr, "     %10.6f %10.6f %10.6f\n", box_z.x, box_z.y, box_z.z);
+  fprintf(stderr, "Box normals:\n");
+  fprintf(stderr, "     %10.6f %10.6f %10.6f\n", tbox_x.x, tbox_x.y, tbox_x.z);
+  fprintf(stderr, "     %10.6f %10.6f %10.6f\n", tbox_y.x, tbox_y.y, tbox_y.z);
+  fprintf(stderr, "     %10.6f %10.6f %10.6f\n", tbox_z.x, tbox_z.y, tbox_z.z);
+  fprintf(stderr, "Box heights:\n");
+  fprintf(stderr, "     %10.6f %10.6f %10.6f\n", 1. / iheight.x, 1. / iheight.y, 1. / iheight.z);
+  fprintf(stderr, "Potential range:  %f\n", rcutmax);
+  fprintf(stderr, "Periodic images needed: %d %d %d\n\n",
+    2 * cell_scale[0] + 1, 2 * cell_scale[1] + 1, 2 * cell_scale[2] + 1);
+#endif /* DEBUG */
+
+  /* compute the neighbor table */
+  t_start = wall_time();
+
+  /* first pass: find the neighbors of all atoms of this configuration */
+  cand_start = (int *)malloc((count + 1) * sizeof(int));
+  if (NULL == cand_start)
+    error(1, "Cannot allocate memory for neighbor candidates");
+  if (neigh_cells)
+    make_cell_list(&cells, first, count, iheight);
+  ncand = 0;
+  for (i = first; i < first + count; i++) {
+    cand_start[i - first] = ncand;
+    if (neigh_cells)
+      ncand = find_neighbors_cells(&cells, i, first, cell_scale, ncand, &rd->cand, &rd->cand_size);
+    else
+      ncand = find_neighbors_all(i, first, count, cell_scale, ncand, &rd->cand, &rd->cand_size);
+  }
+  cand_start[count] = ncand;
+  if (neigh_cells)
+    free_cell_list(&cells);
+
+  /* second pass: one block holds the neighbors of the whole configuration */
+  neigh_block = (neigh_t *)malloc(MAX(ncand, 1) * sizeof(neigh_t));
+  if (NULL == neigh_block)
+    error(1, "Cannot allocate memory for neighbor table of configuration %d", h);
+#if !defined NEIGH_TABLE && !defined MPI
+  /* with NEIGH_TABLE it is released by pack_neighbors(),
+     with MPI by broadcast_neighbors() */
+#ifdef _OPENMP
+#pragma omp critical (reg_for_free)
+#endif /* _OPENMP */
+  reg_for_free(neigh_block, "neighbor table configuration %d", h);
+#endif /* !NEIGH_TABLE && !MPI */
+  rd->total_neigh += ncand;
+
+  for (i = first; i < first + count; i++) {
+    atoms[i].neigh = neigh_block + cand_start[i - first];
+    atoms[i].num_neigh = 0;
+    for (n = cand_start[i - first]; n < cand_start[i - first + 1]; n++) {
+      j = rd->cand[n].nr;
+      dd = rd->cand[n].dd;
+      r = rd->cand[n].r;
+      type1 = atoms[i].type;
+      type2 = atoms[j].type;
+      if (r <= rmin[type1 * ntypes + type2]) {
+	sh_dist = h;
+	fprintf(stderr, "Configuration %d: Distance %f\n", h, r);
+	fprintf(stderr, "atom %d (type %d) at pos: %f %f %f\n",
+	  i - first, type1, atoms[i].pos.x, atoms[i].pos.y, atoms[i].pos.z);
+	fprintf(stderr, "atom %d (type %d) at pos: %f %f %f\n", j - first, type2, dd.x, dd.y,
+	  dd.z);
+      }
+      dd.x /= r;
+      dd.y /= r;
+      dd.z /= r;
+      k = atoms[i].num_neigh++;
+      atoms[i].neigh[k].type = type2;
+      atoms[i].neigh[k].nr = j;
+      atoms[i].neigh[k].r = r;
+      atoms[i].neigh[k].r2 = r * r;
+      atoms[i].neigh[k].inv_r = 1.0 / r;
+      atoms[i].neigh[k].dist_r = dd;
+      atoms[i].neigh[k].dist.x = dd.x * r;
+      atoms[i].neigh[k].dist.y = dd.y * r;
+      atoms[i].neigh[k].dist.z = dd.z * r;
+#ifdef ADP
+      atoms[i].neigh[k].sqrdist.xx = dd.x * dd.x * r * r;
+      atoms[i].neigh[k].sqrdist.yy = dd.y * dd.y * r * r;
+      atoms[i].neigh[k].sqrdist.zz = dd.z * dd.z * r * r;
+      atoms[i].neigh[k].sqrdist.yz = dd.y * dd.z * r * r;
+      atoms[i].neigh[k].sqrdist.zx = dd.z * dd.x * r * r;
+      atoms[i].neigh[k].sqrdist.xy = dd.x * dd.y * r * r;
+#endif /* ADP */
+
+      col = (type1 <= type2) ? type1 * ntypes + type2 - ((type1 * (type1 + 1)) / 2)
+	: type2 * ntypes + type1 - ((type2 * (type2 + 1)) / 2);
+      atoms[i].neigh[k].col[0] = col;
+      rd->mindist[col] = MIN(rd->mindist[col], r);
+
+      /* pre-compute index and shift into potential table */
+
+      /* pair potential */
+      if (!sh_dist) {
+	if (format == 0 || format == 3) {
+	  rr = r - calc_pot.begin[col];
+	  if (rr < 0) {
+	    fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
+	    fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
+	    fflush(stdout);
+	    error(1, "Short distance!");
+	  }
+	  istep = calc_pot.invstep[col];
+	  slot = (int)(rr * istep);
+	  shift = (rr - slot * calc_pot.step[col]) * istep;
+	  slot += calc_pot.first[col];
+	  step = calc_pot.step[col];
+	} else {	/* format == 4 ! */
+	  klo = calc_pot.first[col];
+	  khi = calc_pot.last[col];
+	  /* bisection */
+	  while (khi - klo > 1) {
+	    slot = (khi + klo) >> 1;
+	    if (calc_pot.xcoord[slot] > r)
+	      khi = slot;
+	    else
+	      klo = slot;
+	  }
+	  slot = klo;
+	  step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
+	  shift = (r - calc_pot.xcoord[klo]) / step;
+
+	}
+	/* independent of format - we should be left of last index */
+	if (slot >= calc_pot.last[col]) {
+	  slot--;
+	  shift += 1.0;
+	}
+	atoms[i].neigh[k].shift[0] = shift;
+	atoms[i].neigh[k].slot[0] = slot;
+	atoms[i].neigh[k].step[0] = step;
+
+#if defined EAM || defined ADP || defined MEAM
+	/* transfer function */
+	col = paircol + type2;
+	atoms[i].neigh[k].col[1] = col;
+	if (format == 0 || format == 3) {
+	  rr = r - calc_pot.begin[col];
+	  if (rr < 0) {
+	    fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
+	    fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
+	    fflush(stdout);
+	    error(1, "short distance in config.c!");
+	  }
+	  istep = calc_pot.invstep[col];
+	  slot = (int)(rr * istep);
+	  shift = (rr - slot * calc_pot.step[col]) * istep;
+	  slot += calc_pot.first[col];
+	  step = calc_pot.step[col];
+	} else {	/* format == 4 ! */
+	  klo = calc_pot.first[col];
+	  khi = calc_pot.last[col];
+	  /* bisection */
+	  while (khi - klo > 1) {
+	    slot = (khi + klo) >> 1;
+	    if (calc_pot.xcoord[slot] > r)
+	      khi = slot;
+	    else
+	      klo = slot;
+	  }
+	  slot = klo;
+	  step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
+	  shift = (r - calc_pot.xcoord[klo]) / step;
+
+	}
+	/* Check if we are at the last index */
+	if (slot >= calc_pot.last[col]) {
+	  slot--;
+	  shift += 1.0;
+	}
+	atoms[i].neigh[k].shift[1] = shift;
+	atoms[i].neigh[k].slot[1] = slot;
+	atoms[i].neigh[k].step[1] = step;
+#endif /* EAM || ADP || MEAM */
+
+#ifdef MEAM
+	/* Store slots and stuff for f(r_ij) */
+	col = paircol + 2 * ntypes + atoms[i].neigh[k].col[0];
+	atoms[i].neigh[k].col[2] = col;
+	if (0 == format || 3 == format) {
+	  rr = r - calc_pot.begin[col];
+	  if (rr < 0) {
+	    fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
+	    fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
+	    fflush(stdout);
+	    error(1, "short distance in config.c!");
+	  }
+	  istep = calc_pot.invstep[col];
+	  slot = (int)(rr * istep);
+	  shift = (rr - slot * calc_pot.step[col]) * istep;
+	  slot += calc_pot.first[col];
+	  step = calc_pot.step[col];
+	} else {	/* format == 4 ! */
+	  klo = calc_pot.first[col];
+	  khi = calc_pot.last[col];
+	  /* bisection */
+	  while (khi - klo > 1) {
+	    slot = (khi + klo) >> 1;
+	    if (calc_pot.xcoord[slot] > r)
+	      khi = slot;
+	    else
+	      klo = slot;
+	  }
+	  slot = klo;
+	  step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
+	  shift = (r - calc_pot.xcoord[klo]) / step;
+
+	}
+	/* Check if we are at the last index */
+	if (slot >= calc_pot.last[col]) {
+	  slot--;
+	  shift += 1.0;
+	}
+	atoms[i].neigh[k].shift[2] = shift;
+	atoms[i].neigh[k].slot[2] = slot;
+	atoms[i].neigh[k].step[2] = step;
+#endif /* MEAM */
+
+#ifdef ADP
+	/* dipole part */
+	col = paircol + 2 * ntypes + atoms[i].neigh[k].col[0];
+	atoms[i].neigh[k].col[2] = col;
+	if (format == 0 || format == 3) {
+	  rr = r - calc_pot.begin[col];
+	  if (rr < 0) {
+	    fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
+	    fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
+	    fflush(stdout);
+	    error(1, "short distance in config.c!");
+	  }
+	  istep = calc_pot.invstep[col];
+	  slot = (int)(rr * istep);
+	  shift = (rr - slot * calc_pot.step[col]) * istep;
+	  slot += calc_pot.first[col];
+	  step = calc_pot.step[col];
+	} else {	/* format == 4 ! */
+	  klo = calc_pot.first[col];
+	  khi = calc_pot.last[col];
+	  /* bisection */
+	  while (khi - klo > 1) {
+	    slot = (khi + klo) >> 1;
+	    if (calc_pot.xcoord[slot] > r)
+	      khi = slot;
+	    else
+	      klo = slot;
+	  }
+	  slot = klo;
+	  step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
+	  shift = (r - calc_pot.xcoord[klo]) / step;
+
+	}
+	/* Check if we are at the last index */
+	if (slot >= calc_pot.last[col]) {
+	  slot--;
+	  shift += 1.0;
+	}
+	atoms[i].neigh[k].shift[2] = shift;
+	atoms[i].neigh[k].slot[2] = slot;
+	atoms[i].neigh[k].step[2] = step;
+
+	/* quadrupole part */
+	col = 2 * paircol + 2 * ntypes + atoms[i].neigh[k].col[0];
+	atoms[i].neigh[k].col[3] = col;
+	if (format == 0 || format == 3) {
+	  rr = r - calc_pot.begin[col];
+	  if (rr < 0) {
+	    fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
+	    fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
+	    fflush(stdout);
+	    error(1, "short distance in config.c!");
+	  }
+	  istep = calc_pot.invstep[col];
+	  slot = (int)(rr * istep);
+	  shift = (rr - slot * calc_pot.step[col]) * istep;
+	  slot += calc_pot.first[col];
+	  step = calc_pot.step[col];
+	} else {	/* format == 4 ! */
+	  klo = calc_pot.first[col];
+	  khi = calc_pot.last[col];
+	  /* bisection */
+	  while (khi - klo > 1) {
+	    slot = (khi + klo) >> 1;
+	    if (calc_pot.xcoord[slot] > r)
+	      khi = slot;
+	    else
+	      klo = slot;
+	  }
+	  slot = klo;
+	  step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
+	  shift = (r - calc_pot.xcoord[klo]) / step;
+
+	}
+	/* Check if we are at the last index */
+	if (slot >= calc_pot.last[col]) {
+	  slot--;
+	  shift += 1.0;
+	}
+	atoms[i].neigh[k].shift[3] = shift;
+	atoms[i].neigh[k].slot[3] = slot;
+	atoms[i].neigh[k].step[3] = step;
+#endif /* ADP */
+
+#ifdef STIWEB
+	/* Store slots and stuff for exp. function */
+	col = paircol + atoms[i].neigh[k].col[0];
+	atoms[i].neigh[k].col[1] = col;
+	if (0 == format || 3 == format) {
+	  rr = r - calc_pot.begin[col];
+	  if (rr < 0) {
+	    fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
+	    fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
+	    fflush(stdout);
+	    error(1, "short distance in config.c!");
+	  }
+	  istep = calc_pot.invstep[col];
+	  slot = (int)(rr * istep);
+	  shift = (rr - slot * calc_pot.step[col]) * istep;
+	  slot += calc_pot.first[col];
+	  step = calc_pot.step[col];
+	} else {	/* format == 4 ! */
+	  klo = calc_pot.first[col];
+	  khi = calc_pot.last[col];
+	  /* bisection */
+	  while (khi - klo > 1) {
+	    slot = (khi + klo) >> 1;
+	    if (calc_pot.xcoord[slot] > r)
+	      khi = slot;
+	    else
+	      klo = slot;
+	  }
+	  slot = klo;
+	  step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
+	  shift = (r - calc_pot.xcoord[klo]) / step;
+
+	}
+	/* Check if we are at the last index */
+	if (slot >= calc_pot.last[col]) {
+	  slot--;
+	  shift += 1.0;
+	}
+	atoms[i].neigh[k].shift[1] = shift;
+	atoms[i].neigh[k].slot[1] = slot;
+	atoms[i].neigh[k].step[1] = step;
+#endif /* STIWEB */
+
+      }
+    }
+    rd->max_neigh = MAX(rd->max_neigh, atoms[i].num_neigh);
+  }
+  free(cand_start);
+
+  /* compute the angular part */
+#ifdef THREEBODY
+  /* count the angles first, they are all stored in a single block */
+  nangl = 0;
+  for (i = first; i < first + count; i++) {
+    nnn = atoms[i].num_neigh;
+#ifdef TERSOFF
+    nangl += nnn * (nnn - 1);
+#else
+    nangl += nnn * (nnn - 1) / 2;
+#endif /* TERSOFF */
+  }
+  angl_block = (angl *) malloc(MAX(nangl, 1) * sizeof(angl));
+  if (NULL == angl_block)
+    error(1, "Cannot allocate memory for angular part of configuration %d", h);
+#ifndef MPI
+  /* with MPI it is released by broadcast_angles() */
+#ifdef _OPENMP
+#pragma omp critical (reg_for_free)
+#endif /* _OPENMP */
+  reg_for_free(angl_block, "angular part configuration %d", h);
+#endif /* !MPI */
+  rd->total_angl += nangl;
+
+  nangl = 0;
+  for (i = first; i < first + count; i++) {
+    nnn = atoms[i].num_neigh;
+    ijk = 0;
+    atoms[i].angl_part = angl_block + nangl;
+#ifdef TERSOFF
+    for (j = 0; j < nnn; j++) {
+#else
+    for (j = 0; j < nnn - 1; j++) {
+#endif /* TERSOFF */
+      atoms[i].neigh[j].ijk_start = ijk;
+#ifdef TERSOFF
+      for (k = 0; k < nnn; k++) {
+	if (j == k)
+	  continue;
+#else
+      for (k = j + 1; k < nnn; k++) {
+#endif /* TERSOFF */
+	ccos =
+	  atoms[i].neigh[j].dist_r.x * atoms[i].neigh[k].dist_r.x +
+	  atoms[i].neigh[j].dist_r.y * atoms[i].neigh[k].dist_r.y +
+	  atoms[i].neigh[j].dist_r.z * atoms[i].neigh[k].dist_r.z;
+
+	atoms[i].angl_part[ijk].cos = ccos;
+
+	col = 2 * paircol + 2 * ntypes + atoms[i].type;
+	if (0 == format || 3 == format) {
+	  if ((fabs(ccos) - 1.0) > 1e-10) {
+	    printf("%.20f %f %d %d %d\n", ccos, calc_pot.begin[col], col, type1, type2);
+	    fflush(stdout);
+	    error(1, "cos out of range, it is strange!");
+	  }
+#ifdef MEAM
+	  istep = calc_pot.invstep[col];
+	  slot = (int)((ccos + 1) * istep);
+	  shift = ((ccos + 1) - slot * calc_pot.step[col]) * istep;
+	  slot += calc_pot.first[col];
+	  step = calc_pot.step[col];
+
+	  /* Don't want lower bound spline knot to be final knot or upper
+	     bound knot will cause trouble since it goes beyond the array */
+	  if (slot >= calc_pot.last[col]) {
+	    slot--;
+	    shift += 1.0;
+	  }
+#endif /* !MEAM */
+	}
+#ifdef MEAM
+	atoms[i].angl_part[ijk].shift = shift;
+	atoms[i].angl_part[ijk].slot = slot;
+	atoms[i].angl_part[ijk].step = step;
+#endif /* MEAM */
+	ijk++;
+      }
+    }
+    atoms[i].num_angl = ijk;
+    nangl += ijk;
+  }
+#endif /* THREEBODY */
+  rd->t_neigh += wall_time() - t_start;
+  rd->sh_dist = MAX(rd->sh_dist, sh_dist);
+
+  return;
+}
+
 /****************************************************************
  *
  *  read the configurations
@@ -41,40 +1586,26 @@
 
 void read_config(char *filename)
 {
-  atom_t *atom;
-  char  msg[255], buffer[1024];
-  char *res, *ptr;
-  char *tmp, *res_tmp;
-  int   count;
-  int   i, j, k, ix, iy, iz;
-  int   type1, type2, col, slot, klo, khi;
-  int   cell_scale[3];
-  int   fixed_elements;
-  int   h_stress = 0, h_eng = 0, h_boxx = 0, h_boxy = 0, h_boxz = 0, use_force;
+  int   i, j, k, h;
+  int   type1, type2, col;
+  int   total_neigh = 0;
   int   have_small_box = 0;
-#ifdef CONTRIB
-  int   have_contrib = 0;
-#endif /* CONTRIB */
-  int   line = 0;
   int   max_type = 0;
   int   sh_dist = 0;		/* short distance flag */
-  int   str_len;
-  int   tag_format = 0;
   int   w_force = 0, w_stress = 0;
+  int   cache_hit = 0;
+#ifdef THREEBODY
+  int   total_angl = 0;
+#endif /* THREEBODY */
 #ifdef APOT
   int   index;
 #endif /* APOT */
+  uint64_t cache_key = 0;
+  cache_header_t cache_hdr;
+  conf_pos_t *pos = NULL;
   FILE *infile;
-  fpos_t filepos;
-  double r, rr, istep, shift, step;
+  double t_start, t_neigh = 0.;
   double *mindist;
-  sym_tens *stresses;
-  vector d, dd, iheight;
-#ifdef THREEBODY
-  int   ijk;
-  int   nnn;
-  double ccos;
-#endif /* THREEBODY */
 
   /* initialize elements array */
   elements = (char **)malloc(ntypes * sizeof(char *));
@@ -110,809 +1641,132 @@ void read_config(char *filename)
   if (NULL == infile)
     error(1, "Could not open file %s\n", filename);
 
-  printf("Reading the config file >> %s << and calculating neighbor lists ... ", filename);
-  fflush(stdout);
-
-  /* read configurations until the end of the file */
-  do {
-    res = fgets(buffer, 1024, infile);
-    line++;
-    if (NULL == res)
-      error(1, "Unexpected end of file in %s", filename);
-    if (res[0] == '#') {	/* new file format (with tags) */
-      tag_format = 1;
-      h_eng = h_stress = h_boxx = h_boxy = h_boxz = 0;
-      if (res[1] == 'N') {	/* Atom number line */
-	if (sscanf(res + 3, "%d %d", &count, &use_force) < 2)
-	  error(1, "%s: Error in atom number specification on line %d\n", filename, line);
-      } else
-	error(1, "%s: Number of atoms missing on line %d\n", filename, line);
-    } else {
-      /* number of atoms in this configuration */
-      tag_format = 0;
-      use_force = 1;
-      if (1 > sscanf(buffer, "%d", &count))
-	error(1, "Unexpected end of file in %s", filename);
-    }
-
-    /* check if there are enough atoms, 2 for pair and 3 for manybody potentials */
-#ifndef THREEBODY
-    if (2 > count)
-      error(1, "The configuration %d (starting on line %d) has not enough atoms. Please remove it.",
-	nconf + 1, line);
-#else
-    if (3 > count)
-      error(1, "The configuration %d (starting on line %d) has not enough atoms. Please remove it.",
-	nconf + 1, line);
-#endif /* THREEBODY */
-
-    /* increase memory for this many additional atoms */
-    atoms = (atom_t *)realloc(atoms, (natoms + count) * sizeof(atom_t));
-    if (NULL == atoms)
-      error(1, "Cannot allocate memory for atoms");
-    for (i = 0; i < count; i++) {
-      atoms[natoms + i].neigh = (neigh_t *)malloc(sizeof(neigh_t));
-      reg_for_free(atoms[natoms + i].neigh, "test neigh");
-    }
-    coheng = (double *)realloc(coheng, (nconf + 1) * sizeof(double));
-    if (NULL == coheng)
-      error(1, "Cannot allocate memory for cohesive energy");
-    conf_weight = (double *)realloc(conf_weight, (nconf + 1) * sizeof(double));
-    if (NULL == conf_weight)
-      error(1, "Cannot allocate memory for configuration weights");
-    else
-      conf_weight[nconf] = 1.0;
-    volume = (double *)realloc(volume, (nconf + 1) * sizeof(double));
-    if (NULL == volume)
-      error(1, "Cannot allocate memory for volume");
-    stress = (sym_tens *)realloc(stress, (nconf + 1) * sizeof(sym_tens));
-    if (NULL == stress)
-      error(1, "Cannot allocate memory for stress");
-    inconf = (int *)realloc(inconf, (nconf + 1) * sizeof(int));
-    if (NULL == inconf)
-      error(1, "Cannot allocate memory for atoms in conf");
-    cnfstart = (int *)realloc(cnfstart, (nconf + 1) * sizeof(int));
-    if (NULL == cnfstart)
-      error(1, "Cannot allocate memory for start of conf");
-    useforce = (int *)realloc(useforce, (nconf + 1) * sizeof(int));
-    if (NULL == useforce)
-      error(1, "Cannot allocate memory for useforce");
-    usestress = (int *)realloc(usestress, (nconf + 1) * sizeof(int));
-    if (NULL == useforce)
-      error(1, "Cannot allocate memory for usestress");
-    na_type = (int **)realloc(na_type, (nconf + 2) * sizeof(int *));
-    if (NULL == na_type)
-      error(1, "Cannot allocate memory for na_type");
-    na_type[nconf] = (int *)malloc(ntypes * sizeof(int));
-    reg_for_free(na_type[nconf], "na_type[%d]", nconf);
-    if (NULL == na_type[nconf])
-      error(1, "Cannot allocate memory for na_type");
-
-    for (i = natoms; i < natoms + count; i++) {
-      atoms[i].type = 0;
-      atoms[i].num_neigh = 0;
-      atoms[i].pos.x = 0.0;
-      atoms[i].pos.y = 0.0;
-      atoms[i].pos.z = 0.0;
-      atoms[i].force.x = 0.0;
-      atoms[i].force.y = 0.0;
-      atoms[i].force.z = 0.0;
-      atoms[i].absforce = 0.0;
-      atoms[i].conf = 0;
-
-#ifdef CONTRIB
-      atoms[i].contrib = 0;
-#endif /* CONTRIB */
-
-#if defined EAM || defined ADP || defined MEAM
-      atoms[i].rho = 0.0;
-      atoms[i].gradF = 0.0;
-#endif /* EAM || ADP || MEAM */
-
-#ifdef ADP
-      atoms[i].mu.x = 0.0;
-      atoms[i].mu.y = 0.0;
-      atoms[i].mu.z = 0.0;
-      atoms[i].lambda.xx = 0.0;
-      atoms[i].lambda.yy = 0.0;
-      atoms[i].lambda.zz = 0.0;
-      atoms[i].lambda.xy = 0.0;
-      atoms[i].lambda.yz = 0.0;
-      atoms[i].lambda.zx = 0.0;
-#endif /* ADP */
-
-#ifdef DIPOLE
-      atoms[i].E_stat.x = 0.0;
-      atoms[i].E_stat.y = 0.0;
-      atoms[i].E_stat.z = 0.0;
-      atoms[i].p_sr.x = 0.0;
-      atoms[i].p_sr.y = 0.0;
-      atoms[i].p_sr.z = 0.0;
-      atoms[i].E_ind.x = 0.0;
-      atoms[i].E_ind.y = 0.0;
-      atoms[i].E_ind.z = 0.0;
-      atoms[i].p_ind.x = 0.0;
-      atoms[i].p_ind.y = 0.0;
-      atoms[i].p_ind.z = 0.0;
-      atoms[i].E_old.x = 0.0;
-      atoms[i].E_old.y = 0.0;
-      atoms[i].E_old.z = 0.0;
-      atoms[i].E_tot.x = 0.0;
-      atoms[i].E_tot.y = 0.0;
-      atoms[i].E_tot.z = 0.0;
-#endif /* DIPOLE */
-
+  /* try the binary cache first, it has to match the config file and all settings */
+  if (strcmp(config_cache, "\0") != 0) {
+    t_start = wall_time();
+    cache_key = config_cache_key(infile);
+    cache_hit = read_config_cache(cache_key, &cache_hdr, mindist);
+    if (cache_hit) {
+      total_neigh = cache_hdr.total_neigh;
 #ifdef THREEBODY
-      atoms[i].num_angl = 0;
-#ifdef MEAM
-      atoms[i].rho_eam = 0.0;
-#endif /* MEAM */
-#endif /* MANYBODY */
-
-      atoms[i].neigh = NULL;
-#ifdef THREEBODY
-      atoms[i].angl_part = NULL;
+      total_angl = cache_hdr.total_angl;
 #endif /* THREEBODY */
+      max_type = cache_hdr.max_type;
+      w_force = cache_hdr.w_force;
+      w_stress = cache_hdr.w_stress;
+      have_small_box = cache_hdr.have_small_box;
+      t_neigh = wall_time() - t_start;
+      printf("Reading the config file >> %s << from the cache >> %s << ... ", filename, config_cache);
     }
+  }
 
-    for (i = 0; i < ntypes; i++)
-      na_type[nconf][i] = 0;
-
-    inconf[nconf] = count;
-    cnfstart[nconf] = natoms;
-    useforce[nconf] = use_force;
-    stresses = stress + nconf;
-#ifdef CONTRIB
-    have_contrib = 0;
-    have_contrib_box = 0;
-#endif /* CONTRIB */
-
-    if (tag_format) {
-      do {
-	res = fgets(buffer, 1024, infile);
-	if ((ptr = strchr(res, '\n')) != NULL)
-	  *ptr = '\0';
-	line++;
-	/* read the box vectors */
-	if (res[1] == 'X') {
-	  if (sscanf(res + 3, "%lf %lf %lf\n", &box_x.x, &box_x.y, &box_x.z) == 3)
-	    h_boxx++;
-	  else
-	    error(1, "%s: Error in box vector x, line %d\n", filename, line);
-	} else if (res[1] == 'Y') {
-	  if (sscanf(res + 3, "%lf %lf %lf\n", &box_y.x, &box_y.y, &box_y.z) == 3)
-	    h_boxy++;
-	  else
-	    error(1, "%s: Error in box vector y, line %d\n", filename, line);
-	} else if (res[1] == 'Z') {
-	  if (sscanf(res + 3, "%lf %lf %lf\n", &box_z.x, &box_z.y, &box_z.z) == 3)
-	    h_boxz++;
-	  else
-	    error(1, "%s: Error in box vector z, line %d\n", filename, line);
-
-#ifdef CONTRIB
-	  /* box of contributing particles */
-	} else if (strncmp(res + 1, "B_O", 3) == 0) {
-	  if (1 == have_contrib_box) {
-	    error(0, "There can only be one box of contributing atoms\n");
-	    error(1, "This occured in %s on line %d", filename, line);
-	  }
-	  if (sscanf(res + 5, "%lf %lf %lf\n", &cbox_o.x, &cbox_o.y, &cbox_o.z) == 3) {
-	    have_contrib_box = 1;
-	    have_contrib++;
-	  } else
-	    error(1, "%s: Error in box of contributing atoms, line %d\n", filename, line);
-	} else if (strncmp(res + 1, "B_A", 3) == 0) {
-	  if (sscanf(res + 5, "%lf %lf %lf\n", &cbox_a.x, &cbox_a.y, &cbox_a.z) == 3) {
-	    have_contrib++;
-	  } else
-	    error(1, "%s: Error in box of contributing atoms, line %d\n", filename, line);
-	} else if (strncmp(res + 1, "B_B", 3) == 0) {
-	  if (sscanf(res + 5, "%lf %lf %lf\n", &cbox_b.x, &cbox_b.y, &cbox_b.z) == 3) {
-	    have_contrib++;
-	  } else
-	    error(1, "%s: Error in box of contributing atoms, line %d\n", filename, line);
-	} else if (strncmp(res + 1, "B_C", 3) == 0) {
-	  if (sscanf(res + 5, "%lf %lf %lf\n", &cbox_c.x, &cbox_c.y, &cbox_c.z) == 3) {
-	    have_contrib++;
-	  } else
-	    error(1, "%s: Error in box of contributing atoms, line %d\n", filename, line);
-
-	  /* sphere of contributing particles */
-	} else if (strncmp(res + 1, "B_S", 3) == 0) {
-	  sphere_centers = (vector *)realloc(sphere_centers, (n_spheres + 1) * sizeof(vector));
-	  r_spheres = (double *)realloc(r_spheres, (n_spheres + 1) * sizeof(double));
-	  if (sscanf(res + 5, "%lf %lf %lf %lf\n", &sphere_centers[n_spheres].x,
-	      &sphere_centers[n_spheres].y, &sphere_centers[n_spheres].z, &r_spheres[n_spheres]) == 4) {
-	    n_spheres++;
-	  } else
-	    error(1, "%s: Error in sphere of contributing atoms, line %d\n", filename, line);
-#endif /* CONTRIB */
-
-	  /* energy */
-	} else if (res[1] == 'E') {
-	  if (sscanf(res + 3, "%lf\n", &(coheng[nconf])) == 1)
-	    h_eng++;
-	  else
-	    error(1, "%s: Error in energy on line %d\n", filename, line);
-
-	  /* configuration weight */
-	} else if (res[1] == 'W') {
-	  if (sscanf(res + 3, "%lf\n", &(conf_weight[nconf])) != 1)
-	    error(1, "%s: Error in configuration weight on line %d\n", filename, line);
-
-	  /* chemical elements */
-	} else if (res[1] == 'C') {
-	  fgetpos(infile, &filepos);
-	  if (!have_elements) {
-	    i = 0;
-	    for (j = 0; j < ntypes; j++) {
-	      res_tmp = res + 3 + i;
-	      if (strchr(res_tmp, ' ') != NULL && strlen(res_tmp) > 0) {
-		tmp = strchr(res_tmp, ' ');
-		str_len = tmp - res_tmp + 1;
-		strncpy(elements[j], res_tmp, str_len - 1);
-		elements[j][str_len - 1] = '\0';
-		i += str_len;
-	      } else if (strlen(res_tmp) >= 1) {
-		if ((ptr = strchr(res_tmp, '\n')) != NULL)
-		  *ptr = '\0';
-		strcpy(elements[j], res_tmp);
-		i += strlen(res_tmp);
-		fixed_elements = j;
-	      } else
-		break;
-	    }
-	    have_elements = 1;
-	  } else {
-	    i = 0;
-	    for (j = 0; j < ntypes; j++) {
-	      res_tmp = res + 3 + i;
-	      if (strchr(res_tmp, ' ') != NULL && strlen(res_tmp) > 0) {
-		/* more than one element left */
-		tmp = strchr(res_tmp, ' ');
-		str_len = tmp - res_tmp + 1;
-		strncpy(msg, res_tmp, str_len - 1);
-		msg[str_len - 1] = '\0';
-		i += str_len;
-		if (strcmp(msg, elements[j]) != 0) {
-		  if (atoi(elements[j]) == j && j > fixed_elements) {
-		    strcpy(elements[j], msg);
-		    fixed_elements++;
-		  } else {
-		    /* Fix newline at the end of a string */
-		    if ((ptr = strchr(msg, '\n')) != NULL)
-		      *ptr = '\0';
-		    error(0, "Mismatch found in configuration %d, line %d.\n", nconf, line);
-		    error(0, "Expected element >> %s << but found element >> %s <<.\n", elements[j], msg);
-		    error(0, "You can use list_config to identify that configuration.\n");
-		    error(1, "Please check your configuration files!\n");
-		  }
-		}
-	      } else if (strlen(res_tmp) > 1) {
-		strcpy(msg, res_tmp);
-		if ((ptr = strchr(msg, '\n')) != NULL)
-		  *ptr = '\0';
-		i += strlen(msg);
-		if (strcmp(msg, elements[j]) != 0) {
-		  if (atoi(elements[j]) == j && j > fixed_elements) {
-		    strcpy(elements[j], msg);
-		    fixed_elements++;
-		  } else {
-		    /* Fix newline at the end of a string */
-		    if ((ptr = strchr(msg, '\n')) != NULL)
-		      *ptr = '\0';
-		    error(0, "Mismatch found in configuration %d on line %d.\n", nconf, line);
-		    error(0, "Expected element >> %s << but found element >> %s <<.\n", elements[j], msg);
-		    error(0, "You can use list_config to identify that configuration.\n");
-		    error(1, "Please check your configuration files!");
-		  }
-		}
-	      } else
-		break;
-	    }
-	  }
-	  fsetpos(infile, &filepos);
-	}
-#ifdef STRESS
-	/* read stress */
-	else if (res[1] == 'S') {
-	  if (sscanf(res + 3, "%lf %lf %lf %lf %lf %lf\n", &(stresses->xx),
-	      &(stresses->yy), &(stresses->zz), &(stresses->xy), &(stresses->yz), &(stresses->zx)) == 6)
-	    h_stress++;
-	  else
-	    error(1, "Error in stress tensor on line %d\n", line);
-	}
-#endif /* STRESS */
-
-      } while (res[1] != 'F');
-      if (!(h_eng && h_boxx && h_boxy && h_boxz))
-	error(1, "Incomplete box vectors for config %d!", nconf);
-#ifdef CONTRIB
-      if (have_contrib_box && have_contrib != 4)
-	error(1, "Incomplete box of contributing atoms for config %d!", nconf);
-#endif /* CONTRIB */
-      usestress[nconf] = h_stress;	/* no stress tensor available */
-    } else {
-      /* read the box vectors */
-      fscanf(infile, "%lf %lf %lf\n", &box_x.x, &box_x.y, &box_x.z);
-      fscanf(infile, "%lf %lf %lf\n", &box_y.x, &box_y.y, &box_y.z);
-      fscanf(infile, "%lf %lf %lf\n", &box_z.x, &box_z.y, &box_z.z);
-      line += 3;
-
-      /* read cohesive energy */
-      if (1 != fscanf(infile, "%lf\n", &(coheng[nconf])))
-	error(1, "Configuration file without cohesive energy -- old format!");
-      line++;
-
-      /* read stress tensor */
-      if (6 != fscanf(infile, "%lf %lf %lf %lf %lf %lf\n", &(stresses->xx),
-	  &(stresses->yy), &(stresses->zz), &(stresses->xy), &(stresses->yz), &(stresses->zx)))
-	error(1, "No stresses given -- old format");
-      usestress[nconf] = 1;
-      line++;
-    }
-
-    if (usestress[nconf])
-      w_stress++;
-    if (useforce[nconf])
-      w_force++;
-
-    volume[nconf] = make_box();
-
-    /* read the atoms */
-    for (i = 0; i < count; i++) {
-      atom = atoms + natoms + i;
-      if (7 > fscanf(infile, "%d %lf %lf %lf %lf %lf %lf\n", &(atom->type),
-	  &(atom->pos.x), &(atom->pos.y), &(atom->pos.z), &(atom->force.x), &(atom->force.y),
-	  &(atom->force.z)))
-	error(1, "Corrupt configuration file on line %d\n", line + 1);
-      line++;
-      if (atom->type >= ntypes || atom->type < 0)
-	error(1, "Corrupt configuration file on line %d: Incorrect atom type (%d)\n", line, atom->type);
-      atom->absforce = sqrt(dsquare(atom->force.x) + dsquare(atom->force.y) + dsquare(atom->force.z));
-      atom->conf = nconf;
-#ifdef CONTRIB
-      if (have_contrib_box || n_spheres != 0)
-	atom->contrib = does_contribute(atom->pos);
-      else
-	atom->contrib = 1;
-#endif
-      na_type[nconf][atom->type] += 1;
-      max_type = MAX(max_type, atom->type);
+  if (!cache_hit) {
+    printf("Reading the config file >> %s << and calculating neighbor lists ... ", filename);
+    fflush(stdout);
+
+    /* first pass: find all configurations */
+    nconf = scan_config(infile, filename, &pos);
+    for (h = 0; h < nconf; h++)
+      natoms += pos[h].count;
+
+    atoms = (atom_t *)malloc(natoms * sizeof(atom_t));
+    coheng = (double *)malloc(nconf * sizeof(double));
+    conf_weight = (double *)malloc(nconf * sizeof(double));
+    volume = (double *)malloc(nconf * sizeof(double));
+    stress = (sym_tens *)malloc(nconf * sizeof(sym_tens));
+    inconf = (int *)malloc(nconf * sizeof(int));
+    cnfstart = (int *)malloc(nconf * sizeof(int));
+    useforce = (int *)malloc(nconf * sizeof(int));
+    usestress = (int *)malloc(nconf * sizeof(int));
+    na_type = (int **)malloc((nconf + 1) * sizeof(int *));
+    if (NULL == atoms || NULL == coheng || NULL == conf_weight || NULL == volume || NULL == stress
+      || NULL == inconf || NULL == cnfstart || NULL == useforce || NULL == usestress
+      || NULL == na_type)
+      error(1, "Cannot allocate memory for the configurations");
+#ifdef COULOMB
+    boxes = (vector *)malloc(3 * nconf * sizeof(vector));
+    if (NULL == boxes)
+      error(1, "Cannot allocate memory for the box vectors");
+#endif /* COULOMB */
+    for (h = 0, i = 0; h < nconf; h++) {
+      inconf[h] = pos[h].count;
+      cnfstart[h] = i;
+      conf_weight[h] = 1.0;
+      usestress[h] = 0;
+      i += pos[h].count;
+      na_type[h] = (int *)malloc(ntypes * sizeof(int));
+      if (NULL == na_type[h])
+	error(1, "Cannot allocate memory for na_type");
+      reg_for_free(na_type[h], "na_type[%d]", h);
     }
 
-    /* check cell size */
-    /* inverse height in direction */
-    iheight.x = sqrt(SPROD(tbox_x, tbox_x));
-    iheight.y = sqrt(SPROD(tbox_y, tbox_y));
-    iheight.z = sqrt(SPROD(tbox_z, tbox_z));
-
-    if ((ceil(rcutmax * iheight.x) > 30000)
-      || (ceil(rcutmax * iheight.y) > 30000)
-      || (ceil(rcutmax * iheight.z) > 30000))
-      error(1, "Very bizarre small cell size - aborting");
-
-    cell_scale[0] = (int)ceil(rcutmax * iheight.x);
-    cell_scale[1] = (int)ceil(rcutmax * iheight.y);
-    cell_scale[2] = (int)ceil(rcutmax * iheight.z);
-
-    if (cell_scale[0] > 1 || cell_scale[1] > 1 || cell_scale[2] > 1)
-      have_small_box = 1;
-
-#ifdef DEBUG
-    fprintf(stderr, "Checking cell size for configuration %d:\n", nconf);
-    fprintf(stderr, "Box dimensions:\n");
-    fprintf(stderr, "     %10.6f %10.6f %10.6f\n", box_x.x, box_x.y, box_x.z);
-    fprintf(stderr, "     %10.6f %10.6f %10.6f\n", box_y.x, box_y.y, box_y.z);
-    fprintf(stderr, "     %10.6f %10.6f %10.6f\n", box_z.x, box_z.y, box_z.z);
-    fprintf(stderr, "Box normals:\n");
-    fprintf(stderr, "     %10.6f %10.6f %10.6f\n", tbox_x.x, tbox_x.y, tbox_x.z);
-    fprintf(stderr, "     %10.6f %10.6f %10.6f\n", tbox_y.x, tbox_y.y, tbox_y.z);
-    fprintf(stderr, "     %10.6f %10.6f %10.6f\n", tbox_z.x, tbox_z.y, tbox_z.z);
-    fprintf(stderr, "Box heights:\n");
-    fprintf(stderr, "     %10.6f %10.6f %10.6f\n", 1. / iheight.x, 1. / iheight.y, 1. / iheight.z);
-    fprintf(stderr, "Potential range:  %f\n", rcutmax);
-    fprintf(stderr, "Periodic images needed: %d %d %d\n\n",
-      2 * cell_scale[0] + 1, 2 * cell_scale[1] + 1, 2 * cell_scale[2] + 1);
-#endif /* DEBUG */
-
-    /* compute the neighbor table */
-    for (i = natoms; i < natoms + count; i++) {
-      atoms[i].num_neigh = 0;
-      /* loop over all atoms for threebody interactions */
+    /* second pass: read the configurations and compute the neighbor tables,
+       with OpenMP the configurations are distributed among the threads,
+       the boxes of contributing atoms have to be read in order */
+    t_start = wall_time();
+#if defined _OPENMP && !defined CONTRIB
+#pragma omp parallel private(h, i)
+#endif /* _OPENMP && !CONTRIB */
+    {
+      conf_reader_t rd;
+      FILE *conffile;
+
+      memset(&rd, 0, sizeof(rd));
+      rd.mindist = (double *)malloc(ntypes * ntypes * sizeof(double));
+      if (NULL == rd.mindist)
+	error(1, "Cannot allocate memory for minimal distance.");
+      memcpy(rd.mindist, mindist, ntypes * ntypes * sizeof(double));
+      conffile = fopen(filename, "r");
+      if (NULL == conffile)
+	error(1, "Could not open file %s\n", filename);
+
+#if defined _OPENMP && !defined CONTRIB
+#pragma omp for schedule(dynamic)
+#endif /* _OPENMP && !CONTRIB */
+      for (h = 0; h < nconf; h++)
+	read_conf(conffile, filename, h, pos + h, &rd);
+
+      fclose(conffile);
+#if defined _OPENMP && !defined CONTRIB
+#pragma omp critical
+#endif /* _OPENMP && !CONTRIB */
+      {
+	total_neigh += rd.total_neigh;
 #ifdef THREEBODY
-      for (j = natoms; j < natoms + count; j++) {
-#else
-      for (j = i; j < natoms + count; j++) {
+	total_angl += rd.total_angl;
 #endif /* THREEBODY */
-	d.x = atoms[j].pos.x - atoms[i].pos.x;
-	d.y = atoms[j].pos.y - atoms[i].pos.y;
-	d.z = atoms[j].pos.z - atoms[i].pos.z;
-	for (ix = -cell_scale[0]; ix <= cell_scale[0]; ix++) {
-	  for (iy = -cell_scale[1]; iy <= cell_scale[1]; iy++) {
-	    for (iz = -cell_scale[2]; iz <= cell_scale[2]; iz++) {
-	      if ((i == j) && (ix == 0) && (iy == 0) && (iz == 0))
-		continue;
-	      dd.x = d.x + ix * box_x.x + iy * box_y.x + iz * box_z.x;
-	      dd.y = d.y + ix * box_x.y + iy * box_y.y + iz * box_z.y;
-	      dd.z = d.z + ix * box_x.z + iy * box_y.z + iz * box_z.z;
-	      r = sqrt(SPROD(dd, dd));
-	      type1 = atoms[i].type;
-	      type2 = atoms[j].type;
-	      if (r <= rcut[type1 * ntypes + type2]) {
-		if (r <= rmin[type1 * ntypes + type2]) {
-		  sh_dist = nconf;
-		  fprintf(stderr, "Configuration %d: Distance %f\n", nconf, r);
-		  fprintf(stderr, "atom %d (type %d) at pos: %f %f %f\n",
-		    i - natoms, type1, atoms[i].pos.x, atoms[i].pos.y, atoms[i].pos.z);
-		  fprintf(stderr, "atom %d (type %d) at pos: %f %f %f\n", j - natoms, type2, dd.x, dd.y,
-		    dd.z);
-		}
-		atoms[i].neigh =
-		  (neigh_t *)realloc(atoms[i].neigh, (atoms[i].num_neigh + 1) * sizeof(neigh_t));
-		dd.x /= r;
-		dd.y /= r;
-		dd.z /= r;
-		k = atoms[i].num_neigh++;
-		atoms[i].neigh[k].type = type2;
-		atoms[i].neigh[k].nr = j;
-		atoms[i].neigh[k].r = r;
-		atoms[i].neigh[k].r2 = r * r;
-		atoms[i].neigh[k].inv_r = 1.0 / r;
-		atoms[i].neigh[k].dist_r = dd;
-		atoms[i].neigh[k].dist.x = dd.x * r;
-		atoms[i].neigh[k].dist.y = dd.y * r;
-		atoms[i].neigh[k].dist.z = dd.z * r;
-#ifdef ADP
-		atoms[i].neigh[k].sqrdist.xx = dd.x * dd.x * r * r;
-		atoms[i].neigh[k].sqrdist.yy = dd.y * dd.y * r * r;
-		atoms[i].neigh[k].sqrdist.zz = dd.z * dd.z * r * r;
-		atoms[i].neigh[k].sqrdist.yz = dd.y * dd.z * r * r;
-		atoms[i].neigh[k].sqrdist.zx = dd.z * dd.x * r * r;
-		atoms[i].neigh[k].sqrdist.xy = dd.x * dd.y * r * r;
-#endif /* ADP */
-
-		col = (type1 <= type2) ? type1 * ntypes + type2 - ((type1 * (type1 + 1)) / 2)
-		  : type2 * ntypes + type1 - ((type2 * (type2 + 1)) / 2);
-		atoms[i].neigh[k].col[0] = col;
-		mindist[col] = MIN(mindist[col], r);
-
-		/* pre-compute index and shift into potential table */
-
-		/* pair potential */
-		if (!sh_dist) {
-		  if (format == 0 || format == 3) {
-		    rr = r - calc_pot.begin[col];
-		    if (rr < 0) {
-		      fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
-		      fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
-		      fflush(stdout);
-		      error(1, "Short distance!");
-		    }
-		    istep = calc_pot.invstep[col];
-		    slot = (int)(rr * istep);
-		    shift = (rr - slot * calc_pot.step[col]) * istep;
-		    slot += calc_pot.first[col];
-		    step = calc_pot.step[col];
-		  } else {	/* format == 4 ! */
-		    klo = calc_pot.first[col];
-		    khi = calc_pot.last[col];
-		    /* bisection */
-		    while (khi - klo > 1) {
-		      slot = (khi + klo) >> 1;
-		      if (calc_pot.xcoord[slot] > r)
-			khi = slot;
-		      else
-			klo = slot;
-		    }
-		    slot = klo;
-		    step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
-		    shift = (r - calc_pot.xcoord[klo]) / step;
-
-		  }
-		  /* independent of format - we should be left of last index */
-		  if (slot >= calc_pot.last[col]) {
-		    slot--;
-		    shift += 1.0;
-		  }
-		  atoms[i].neigh[k].shift[0] = shift;
-		  atoms[i].neigh[k].slot[0] = slot;
-		  atoms[i].neigh[k].step[0] = step;
-
-#if defined EAM || defined ADP || defined MEAM
-		  /* transfer function */
-		  col = paircol + type2;
-		  atoms[i].neigh[k].col[1] = col;
-		  if (format == 0 || format == 3) {
-		    rr = r - calc_pot.begin[col];
-		    if (rr < 0) {
-		      fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
-		      fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
-		      fflush(stdout);
-		      error(1, "short distance in config.c!");
-		    }
-		    istep = calc_pot.invstep[col];
-		    slot = (int)(rr * istep);
-		    shift = (rr - slot * calc_pot.step[col]) * istep;
-		    slot += calc_pot.first[col];
-		    step = calc_pot.step[col];
-		  } else {	/* format == 4 ! */
-		    klo = calc_pot.first[col];
-		    khi = calc_pot.last[col];
-		    /* bisection */
-		    while (khi - klo > 1) {
-		      slot = (khi + klo) >> 1;
-		      if (calc_pot.xcoord[slot] > r)
-			khi = slot;
-		      else
-			klo = slot;
-		    }
-		    slot = klo;
-		    step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
-		    shift = (r - calc_pot.xcoord[klo]) / step;
-
-		  }
-		  /* Check if we are at the last index */
-		  if (slot >= calc_pot.last[col]) {
-		    slot--;
-		    shift += 1.0;
-		  }
-		  atoms[i].neigh[k].shift[1] = shift;
-		  atoms[i].neigh[k].slot[1] = slot;
-		  atoms[i].neigh[k].step[1] = step;
-#endif /* EAM || ADP || MEAM */
-
-#ifdef MEAM
-		  /* Store slots and stuff for f(r_ij) */
-		  col = paircol + 2 * ntypes + atoms[i].neigh[k].col[0];
-		  atoms[i].neigh[k].col[2] = col;
-		  if (0 == format || 3 == format) {
-		    rr = r - calc_pot.begin[col];
-		    if (rr < 0) {
-		      fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
-		      fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
-		      fflush(stdout);
-		      error(1, "short distance in config.c!");
-		    }
-		    istep = calc_pot.invstep[col];
-		    slot = (int)(rr * istep);
-		    shift = (rr - slot * calc_pot.step[col]) * istep;
-		    slot += calc_pot.first[col];
-		    step = calc_pot.step[col];
-		  } else {	/* format == 4 ! */
-		    klo = calc_pot.first[col];
-		    khi = calc_pot.last[col];
-		    /* bisection */
-		    while (khi - klo > 1) {
-		      slot = (khi + klo) >> 1;
-		      if (calc_pot.xcoord[slot] > r)
-			khi = slot;
-		      else
-			klo = slot;
-		    }
-		    slot = klo;
-		    step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
-		    shift = (r - calc_pot.xcoord[klo]) / step;
-
-		  }
-		  /* Check if we are at the last index */
-		  if (slot >= calc_pot.last[col]) {
-		    slot--;
-		    shift += 1.0;
-		  }
-		  atoms[i].neigh[k].shift[2] = shift;
-		  atoms[i].neigh[k].slot[2] = slot;
-		  atoms[i].neigh[k].step[2] = step;
-#endif /* MEAM */
-
-#ifdef ADP
-		  /* dipole part */
-		  col = paircol + 2 * ntypes + atoms[i].neigh[k].col[0];
-		  atoms[i].neigh[k].col[2] = col;
-		  if (format == 0 || format == 3) {
-		    rr = r - calc_pot.begin[col];
-		    if (rr < 0) {
-		      fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
-		      fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
-		      fflush(stdout);
-		      error(1, "short distance in config.c!");
-		    }
-		    istep = calc_pot.invstep[col];
-		    slot = (int)(rr * istep);
-		    shift = (rr - slot * calc_pot.step[col]) * istep;
-		    slot += calc_pot.first[col];
-		    step = calc_pot.step[col];
-		  } else {	/* format == 4 ! */
-		    klo = calc_pot.first[col];
-		    khi = calc_pot.last[col];
-		    /* bisection */
-		    while (khi - klo > 1) {
-		      slot = (khi + klo) >> 1;
-		      if (calc_pot.xcoord[slot] > r)
-			khi = slot;
-		      else
-			klo = slot;
-		    }
-		    slot = klo;
-		    step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
-		    shift = (r - calc_pot.xcoord[klo]) / step;
-
-		  }
-		  /* Check if we are at the last index */
-		  if (slot >= calc_pot.last[col]) {
-		    slot--;
-		    shift += 1.0;
-		  }
-		  atoms[i].neigh[k].shift[2] = shift;
-		  atoms[i].neigh[k].slot[2] = slot;
-		  atoms[i].neigh[k].step[2] = step;
-
-		  /* quadrupole part */
-		  col = 2 * paircol + 2 * ntypes + atoms[i].neigh[k].col[0];
-		  atoms[i].neigh[k].col[3] = col;
-		  if (format == 0 || format == 3) {
-		    rr = r - calc_pot.begin[col];
-		    if (rr < 0) {
-		      fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
-		      fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
-		      fflush(stdout);
-		      error(1, "short distance in config.c!");
-		    }
-		    istep = calc_pot.invstep[col];
-		    slot = (int)(rr * istep);
-		    shift = (rr - slot * calc_pot.step[col]) * istep;
-		    slot += calc_pot.first[col];
-		    step = calc_pot.step[col];
-		  } else {	/* format == 4 ! */
-		    klo = calc_pot.first[col];
-		    khi = calc_pot.last[col];
-		    /* bisection */
-		    while (khi - klo > 1) {
-		      slot = (khi + klo) >> 1;
-		      if (calc_pot.xcoord[slot] > r)
-			khi = slot;
-		      else
-			klo = slot;
-		    }
-		    slot = klo;
-		    step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
-		    shift = (r - calc_pot.xcoord[klo]) / step;
-
-		  }
-		  /* Check if we are at the last index */
-		  if (slot >= calc_pot.last[col]) {
-		    slot--;
-		    shift += 1.0;
-		  }
-		  atoms[i].neigh[k].shift[3] = shift;
-		  atoms[i].neigh[k].slot[3] = slot;
-		  atoms[i].neigh[k].step[3] = step;
-#endif /* ADP */
-
-#ifdef STIWEB
-		  /* Store slots and stuff for exp. function */
-		  col = paircol + atoms[i].neigh[k].col[0];
-		  atoms[i].neigh[k].col[1] = col;
-		  if (0 == format || 3 == format) {
-		    rr = r - calc_pot.begin[col];
-		    if (rr < 0) {
-		      fprintf(stderr, "The distance %f is smaller than the beginning\n", r);
-		      fprintf(stderr, "of the potential #%d (r_begin=%f).\n", col, calc_pot.begin[col]);
-		      fflush(stdout);
-		      error(1, "short distance in config.c!");
-		    }
-		    istep = calc_pot.invstep[col];
-		    slot = (int)(rr * istep);
-		    shift = (rr - slot * calc_pot.step[col]) * istep;
-		    slot += calc_pot.first[col];
-		    step = calc_pot.step[col];
-		  } else {	/* format == 4 ! */
-		    klo = calc_pot.first[col];
-		    khi = calc_pot.last[col];
-		    /* bisection */
-		    while (khi - klo > 1) {
-		      slot = (khi + klo) >> 1;
-		      if (calc_pot.xcoord[slot] > r)
-			khi = slot;
-		      else
-			klo = slot;
-		    }
-		    slot = klo;
-		    step = calc_pot.xcoord[khi] - calc_pot.xcoord[klo];
-		    shift = (r - calc_pot.xcoord[klo]) / step;
-
-		  }
-		  /* Check if we are at the last index */
-		  if (slot >= calc_pot.last[col]) {
-		    slot--;
-		    shift += 1.0;
-		  }
-		  atoms[i].neigh[k].shift[1] = shift;
-		  atoms[i].neigh[k].slot[1] = slot;
-		  atoms[i].neigh[k].step[1] = step;
-#endif /* STIWEB */
-
-		}
-	      }
-	    }
-	  }
-	}
+	maxneigh = MAX(maxneigh, rd.max_neigh);
+	max_type = MAX(max_type, rd.max_type);
+	w_force += rd.w_force;
+	w_stress += rd.w_stress;
+	have_small_box = MAX(have_small_box, rd.have_small_box);
+	sh_dist = MAX(sh_dist, rd.sh_dist);
+	t_neigh = MAX(t_neigh, rd.t_neigh);
+	for (i = 0; i < ntypes * ntypes; i++)
+	  mindist[i] = MIN(mindist[i], rd.mindist[i]);
       }
-      maxneigh = MAX(maxneigh, atoms[i].num_neigh);
-      reg_for_free(atoms[i].neigh, "neighbor table atom %d", i);
+      free(rd.mindist);
+      free(rd.cand);
     }
+    free(pos);
+  }
+  fclose(infile);
+  printf("done\n");
 
-    /* compute the angular part */
+  /* store everything for the next run, unless there are errors */
+  if (0 != cache_key && !cache_hit && !sh_dist) {
+    memset(&cache_hdr, 0, sizeof(cache_hdr));
+    cache_hdr.key = cache_key;
+    cache_hdr.total_neigh = total_neigh;
 #ifdef THREEBODY
-    for (i = natoms; i < natoms + count; i++) {
-      nnn = atoms[i].num_neigh;
-      ijk = 0;
-      atoms[i].angl_part = (angl *) malloc(sizeof(angl));
-#ifdef TERSOFF
-      for (j = 0; j < nnn; j++) {
-#else
-      for (j = 0; j < nnn - 1; j++) {
-#endif /* TERSOFF */
-	atoms[i].neigh[j].ijk_start = ijk;
-#ifdef TERSOFF
-	for (k = 0; k < nnn; k++) {
-	  if (j == k)
-	    continue;
-#else
-	for (k = j + 1; k < nnn; k++) {
-#endif /* TERSOFF */
-	  atoms[i].angl_part = (angl *) realloc(atoms[i].angl_part, (ijk + 1) * sizeof(angl));
-	  ccos =
-	    atoms[i].neigh[j].dist_r.x * atoms[i].neigh[k].dist_r.x +
-	    atoms[i].neigh[j].dist_r.y * atoms[i].neigh[k].dist_r.y +
-	    atoms[i].neigh[j].dist_r.z * atoms[i].neigh[k].dist_r.z;
-
-	  atoms[i].angl_part[ijk].cos = ccos;
-
-	  col = 2 * paircol + 2 * ntypes + atoms[i].type;
-	  if (0 == format || 3 == format) {
-	    if ((fabs(ccos) - 1.0) > 1e-10) {
-	      printf("%.20f %f %d %d %d\n", ccos, calc_pot.begin[col], col, type1, type2);
-	      fflush(stdout);
-	      error(1, "cos out of range, it is strange!");
-	    }
-#ifdef MEAM
-	    istep = calc_pot.invstep[col];
-	    slot = (int)((ccos + 1) * istep);
-	    shift = ((ccos + 1) - slot * calc_pot.step[col]) * istep;
-	    slot += calc_pot.first[col];
-	    step = calc_pot.step[col];
-
-	    /* Don't want lower bound spline knot to be final knot or upper
-	       bound knot will cause trouble since it goes beyond the array */
-	    if (slot >= calc_pot.last[col]) {
-	      slot--;
-	      shift += 1.0;
-	    }
-#endif /* !MEAM */
-	  }
-#ifdef MEAM
-	  atoms[i].angl_part[ijk].shift = shift;
-	  atoms[i].angl_part[ijk].slot = slot;
-	  atoms[i].angl_part[ijk].step = step;
-#endif /* MEAM */
-	  ijk++;
-	}
-      }
-      atoms[i].num_angl = ijk;
-      reg_for_free(atoms[i].angl_part, "angl part atom %d", i);
-    }
+    cache_hdr.total_angl = total_angl;
 #endif /* THREEBODY */
-
-/* increment natoms and configuration number */
-    natoms += count;
-    nconf++;
-
-  } while (!feof(infile));
-  fclose(infile);
-
-  printf("done\n");
+    cache_hdr.max_type = max_type;
+    cache_hdr.w_force = w_force;
+    cache_hdr.w_stress = w_stress;
+    cache_hdr.have_small_box = have_small_box;
+    write_config_cache(&cache_hdr, mindist);
+  }
 
   /* calculate the total number of the atom types */
   na_type = (int **)realloc(na_type, (nconf + 1) * sizeof(int *));
@@ -940,6 +1794,13 @@ void read_config(char *filename)
       printf(", ");
   }
   printf(").\n");
+#ifdef THREEBODY
+  printf("%s neighbor tables with %d neighbors and %d angles in %.3f seconds.\n",
+    cache_hit ? "Loaded" : "Built", total_neigh, total_angl, t_neigh);
+#else
+  printf("%s neighbor tables with %d neighbors in %.3f seconds.\n", cache_hit ? "Loaded" : "Built",
+    total_neigh, t_neigh);
+#endif /* THREEBODY */
 
   /* be pedantic about too large ntypes */
   if ((max_type + 1) < ntypes) {
@@ -956,6 +1817,9 @@ void read_config(char *filename)
   reg_for_free(coheng, "coheng");
   reg_for_free(conf_weight, "conf_weight");
   reg_for_free(volume, "volume");
+#ifdef COULOMB
+  reg_for_free(boxes, "boxes");
+#endif /* COULOMB */
   reg_for_free(stress, "stress");
   reg_for_free(inconf, "inconf");
   reg_for_free(cnfstart, "cnfstart");
@@ -1381,4 +2245,328 @@ void update_slots(void)
   return;
 }
 
+#if defined STIWEB || defined TERSOFF
+
+/****************************************************************
+ *
+ *  prune_neighbors: restrict the neighbor and angle lists of the
+ *	local atoms to the neighbors inside the active cutoff cut[col]
+ *	of their pair column, the lists are compacted to a radius of
+ *	MIN(PRUNE_SKIN * cut, cutmax) and only compacted again when
+ *	a cutoff grows beyond that radius
+ *
+ *	the pruned neighbors are kept behind the active ones, the
+ *	angles are rebuilt from the neighbor geometry
+ *
+ *	returns 1 if the lists were changed, all cached neighbor and
+ *	angle terms of the force routine are invalid then
+ *
+ ****************************************************************/
+
+#define PRUNE_SKIN 1.05
+
+static int *neigh_all = NULL;	/* full number of neighbors of the local atoms */
+static double *radius = NULL;	/* radius of the current compaction */
+static neigh_t *prune_tmp = NULL;
+
+int prune_neighbors(const double *cut, const double *cutmax)
+{
+  int   i, j, k, n, nlocal, ijk, first = 0, grow = 0;
+  int   nn = 0, nn_all = 0, na = 0, na_all = 0;
+  static int shown = 0;
+  neigh_t *tmp;
+  atom_t *atom;
+
+#ifdef MPI
+  nlocal = myatoms;
+#else
+  nlocal = natoms;
+#endif /* MPI */
+
+  if (NULL == neigh_all) {
+    neigh_all = (int *)malloc(MAX(nlocal, 1) * sizeof(int));
+    radius = (double *)malloc(paircol * sizeof(double));
+    n = 1;
+    for (i = 0; i < nlocal; i++) {
+      neigh_all[i] = conf_atoms[i].num_neigh;
+      n = MAX(n, neigh_all[i]);
+    }
+    prune_tmp = (neigh_t *)malloc(n * sizeof(neigh_t));
+    if (NULL == neigh_all || NULL == radius || NULL == prune_tmp)
+      error(1, "Cannot allocate memory for pruning the neighbor lists");
+    reg_for_free(neigh_all, "neigh_all");
+    reg_for_free(radius, "prune radius");
+    reg_for_free(prune_tmp, "prune buffer");
+    first = 1;
+  }
+  tmp = prune_tmp;
+
+  for (i = 0; i < paircol; i++)
+    if (first || cut[i] > radius[i])
+      grow = 1;
+  if (!grow)
+    return 0;
+
+  for (i = 0; i < paircol; i++)
+    radius[i] = MAX(cut[i], MIN(PRUNE_SKIN * cut[i], cutmax[i]));
+
+  for (i = 0; i < nlocal; i++) {
+    atom = conf_atoms + i;
+
+    /* stable partition, the active neighbors keep their order */
+    n = 0;
+    for (j = 0; j < neigh_all[i]; j++)
+      if (atom->neigh[j].r < radius[atom->neigh[j].col[0]])
+	atom->neigh[n++] = atom->neigh[j];
+      else
+	tmp[j - n] = atom->neigh[j];
+    memcpy(atom->neigh + n, tmp, (neigh_all[i] - n) * sizeof(neigh_t));
+    atom->num_neigh = n;
+
+    /* the angle block was allocated for all neighbors */
+    ijk = 0;
+#ifdef TERSOFF
+    for (j = 0; j < n; j++) {
+#else
+    for (j = 0; j < n - 1; j++) {
+#endif /* TERSOFF */
+      atom->neigh[j].ijk_start = ijk;
+#ifdef TERSOFF
+      for (k = 0; k < n; k++) {
+	if (j == k)
+	  continue;
+#else
+      for (k = j + 1; k < n; k++) {
+#endif /* TERSOFF */
+	atom->angl_part[ijk++].cos =
+	  atom->neigh[j].dist_r.x * atom->neigh[k].dist_r.x +
+	  atom->neigh[j].dist_r.y * atom->neigh[k].dist_r.y +
+	  atom->neigh[j].dist_r.z * atom->neigh[k].dist_r.z;
+      }
+    }
+    atom->num_angl = ijk;
+
+    nn += n;
+    nn_all += neigh_all[i];
+    na += ijk;
+#ifdef TERSOFF
+    na_all += neigh_all[i] * (neigh_all[i] - 1);
+#else
+    na_all += neigh_all[i] * (neigh_all[i] - 1) / 2;
+#endif /* TERSOFF */
+  }
+
+  if (first && 0 == myid && !shown) {
+    printf("Pruned neighbor lists to the active cutoffs: %d of %d neighbors, %d of %d angles",
+      nn, nn_all, na, na_all);
+#ifdef MPI
+    printf(" on process 0");
+#endif /* MPI */
+    printf(".\n");
+    fflush(stdout);
+    shown = 1;
+  }
+
+  return 1;
+}
+
+#ifdef MPI
+
+/****************************************************************
+ *
+ *  unprune_neighbors: restore the full neighbor and angle counts
+ *	of the local atoms before configurations are moved to another
+ *	process, the next call of prune_neighbors() starts over
+ *
+ ****************************************************************/
+
+void unprune_neighbors(void)
+{
+  int   i, n;
+  void *p[3];
+
+  if (NULL == neigh_all)
+    return;
+
+  for (i = 0; i < myatoms; i++) {
+    n = neigh_all[i];
+    conf_atoms[i].num_neigh = n;
+#ifdef TERSOFF
+    conf_atoms[i].num_angl = n * (n - 1);
+#else
+    conf_atoms[i].num_angl = n * (n - 1) / 2;
+#endif /* TERSOFF */
+  }
+
+  p[0] = neigh_all;
+  p[1] = radius;
+  p[2] = prune_tmp;
+  free_registered(p, 3);
+  neigh_all = NULL;
+  radius = NULL;
+  prune_tmp = NULL;
+
+  return;
+}
+
+#endif /* MPI */
+
+#endif /* STIWEB || TERSOFF */
+
 #endif /* APOT */
+
+#ifdef NEIGH_TABLE
+
+/****************************************************************
+ *
+ *  pack the neighbor lists of the local atoms (conf_atoms)
+ *  into the contiguous neighbor table neigh_tab
+ *
+ ****************************************************************/
+
+void pack_neighbors(void)
+{
+  int   h, i, j, k, s;
+  int   nlocal = 0, len = 0;
+  neigh_t *neigh;
+
+#ifdef MPI
+  nlocal = myatoms;
+#else
+  nlocal = natoms;
+#endif /* MPI */
+
+  for (i = 0; i < nlocal; i++)
+    len += conf_atoms[i].num_neigh;
+
+  /* allocate one block for each property */
+  neigh_tab.len = len;
+  len = MAX(len, 1);
+  neigh_tab.start = (int *)malloc((nlocal + 1) * sizeof(int));
+  neigh_tab.type = (int *)malloc(len * sizeof(int));
+  neigh_tab.nr = (int *)malloc(len * sizeof(int));
+  neigh_tab.r = (double *)malloc(len * sizeof(double));
+  neigh_tab.dist_r = (vector *)malloc(len * sizeof(vector));
+  if (NULL == neigh_tab.start || NULL == neigh_tab.type || NULL == neigh_tab.nr
+    || NULL == neigh_tab.r || NULL == neigh_tab.dist_r)
+    error(1, "Cannot allocate memory for neighbor table");
+  reg_for_free(neigh_tab.start, "neigh_tab.start");
+  reg_for_free(neigh_tab.type, "neigh_tab.type");
+  reg_for_free(neigh_tab.nr, "neigh_tab.nr");
+  reg_for_free(neigh_tab.r, "neigh_tab.r");
+  reg_for_free(neigh_tab.dist_r, "neigh_tab.dist_r");
+  for (s = 0; s < SLOTS; s++) {
+    neigh_tab.col[s] = (int *)malloc(len * sizeof(int));
+    neigh_tab.slot[s] = (int *)malloc(len * sizeof(int));
+    neigh_tab.shift[s] = (double *)malloc(len * sizeof(double));
+    neigh_tab.step[s] = (double *)malloc(len * sizeof(double));
+    if (NULL == neigh_tab.col[s] || NULL == neigh_tab.slot[s]
+      || NULL == neigh_tab.shift[s] || NULL == neigh_tab.step[s])
+      error(1, "Cannot allocate memory for neighbor table");
+    reg_for_free(neigh_tab.col[s], "neigh_tab.col[%d]", s);
+    reg_for_free(neigh_tab.slot[s], "neigh_tab.slot[%d]", s);
+    reg_for_free(neigh_tab.shift[s], "neigh_tab.shift[%d]", s);
+    reg_for_free(neigh_tab.step[s], "neigh_tab.step[%d]", s);
+  }
+
+  /* copy the neighbors, keeping their order */
+  k = 0;
+  for (i = 0; i < nlocal; i++) {
+    neigh_tab.start[i] = k;
+    for (j = 0; j < conf_atoms[i].num_neigh; j++) {
+      neigh = conf_atoms[i].neigh + j;
+      neigh_tab.type[k] = neigh->type;
+      neigh_tab.nr[k] = neigh->nr;
+      neigh_tab.r[k] = neigh->r;
+      neigh_tab.dist_r[k] = neigh->dist_r;
+      for (s = 0; s < SLOTS; s++) {
+	neigh_tab.col[s][k] = neigh->col[s];
+	neigh_tab.slot[s][k] = neigh->slot[s];
+	neigh_tab.shift[s][k] = neigh->shift[s];
+	neigh_tab.step[s][k] = neigh->step[s];
+      }
+      k++;
+    }
+  }
+  neigh_tab.start[nlocal] = k;
+  neigh_tab.gen++;
+
+#ifdef MPI
+  /* the local copies of the neighbor lists are not needed anymore,
+     each configuration keeps them in one block starting at its first atom,
+     the full table on the root process is handled by broadcast_neighbors() */
+  for (h = firstconf; h < firstconf + myconf; h++)
+    free(conf_atoms[cnfstart[h] - firstatom].neigh);
+  for (i = 0; i < nlocal; i++)
+    conf_atoms[i].neigh = NULL;
+#else
+  /* the neighbor lists of the full atoms array are not needed anymore,
+     each configuration keeps them in one block starting at its first atom */
+  for (h = 0; h < nconf; h++)
+    free(atoms[cnfstart[h]].neigh);
+  for (i = 0; i < natoms; i++)
+    atoms[i].neigh = NULL;
+#endif /* MPI */
+
+  return;
+}
+
+#ifdef MPI
+
+/****************************************************************
+ *
+ *  unpack_neighbors: copy the packed neighbor table back into one
+ *	block of neighbors per local configuration and release the
+ *	table, used before configurations are moved to another process
+ *
+ ****************************************************************/
+
+void unpack_neighbors(void)
+{
+  int   h, i, k, s, first, n;
+  neigh_t *block, *neigh;
+  void *p[5 + 4 * SLOTS];
+
+  for (h = firstconf; h < firstconf + myconf; h++) {
+    first = cnfstart[h] - firstatom;
+    n = neigh_tab.start[first + inconf[h]] - neigh_tab.start[first];
+    block = (neigh_t *)calloc(MAX(n, 1), sizeof(neigh_t));
+    if (NULL == block)
+      error(1, "Cannot allocate memory for neighbor table of configuration %d", h);
+    for (i = first; i < first + inconf[h]; i++)
+      conf_atoms[i].neigh = block + neigh_tab.start[i] - neigh_tab.start[first];
+    for (k = neigh_tab.start[first]; k < neigh_tab.start[first + inconf[h]]; k++) {
+      neigh = block + k - neigh_tab.start[first];
+      neigh->type = neigh_tab.type[k];
+      neigh->nr = neigh_tab.nr[k];
+      neigh->r = neigh_tab.r[k];
+      neigh->dist_r = neigh_tab.dist_r[k];
+      for (s = 0; s < SLOTS; s++) {
+	neigh->col[s] = neigh_tab.col[s][k];
+	neigh->slot[s] = neigh_tab.slot[s][k];
+	neigh->shift[s] = neigh_tab.shift[s][k];
+	neigh->step[s] = neigh_tab.step[s][k];
+      }
+    }
+  }
+
+  n = 0;
+  p[n++] = neigh_tab.start;
+  p[n++] = neigh_tab.type;
+  p[n++] = neigh_tab.nr;
+  p[n++] = neigh_tab.r;
+  p[n++] = neigh_tab.dist_r;
+  for (s = 0; s < SLOTS; s++) {
+    p[n++] = neigh_tab.col[s];
+    p[n++] = neigh_tab.slot[s];
+    p[n++] = neigh_tab.shift[s];
+    p[n++] = neigh_tab.step[s];
+  }
+  free_registered(p, n);
+
+  return;
+}
+
+#endif /* MPI */
+
+#endif /* NEIGH_TABLE */
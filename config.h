@@ -44,6 +44,19 @@ int   does_contribute(vector);
 
 #ifdef APOT
 void  update_slots(void);
+#if defined STIWEB || defined TERSOFF
+int   prune_neighbors(const double *, const double *);
+#ifdef MPI
+void  unprune_neighbors(void);
+#endif /* MPI */
+#endif /* STIWEB || TERSOFF */
 #endif /* APOT */
 
+#ifdef NEIGH_TABLE
+void  pack_neighbors(void);
+#ifdef MPI
+void  unpack_neighbors(void);
+#endif /* MPI */
+#endif /* NEIGH_TABLE */
+
 #endif /* CONFIG_H */
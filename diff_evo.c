@@ -57,7 +57,6 @@ void init_population(double **pop, double *xi, double *cost)
 {
   int   i, j;
   double temp, max, min, val;
-  double fxi[mdim];
 
   for (i = 0; i < NP; i++) {
     for (j = 0; j < (D - 2); j++)
@@ -89,8 +88,7 @@ void init_population(double **pop, double *xi, double *cost)
 #endif /* APOT */
     }
   }
-  for (i = 0; i < NP; i++)
-    cost[i] = (*calc_forces) (pop[i], fxi, 0);
+  calc_forces_batch(pop, NP, cost);
 #ifdef APOT
   opposite_check(pop, cost, 1);
 #endif /* APOT */
@@ -107,7 +105,6 @@ void init_population(double **pop, double *xi, double *cost)
 void opposite_check(double **P, double *costP, int init)
 {
   int   i, j;
-  double fxi[mdim];
   double max, min;
   double minp[ndim], maxp[ndim];
   static double *tot_cost;	/* cost of two populations */
@@ -166,8 +163,7 @@ void opposite_check(double **P, double *costP, int init)
   /* calculate cost of opposite population */
   for (i = 0; i < NP; i++)
     tot_cost[i] = costP[i];
-  for (i = NP; i < 2 * NP; i++)
-    tot_cost[i] = (*calc_forces) (tot_P[i], fxi, 0);
+  calc_forces_batch(tot_P + NP, NP, tot_cost + NP);
 
   /* evaluate the NP best individuals from both populations */
   /* sort with quicksort and return NP best indivuals */
@@ -207,36 +203,35 @@ void diff_evo(double *xi)
 #endif /* APOT */
   double *best;			/* best configuration */
   double *cost;			/* cost values for all configurations */
-  double *fxi;			/* force vector */
+  double *tcost;		/* cost values for all trial configurations */
   double *trial;		/* current trial configuration */
   double **x1;			/* current population */
   double **x2;			/* next generation */
+  double **xt;			/* trial configurations of this generation */
   FILE *ff;			/* exit flagfile */
 
   if (evo_threshold == 0.)
     return;
 
-  /* vector for force calculation */
-  fxi = vect_double(mdim);
-
-  /* vector with new configuration */
-  trial = (double *)malloc(D * sizeof(double));
-
   /* allocate memory for all configurations */
   x1 = (double **)malloc(NP * sizeof(double *));
   x2 = (double **)malloc(NP * sizeof(double *));
+  xt = (double **)malloc(NP * sizeof(double *));
   best = (double *)malloc(NP * sizeof(double));
   cost = (double *)malloc(NP * sizeof(double));
-  if (x1 == NULL || x2 == NULL || trial == NULL || cost == NULL || best == NULL)
+  tcost = (double *)malloc(NP * sizeof(double));
+  if (x1 == NULL || x2 == NULL || xt == NULL || cost == NULL || tcost == NULL || best == NULL)
     error(1, "Could not allocate memory for population vector!\n");
   for (i = 0; i < NP; i++) {
     x1[i] = (double *)malloc(D * sizeof(double));
     x2[i] = (double *)malloc(D * sizeof(double));
-    if (x1[i] == NULL || x2[i] == NULL)
+    xt[i] = (double *)malloc(D * sizeof(double));
+    if (x1[i] == NULL || x2[i] == NULL || xt[i] == NULL)
       error(1, "Could not allocate memory for population vector!\n");
     for (j = 0; j < D; j++) {
       x1[i][j] = 0;
       x2[i][j] = 0;
+      xt[i][j] = 0;
     }
   }
 
@@ -268,6 +263,7 @@ void diff_evo(double *xi)
     max = 0.;
     /* randomly create new populations */
     for (i = 0; i < NP; i++) {
+      trial = xt[i];
       /* generate random numbers */
       do
 	a = (int)floor(eqdist() * NP);
@@ -331,8 +327,14 @@ void diff_evo(double *xi)
 	}
 	j = (j + 1) % ndim;
       }
+    }
+
+    /* evaluate all trial vectors of this generation at once */
+    calc_forces_batch(xt, NP, tcost);
 
-      force = (*calc_forces) (trial, fxi, 0);
+    for (i = 0; i < NP; i++) {
+      trial = xt[i];
+      force = tcost[i];
       if (force < min) {
 	for (j = 0; j < D; j++)
 	  best[j] = trial[j];
@@ -406,13 +408,14 @@ void diff_evo(double *xi)
   for (i = 0; i < NP; i++) {
     free(x1[i]);
     free(x2[i]);
+    free(xt[i]);
   }
   free(x1);
   free(x2);
-  free(trial);
+  free(xt);
   free(cost);
+  free(tcost);
   free(best);
-  free(fxi);
 }
 
 #endif /* EVO */
@@ -0,0 +1,481 @@
+/****************************************************************
+ *
+ * ewald.c: reciprocal space part of the Ewald sum, either as
+ *     classic Ewald sum or as smooth particle mesh Ewald (PME)
+ *
+ *
+ ****************************************************************
+ *
+ * Copyright 2002-2013
+ *	Institute for Theoretical and Applied Physics
+ *	University of Stuttgart, D-70550 Stuttgart, Germany
+ *	http://potfit.sourceforge.net/
+ *
+ ****************************************************************
+ *
+ *   This file is part of potfit.
+ *
+ *   potfit is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   potfit is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with potfit; if not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************/
+
+#ifdef COULOMB
+
+#include "potfit.h"
+
+#include "ewald.h"
+#include "utils.h"
+
+#define PME_ORDER 6		/* order of the B-splines for the charge mesh */
+
+/****************************************************************
+ *
+ * reciprocal box vectors (without the factor 2 pi) and the
+ * largest wave vector index in each direction, returns the volume
+ *
+ ****************************************************************/
+
+static double ewald_setup(int h, double kcut, vector *b, int *mmax)
+{
+  int   i;
+  double vol;
+  vector *a = boxes + 3 * h;
+
+  b[0] = vec_prod(a[1], a[2]);
+  b[1] = vec_prod(a[2], a[0]);
+  b[2] = vec_prod(a[0], a[1]);
+  vol = SPROD(a[0], b[0]);
+  for (i = 0; i < 3; i++) {
+    b[i].x /= vol;
+    b[i].y /= vol;
+    b[i].z /= vol;
+    mmax[i] = (int)(kcut * sqrt(SPROD(a[i], a[i])) / (2 * M_PI));
+  }
+
+  return vol;
+}
+
+/****************************************************************
+ *
+ * add the contribution of one wave vector to the stress tensor
+ *
+ * k2 is the square of k, c the contribution to the energy
+ *
+ ****************************************************************/
+
+static void ewald_stress(vector k, double k2, double c, double dp_kappa, double *stress)
+{
+  double x = 2 * (1 / k2 + 1 / (4 * dp_kappa * dp_kappa));
+
+  stress[0] += c * (1 - x * k.x * k.x);
+  stress[1] += c * (1 - x * k.y * k.y);
+  stress[2] += c * (1 - x * k.z * k.z);
+  stress[3] -= c * x * k.x * k.y;
+  stress[4] -= c * x * k.y * k.z;
+  stress[5] -= c * x * k.z * k.x;
+
+  return;
+}
+
+/****************************************************************
+ *
+ * classic Ewald sum over all wave vectors with |k| < kcut
+ *
+ * The phase factors exp(i k r) of every atom are built from the
+ * factors of the three reciprocal box vectors. Only one half of
+ * the wave vectors is visited, k and -k contribute the same.
+ *
+ ****************************************************************/
+
+static double ewald_classic(int h, double *charge, double dp_kappa, double vol, double kcut, vector *b,
+  int *mmax, double *forces, int uf, double *stress)
+{
+  int   i, j, d, m[3], len[3], num = inconf[h];
+  double energy = 0., k2, c, s_re, s_im, f, x;
+  double *q, *e[3], *ph, *p;
+  vector k;
+  atom_t *atom = conf_atoms + cnfstart[h] - firstatom;
+
+  for (d = 0; d < 3; d++)
+    len[d] = mmax[d] + 1;
+  q = (double *)malloc(num * (3 + 2 * (len[0] + len[1] + len[2])) * sizeof(double));
+  if (NULL == q)
+    error(1, "Cannot allocate memory for the Ewald sum");
+  ph = q + num;
+  e[0] = ph + 2 * num;
+  e[1] = e[0] + 2 * num * len[0];
+  e[2] = e[1] + 2 * num * len[1];
+
+  /* exp(2 pi i m s) of the fractional coordinates s for m >= 0 */
+  for (j = 0; j < num; j++) {
+    q[j] = charge[atom[j].type];
+    for (d = 0; d < 3; d++) {
+      p = e[d] + 2 * j * len[d];
+      x = 2 * M_PI * SPROD(b[d], atom[j].pos);
+      p[0] = 1.;
+      p[1] = 0.;
+      for (i = 1; i < len[d]; i++) {
+	p[2 * i] = p[2 * i - 2] * cos(x) - p[2 * i - 1] * sin(x);
+	p[2 * i + 1] = p[2 * i - 2] * sin(x) + p[2 * i - 1] * cos(x);
+      }
+    }
+  }
+
+  for (m[0] = 0; m[0] <= mmax[0]; m[0]++)
+    for (m[1] = -mmax[1]; m[1] <= mmax[1]; m[1]++)
+      for (m[2] = -mmax[2]; m[2] <= mmax[2]; m[2]++) {
+	if (0 == m[0] && (m[1] < 0 || (0 == m[1] && m[2] <= 0)))
+	  continue;
+	k.x = 2 * M_PI * (m[0] * b[0].x + m[1] * b[1].x + m[2] * b[2].x);
+	k.y = 2 * M_PI * (m[0] * b[0].y + m[1] * b[1].y + m[2] * b[2].y);
+	k.z = 2 * M_PI * (m[0] * b[0].z + m[1] * b[1].z + m[2] * b[2].z);
+	k2 = SPROD(k, k);
+	if (k2 > kcut * kcut)
+	  continue;
+
+	/* structure factor */
+	s_re = 0.;
+	s_im = 0.;
+	for (j = 0; j < num; j++) {
+	  double re = 1., im = 0., t;
+	  for (d = 0; d < 3; d++) {
+	    p = e[d] + 2 * (j * len[d] + abs(m[d]));
+	    t = re * p[0] - im * ((m[d] < 0) ? -p[1] : p[1]);
+	    im = re * ((m[d] < 0) ? -p[1] : p[1]) + im * p[0];
+	    re = t;
+	  }
+	  ph[2 * j] = re;
+	  ph[2 * j + 1] = im;
+	  s_re += q[j] * re;
+	  s_im += q[j] * im;
+	}
+
+	/* both k and -k */
+	c = 4 * M_PI * dp_eps * exp(-k2 / (4 * dp_kappa * dp_kappa)) / (vol * k2);
+	energy += c * (s_re * s_re + s_im * s_im);
+
+	if (uf) {
+	  for (j = 0; j < num; j++) {
+	    f = 2 * c * q[j] * (s_re * ph[2 * j + 1] - s_im * ph[2 * j]);
+	    i = 3 * (cnfstart[h] + j);
+	    forces[i + 0] += f * k.x;
+	    forces[i + 1] += f * k.y;
+	    forces[i + 2] += f * k.z;
+	  }
+	}
+	if (NULL != stress)
+	  ewald_stress(k, k2, c * (s_re * s_re + s_im * s_im), dp_kappa, stress);
+      }
+
+  free(q);
+
+  return energy;
+}
+
+/****************************************************************
+ *
+ * B-spline weights M(t + l) and their derivatives for
+ * l = 0 .. PME_ORDER - 1 and 0 <= t < 1
+ *
+ ****************************************************************/
+
+static void pme_weights(double t, double *w, double *dw)
+{
+  int   k, l;
+
+  for (l = 2; l < PME_ORDER; l++)
+    w[l] = 0.;
+  w[0] = t;
+  w[1] = 1. - t;
+
+  /* raise the order from k to k + 1 */
+  for (k = 2; k < PME_ORDER; k++) {
+    if (PME_ORDER - 1 == k)
+      for (l = 0; l < PME_ORDER; l++)
+	dw[l] = w[l] - ((l > 0) ? w[l - 1] : 0.);
+    for (l = k; l >= 0; l--)
+      w[l] = ((t + l) * w[l] + (k + 1 - t - l) * ((l > 0) ? w[l - 1] : 0.)) / k;
+  }
+
+  return;
+}
+
+/****************************************************************
+ *
+ * in-place complex FFT of n = 2^m values, which are stride
+ * complex numbers apart, sign is the sign of the exponent
+ *
+ ****************************************************************/
+
+static void fft_line(double *data, int n, int stride, int sign)
+{
+  int   i, j, k, len;
+  double wr, wi, cr, ci, tr, ti, *a, *b;
+
+  /* bit reversal */
+  for (i = 1, j = 0; i < n; i++) {
+    for (k = n >> 1; j & k; k >>= 1)
+      j ^= k;
+    j ^= k;
+    if (i < j) {
+      a = data + 2 * i * stride;
+      b = data + 2 * j * stride;
+      tr = a[0];
+      ti = a[1];
+      a[0] = b[0];
+      a[1] = b[1];
+      b[0] = tr;
+      b[1] = ti;
+    }
+  }
+
+  for (len = 2; len <= n; len <<= 1) {
+    cr = cos(sign * 2 * M_PI / len);
+    ci = sin(sign * 2 * M_PI / len);
+    for (i = 0; i < n; i += len) {
+      wr = 1.;
+      wi = 0.;
+      for (k = 0; k < len / 2; k++) {
+	a = data + 2 * (i + k) * stride;
+	b = data + 2 * (i + k + len / 2) * stride;
+	tr = wr * b[0] - wi * b[1];
+	ti = wr * b[1] + wi * b[0];
+	b[0] = a[0] - tr;
+	b[1] = a[1] - ti;
+	a[0] += tr;
+	a[1] += ti;
+	tr = wr * cr - wi * ci;
+	wi = wr * ci + wi * cr;
+	wr = tr;
+      }
+    }
+  }
+
+  return;
+}
+
+static void fft_3d(double *data, int *n, int sign)
+{
+  int   i, j;
+
+  for (i = 0; i < n[0] * n[1]; i++)
+    fft_line(data + 2 * i * n[2], n[2], 1, sign);
+  for (i = 0; i < n[0]; i++)
+    for (j = 0; j < n[2]; j++)
+      fft_line(data + 2 * (i * n[1] * n[2] + j), n[1], n[2], sign);
+  for (i = 0; i < n[1] * n[2]; i++)
+    fft_line(data + 2 * i, n[0], n[1] * n[2], sign);
+
+  return;
+}
+
+/****************************************************************
+ *
+ * smooth particle mesh Ewald (Essmann et al., J. Chem. Phys. 103,
+ * 8577 (1995))
+ *
+ * The charges are spread on a mesh with B-splines, the mesh is
+ * transformed, multiplied with the influence function and
+ * transformed back. The forces are the gradient of the energy on
+ * the mesh, so they are consistent with the energy.
+ *
+ ****************************************************************/
+
+static double ewald_pme(int h, double *charge, double dp_kappa, double vol, vector *b, int *grid,
+  double *forces, int uf, double *stress)
+{
+  int   i, j, l, d, n, m[3], g[3], idx, num = inconf[h];
+  int   size = grid[0] * grid[1] * grid[2], *base;
+  double energy = 0., k2, c, t, u, w0, dw0, w01;
+  double *mesh, *bmod[3], *w, *dw, *wt;
+  vector k, f;
+  atom_t *atom = conf_atoms + cnfstart[h] - firstatom;
+
+  mesh = (double *)calloc(2 * size + grid[0] + grid[1] + grid[2] + 6 * num * PME_ORDER,
+    sizeof(double));
+  base = (int *)malloc(3 * num * sizeof(int));
+  if (NULL == mesh || NULL == base)
+    error(1, "Cannot allocate memory for the particle mesh Ewald sum");
+  bmod[0] = mesh + 2 * size;
+  bmod[1] = bmod[0] + grid[0];
+  bmod[2] = bmod[1] + grid[1];
+  w = bmod[2] + grid[2];
+  dw = w + 3 * num * PME_ORDER;
+
+  /* spread the charges */
+  for (j = 0; j < num; j++) {
+    for (d = 0; d < 3; d++) {
+      u = SPROD(b[d], atom[j].pos);
+      u = grid[d] * (u - floor(u));
+      base[3 * j + d] = MIN((int)u, grid[d] - 1);
+      pme_weights(u - base[3 * j + d], w + (3 * j + d) * PME_ORDER, dw + (3 * j + d) * PME_ORDER);
+    }
+    for (l = 0; l < PME_ORDER * PME_ORDER * PME_ORDER; l++) {
+      for (d = 0; d < 3; d++) {
+	n = (0 == d) ? l / (PME_ORDER * PME_ORDER) : ((1 == d) ? (l / PME_ORDER) % PME_ORDER : l % PME_ORDER);
+	g[d] = (base[3 * j + d] - n + grid[d]) % grid[d];
+	m[d] = n;
+      }
+      idx = (g[0] * grid[1] + g[1]) * grid[2] + g[2];
+      mesh[2 * idx] += charge[atom[j].type] * w[3 * j * PME_ORDER + m[0]]
+	* w[(3 * j + 1) * PME_ORDER + m[1]] * w[(3 * j + 2) * PME_ORDER + m[2]];
+    }
+  }
+
+  /* moduli of the B-spline structure factors */
+  wt = (double *)malloc(2 * PME_ORDER * sizeof(double));
+  if (NULL == wt)
+    error(1, "Cannot allocate memory for the particle mesh Ewald sum");
+  pme_weights(0., wt, wt + PME_ORDER);
+  for (d = 0; d < 3; d++)
+    for (i = 0; i < grid[d]; i++) {
+      double re = 0., im = 0.;
+      for (l = 1; l < PME_ORDER; l++) {
+	re += wt[l] * cos(2 * M_PI * i * (l - 1) / grid[d]);
+	im += wt[l] * sin(2 * M_PI * i * (l - 1) / grid[d]);
+      }
+      bmod[d][i] = 1. / (re * re + im * im);
+    }
+  free(wt);
+
+  fft_3d(mesh, grid, 1);
+
+  /* multiply with the influence function */
+  for (g[0] = 0; g[0] < grid[0]; g[0]++)
+    for (g[1] = 0; g[1] < grid[1]; g[1]++)
+      for (g[2] = 0; g[2] < grid[2]; g[2]++) {
+	idx = (g[0] * grid[1] + g[1]) * grid[2] + g[2];
+	for (d = 0; d < 3; d++)
+	  m[d] = (2 * g[d] < grid[d]) ? g[d] : g[d] - grid[d];
+	if (0 == m[0] && 0 == m[1] && 0 == m[2]) {
+	  mesh[2 * idx] = 0.;
+	  mesh[2 * idx + 1] = 0.;
+	  continue;
+	}
+	k.x = 2 * M_PI * (m[0] * b[0].x + m[1] * b[1].x + m[2] * b[2].x);
+	k.y = 2 * M_PI * (m[0] * b[0].y + m[1] * b[1].y + m[2] * b[2].y);
+	k.z = 2 * M_PI * (m[0] * b[0].z + m[1] * b[1].z + m[2] * b[2].z);
+	k2 = SPROD(k, k);
+	c = 2 * M_PI * dp_eps * bmod[0][g[0]] * bmod[1][g[1]] * bmod[2][g[2]]
+	  * exp(-k2 / (4 * dp_kappa * dp_kappa)) / (vol * k2);
+	t = c * (mesh[2 * idx] * mesh[2 * idx] + mesh[2 * idx + 1] * mesh[2 * idx + 1]);
+	energy += t;
+	if (NULL != stress)
+	  ewald_stress(k, k2, t, dp_kappa, stress);
+	mesh[2 * idx] *= c;
+	mesh[2 * idx + 1] *= c;
+      }
+
+  /* forces from the convolved mesh */
+  if (uf) {
+    fft_3d(mesh, grid, -1);
+    for (j = 0; j < num; j++) {
+      f.x = 0.;
+      f.y = 0.;
+      f.z = 0.;
+      for (m[0] = 0; m[0] < PME_ORDER; m[0]++) {
+	g[0] = (base[3 * j] - m[0] + grid[0]) % grid[0];
+	w0 = w[3 * j * PME_ORDER + m[0]];
+	dw0 = dw[3 * j * PME_ORDER + m[0]];
+	for (m[1] = 0; m[1] < PME_ORDER; m[1]++) {
+	  g[1] = (base[3 * j + 1] - m[1] + grid[1]) % grid[1];
+	  w01 = w0 * w[(3 * j + 1) * PME_ORDER + m[1]];
+	  for (m[2] = 0; m[2] < PME_ORDER; m[2]++) {
+	    g[2] = (base[3 * j + 2] - m[2] + grid[2]) % grid[2];
+	    t = mesh[2 * ((g[0] * grid[1] + g[1]) * grid[2] + g[2])];
+	    u = w[(3 * j + 2) * PME_ORDER + m[2]];
+	    /* gradient with respect to the scaled fractional coordinates */
+	    k.x = dw0 * w[(3 * j + 1) * PME_ORDER + m[1]] * u;
+	    k.y = w0 * dw[(3 * j + 1) * PME_ORDER + m[1]] * u;
+	    k.z = w01 * dw[(3 * j + 2) * PME_ORDER + m[2]];
+	    f.x += t * (k.x * grid[0] * b[0].x + k.y * grid[1] * b[1].x + k.z * grid[2] * b[2].x);
+	    f.y += t * (k.x * grid[0] * b[0].y + k.y * grid[1] * b[1].y + k.z * grid[2] * b[2].y);
+	    f.z += t * (k.x * grid[0] * b[0].z + k.y * grid[1] * b[1].z + k.z * grid[2] * b[2].z);
+	  }
+	}
+      }
+      i = 3 * (cnfstart[h] + j);
+      forces[i + 0] -= 2 * charge[atom[j].type] * f.x;
+      forces[i + 1] -= 2 * charge[atom[j].type] * f.y;
+      forces[i + 2] -= 2 * charge[atom[j].type] * f.z;
+    }
+  }
+
+  free(base);
+  free(mesh);
+
+  return energy;
+}
+
+/****************************************************************
+ *
+ * ewald_recip: reciprocal space energy of configuration h, the
+ *     forces are added to forces, the stresses (not yet divided
+ *     by the volume) to stress unless it is NULL
+ *
+ * ewald == 1 picks the cheaper of both methods for every
+ * configuration, 2 always uses the classic sum and 3 always the
+ * particle mesh. The real space part and the self energy are
+ * calculated in the force routines.
+ *
+ ****************************************************************/
+
+double ewald_recip(int h, double *charge, double dp_kappa, double *forces, int uf, double *stress)
+{
+  int   i, mmax[3], grid[3], pme;
+  double kcut, vol, energy, q = 0., nk, size;
+  vector b[3];
+
+  if (dp_kappa <= 0.)
+    return 0.;
+
+  kcut = 2 * dp_kappa * sqrt(-log(ewald_tol));
+  vol = ewald_setup(h, kcut, b, mmax);
+
+  /* the mesh resolves twice the largest wave vector */
+  for (i = 0; i < 3; i++) {
+    grid[i] = 8;
+    while (grid[i] < 4 * mmax[i] + 2)
+      grid[i] *= 2;
+  }
+
+  /* estimated number of operations of both methods */
+  if (1 == ewald) {
+    nk = M_PI / 12 * (2 * mmax[0] + 1) * (2 * mmax[1] + 1) * (2 * mmax[2] + 1);
+    size = (double)grid[0] * grid[1] * grid[2];
+    pme = (2. * inconf[h] * PME_ORDER * PME_ORDER * PME_ORDER + 10. * size * log(size) / log(2.)
+      < 2. * inconf[h] * nk);
+  } else
+    pme = (3 == ewald);
+
+  if (pme)
+    energy = ewald_pme(h, charge, dp_kappa, vol, b, grid, forces, uf, stress);
+  else
+    energy = ewald_classic(h, charge, dp_kappa, vol, kcut, b, mmax, forces, uf, stress);
+
+  /* neutralizing background for charged configurations */
+  for (i = 0; i < inconf[h]; i++)
+    q += charge[conf_atoms[cnfstart[h] - firstatom + i].type];
+  if (0. != q) {
+    nk = -M_PI * dp_eps * q * q / (2 * vol * dp_kappa * dp_kappa);
+    energy += nk;
+    if (NULL != stress)
+      for (i = 0; i < 3; i++)
+	stress[i] += nk;
+  }
+
+  return energy;
+}
+
+#endif /* COULOMB */
@@ -34,6 +34,7 @@
 
 #include "functions.h"
 #include "potential.h"
+#include "profile.h"
 #include "splines.h"
 #include "utils.h"
 
@@ -78,6 +79,10 @@
  *    flag == 2 will cause all processes to perform a potsync (i.e. broadcast
  *             any changed potential parameters from process 0 to the others)
  *             before calculation of forces
+ *    flag == 5 will cause all processes to only calculate the atomic
+ *             densities of their configurations and collect the smallest
+ *             and largest density of each atom type in rho_min and rho_max,
+ *             as needed by rescale()
  *    all other values will cause a set of forces to be calculated. The root
  *             process will return with the sum of squares of the forces,
  *             while all other processes remain in the function, waiting for
@@ -88,7 +93,8 @@
 
 double calc_forces_adp(double *xi_opt, double *forces, int flag)
 {
-  int   first, col, i;
+  int   first, col;
+  double t_prof;		/* start of the current phase of the profile */
   double *xi = NULL;
 
   /* Some useful temp variables */
@@ -109,6 +115,7 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
 
   /* This is the start of an infinite loop */
   while (1) {
+    t_prof = prof_start();
 
     /* Reset tmpsum and rho_sum_loc
        tmpsum = Sum of all the forces, energies and constraints
@@ -124,27 +131,65 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
 #endif /* APOT && !MPI */
 
 #ifdef MPI
-    /* exchange potential and flag value */
+    if (local_forces) {
+      /* a single column of the jacobian, no communication */
+#ifdef APOT
+      /* every process corrects its own copy of the parameters */
+      apot_check_params(xi_opt);
+      update_calc_table(xi_opt, xi, 0);
+#endif /* APOT */
+    } else {
+      /* exchange potential and flag value */
 #ifndef APOT
-    MPI_Bcast(xi, calc_pot.len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      MPI_Bcast(xi, calc_pot.len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 #endif /* APOT */
-    MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      t_prof = prof_stop(PROF_MPI, t_prof);
 
-    if (1 == flag)
-      break;			/* Exception: flag 1 means clean up */
+      if (1 == flag)
+	break;			/* Exception: flag 1 means clean up */
 
 #ifdef APOT
-    if (0 == myid)
-      apot_check_params(xi_opt);
-    MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    update_calc_table(xi_opt, xi, 0);
+      if (0 == myid)
+	apot_check_params(xi_opt);
+      MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      update_calc_table(xi_opt, xi, 0);
 #else
-    /* if flag==2 then the potential parameters have changed -> sync */
-    if (2 == flag)
-      potsync();
+      /* if flag==2 then the potential parameters have changed -> sync */
+      if (2 == flag)
+	potsync();
 #endif /* APOT */
+
+      /* flag 3: all processes evaluate the columns of the jacobian */
+      if (3 == flag) {
+	gamma_columns(xi_opt);
+	if (0 == myid)
+	  return 0.0;
+	continue;
+      }
+
+      /* flag 4: all processes evaluate a batch of parameter vectors */
+      if (4 == flag) {
+	batch_forces();
+	if (0 == myid)
+	  return 0.0;
+	continue;
+      }
+
+      /* move configurations to other processes if the load is unbalanced */
+      balance_configs();
+    }
 #endif /* MPI */
 
+#if !defined NORESCALE && !defined APOT
+    /* flag 5: collect the range of the atomic densities */
+    if (5 == flag)
+      for (col = 0; col < ntypes; col++) {
+	rho_min[col] = 1e100;
+	rho_max[col] = -1e100;
+      }
+#endif /* !NORESCALE && !APOT */
+
     /* init second derivatives for splines */
 
     /* [0, ...,  paircol - 1] = pair potentials */
@@ -154,23 +199,28 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
     /* [2 * paircol + 2 * ntypes, ..., 3 * paircol + 2 * ntypes - 1] = quadrupole function */
     for (col = 0; col < 3 * paircol + 2 * ntypes; col++) {
       first = calc_pot.first[col];
-      if (format == 0 || format == 3)
-	spline_ed(calc_pot.step[col], xi + first,
-	  calc_pot.last[col] - first + 1, *(xi + first - 2), 0.0, calc_pot.d2tab + first);
-      else			/* format >= 4 ! */
-	spline_ne(calc_pot.xcoord + first, xi + first,
-	  calc_pot.last[col] - first + 1, *(xi + first - 2), 0.0, calc_pot.d2tab + first);
+      spline_col(&calc_pot, xi, col, *(xi + first - 2), 0.0);
     }
 
 #ifndef MPI
     myconf = nconf;
 #endif /* MPI */
 
-    /* region containing loop over configurations */
+    t_prof = prof_stop(PROF_SETUP, t_prof);
+
+    /* region containing loop over configurations,
+       configurations are distributed among the threads of each process */
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:tmpsum,rho_sum_loc)
+#endif /* _OPENMP */
     {
       /* Temp variables */
       atom_t *atom;
-      int   h, j;
+      int   h, i, j;
+#ifdef MPI
+      double t_conf;		/* start time of the current configuration */
+#endif /* MPI */
+      double t_phase;		/* start of the current phase of the profile */
       int   n_i, n_j;
       int   self;
       int   uf;
@@ -203,9 +253,33 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
       sym_tens w_force;
       vector u_force;
 
+#if !defined NORESCALE && !defined APOT
+      /* range of the atomic densities of this thread */
+      double *rho_lo = NULL, *rho_hi = NULL;
+
+      if (5 == flag) {
+	rho_lo = (double *)malloc(2 * ntypes * sizeof(double));
+	if (NULL == rho_lo)
+	  error(1, "Cannot allocate memory for the range of the atomic densities");
+	rho_hi = rho_lo + ntypes;
+	for (i = 0; i < ntypes; i++) {
+	  rho_lo[i] = 1e100;
+	  rho_hi[i] = -1e100;
+	}
+      }
+#endif /* !NORESCALE && !APOT */
+
       /* loop over configurations */
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif /* _OPENMP */
       for (h = firstconf; h < firstconf + myconf; h++) {
-	uf = conf_uf[h - firstconf];
+#ifdef MPI
+	t_conf = wall_time();
+#endif /* MPI */
+	t_phase = prof_start();
+	/* flag 5 only needs the atomic densities */
+	uf = (5 == flag) ? 0 : conf_uf[h - firstconf];
 #ifdef STRESS
 	us = conf_us[h - firstconf];
 #endif /* STRESS */
@@ -391,6 +465,14 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
 	    }
 	  }			/* loop over neighbors */
 
+#if !defined NORESCALE && !defined APOT
+	  /* range of the densities before they are limited to the domain of F */
+	  if (5 == flag) {
+	    rho_lo[atom->type] = MIN(rho_lo[atom->type], atom->rho);
+	    rho_hi[atom->type] = MAX(rho_hi[atom->type], atom->rho);
+	  }
+#endif /* !NORESCALE && !APOT */
+
 	  col_F = paircol + ntypes + atom->type;	/* column of F */
 #ifndef NORESCALE
 	  if (atom->rho > calc_pot.end[col_F]) {
@@ -477,6 +559,7 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
 	  eng_store *= 0.5;
 	  forces[energy_p + h] += eng_store;
 	}			/* second loop over atoms */
+	t_phase = prof_stop(PROF_PAIR, t_phase);
 
 	/* 3rd loop over atom: ADP forces */
 	if (uf) {		/* only required if we calc forces */
@@ -629,6 +712,7 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
 		(dsquare(forces[n_i + 0]) + dsquare(forces[n_i + 1]) + dsquare(forces[n_i + 2]));
 	  }			/* third loop over atoms */
 	}
+	t_phase = prof_stop(PROF_MANY, t_phase);
 
 	/* energy contributions */
 	forces[energy_p + h] /= (double)inconf[h];
@@ -649,12 +733,48 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
 	/* limiting constraints per configuration */
 	tmpsum += conf_weight[h] * dsquare(forces[limit_p + h]);
 
+	prof_stop(PROF_SUM, t_phase);
+#ifdef MPI
+	conf_time[h - firstconf] += wall_time() - t_conf;
+#endif /* MPI */
       }				/* loop over configurations */
+
+#if !defined NORESCALE && !defined APOT
+      if (5 == flag) {
+#ifdef _OPENMP
+#pragma omp critical
+#endif /* _OPENMP */
+	for (i = 0; i < ntypes; i++) {
+	  rho_min[i] = MIN(rho_min[i], rho_lo[i]);
+	  rho_max[i] = MAX(rho_max[i], rho_hi[i]);
+	}
+	free(rho_lo);
+      }
+#endif /* !NORESCALE && !APOT */
     }				/* parallel region */
 
+    t_prof = prof_start();
+
+#if !defined NORESCALE && !defined APOT
+    /* flag 5: combine the density ranges of all processes, no forces needed */
+    if (5 == flag) {
 #ifdef MPI
-    /* Reduce rho_sum */
-    MPI_Reduce(&rho_sum_loc, &rho_sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+      MPI_Allreduce(MPI_IN_PLACE, rho_min, ntypes, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+      MPI_Allreduce(MPI_IN_PLACE, rho_max, ntypes, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+      prof_stop(PROF_MPI, t_prof);
+#endif /* MPI */
+      if (0 == myid)
+	return 0.0;
+      continue;
+    }
+#endif /* !NORESCALE && !APOT */
+
+#ifdef MPI
+    /* Reduce rho_sum, a single column of the jacobian only needs the local part */
+    if (local_forces)
+      rho_sum = rho_sum_loc;
+    else
+      MPI_Reduce(&rho_sum_loc, &rho_sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
 #else /* MPI */
     rho_sum = rho_sum_loc;
 #endif /* MPI */
@@ -724,7 +844,13 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
 #endif /* !NOPUNISH */
 
 
+    t_prof = prof_stop(PROF_SUM, t_prof);
+
 #ifdef MPI
+    /* a single column of the jacobian only needs the local part */
+    if (local_forces)
+      return tmpsum;
+
     /* reduce global sum */
     sum = 0.0;
     MPI_Reduce(&tmpsum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
@@ -736,9 +862,11 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, forces + natoms * 3,
 	conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_STENS, forces + natoms * 3 + nconf,
 	conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
       /* punishment constraints */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, forces + natoms * 3 + 7 * nconf,
 	conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
@@ -749,14 +877,17 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(forces + natoms * 3 + firstconf, myconf, MPI_DOUBLE,
 	forces + natoms * 3, conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(forces + natoms * 3 + nconf + 6 * firstconf, myconf, MPI_STENS,
 	forces + natoms * 3 + nconf, conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
       /* punishment constraints */
       MPI_Gatherv(forces + natoms * 3 + 7 * nconf + firstconf, myconf, MPI_DOUBLE,
 	forces + natoms * 3 + 7 * nconf, conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
     }
     /* no need to pick up dummy constraints - are already @ root */
+    prof_stop(PROF_MPI, t_prof);
 #else
     sum = tmpsum;		/* global sum = local sum  */
 #endif /* MPI */
@@ -764,6 +895,7 @@ double calc_forces_adp(double *xi_opt, double *forces, int flag)
     /* root process exits this function now */
     if (myid == 0) {
       fcalls++;			/* Increase function call counter */
+      prof_force();
       if (isnan(sum)) {
 #ifdef DEBUG
 	printf("\n--> Force is nan! <--\n\n");
@@ -34,9 +34,16 @@
 
 #include "functions.h"
 #include "potential.h"
+#include "profile.h"
 #include "splines.h"
 #include "utils.h"
 
+/* spline values of a neighbor block, allocated once by each thread */
+static double *spline_buf = NULL;
+#ifdef _OPENMP
+#pragma omp threadprivate(spline_buf)
+#endif /* _OPENMP */
+
 /****************************************************************
  *
  *  compute forces using eam potentials with spline interpolation
@@ -78,6 +85,10 @@
  *    flag == 2 will cause all processes to perform a potsync (i.e. broadcast
  *             any changed potential parameters from process 0 to the others)
  *             before calculation of forces
+ *    flag == 5 will cause all processes to only calculate the atomic
+ *             densities of their configurations and collect the smallest
+ *             and largest density of each atom type in rho_min and rho_max,
+ *             as needed by rescale()
  *    all other values will cause a set of forces to be calculated. The root
  *             process will return with the sum of squares of the forces,
  *             while all other processes remain in the function, waiting for
@@ -88,7 +99,8 @@
 
 double calc_forces_eam(double *xi_opt, double *forces, int flag)
 {
-  int   first, col, i;
+  int   first, col;
+  double t_prof;		/* start of the current phase of the profile */
   double tmpsum = 0.0, sum = 0.0;
   double *xi = NULL;
 
@@ -109,6 +121,7 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
 
   /* This is the start of an infinite loop */
   while (1) {
+    t_prof = prof_start();
     tmpsum = 0.0;		/* sum of squares of local process */
     rho_sum_loc = 0.0;
 
@@ -120,39 +133,72 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
 #endif /* APOT && !MPI */
 
 #ifdef MPI
+    if (local_forces) {
+      /* a single column of the jacobian, no communication */
+#ifdef APOT
+      /* every process corrects its own copy of the parameters */
+      apot_check_params(xi_opt);
+      update_calc_table(xi_opt, xi, 0);
+#endif /* APOT */
+    } else {
 #ifndef APOT
-    /* exchange potential and flag value */
-    MPI_Bcast(xi, calc_pot.len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      /* exchange potential and flag value */
+      MPI_Bcast(xi, calc_pot.len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 #endif /* APOT */
-    MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      t_prof = prof_stop(PROF_MPI, t_prof);
 
-    if (1 == flag)
-      break;			/* Exception: flag 1 means clean up */
+      if (1 == flag)
+	break;			/* Exception: flag 1 means clean up */
 
 #ifdef APOT
-    if (0 == myid)
-      apot_check_params(xi_opt);
-    MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    update_calc_table(xi_opt, xi, 0);
+      if (0 == myid)
+	apot_check_params(xi_opt);
+      MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      update_calc_table(xi_opt, xi, 0);
 #else /* APOT */
-    /* if flag==2 then the potential parameters have changed -> sync */
-    if (2 == flag)
-      potsync();
+      /* if flag==2 then the potential parameters have changed -> sync */
+      if (2 == flag)
+	potsync();
 #endif /* APOT */
+
+      /* flag 3: all processes evaluate the columns of the jacobian */
+      if (3 == flag) {
+	gamma_columns(xi_opt);
+	if (0 == myid)
+	  return 0.0;
+	continue;
+      }
+
+      /* flag 4: all processes evaluate a batch of parameter vectors */
+      if (4 == flag) {
+	batch_forces();
+	if (0 == myid)
+	  return 0.0;
+	continue;
+      }
+
+      /* move configurations to other processes if the load is unbalanced */
+      balance_configs();
+    }
 #endif /* MPI */
 
+#if !defined NORESCALE && !defined APOT
+    /* flag 5: collect the range of the atomic densities */
+    if (5 == flag)
+      for (col = 0; col < ntypes; col++) {
+	rho_min[col] = 1e100;
+	rho_max[col] = -1e100;
+      }
+#endif /* !NORESCALE && !APOT */
+
     /* init second derivatives for splines */
 
     /* [0, ...,  paircol - 1] = pair potentials */
     /* [paircol, ..., paircol + ntypes - 1] = transfer function */
     for (col = 0; col < paircol + ntypes; col++) {
       first = calc_pot.first[col];
-      if (0 == format || 3 == format)
-	spline_ed(calc_pot.step[col], xi + first,
-	  calc_pot.last[col] - first + 1, *(xi + first - 2), 0.0, calc_pot.d2tab + first);
-      else			/* format >= 4 ! */
-	spline_ne(calc_pot.xcoord + first, xi + first,
-	  calc_pot.last[col] - first + 1, *(xi + first - 2), 0.0, calc_pot.d2tab + first);
+      spline_col(&calc_pot, xi, col, *(xi + first - 2), 0.0);
     }
 
     /* [paircol + ntypes, ..., paircol + 2 * ntypes - 1] = embedding function */
@@ -162,26 +208,15 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
       first = calc_pot.first[col];
       /* gradient at left boundary matched to square root function,
          when 0 not in domain(F), else natural spline */
-      if (0 == format || 3 == format)
-	spline_ed(calc_pot.step[col], xi + first, calc_pot.last[col] - first + 1,
+      spline_col(&calc_pot, xi, col,
 #ifdef WZERO
-	  ((calc_pot.begin[col] <= 0.0) ? *(xi + first - 2)
-	    : 0.5 / xi[first]), ((calc_pot.end[col] >= 0.0) ? *(xi + first - 1)
-	    : -0.5 / xi[calc_pot.last[col]]),
+	((calc_pot.begin[col] <= 0.0) ? *(xi + first - 2)
+	  : 0.5 / xi[first]), ((calc_pot.end[col] >= 0.0) ? *(xi + first - 1)
+	  : -0.5 / xi[calc_pot.last[col]])
 #else /* WZERO: F is natural spline in any case */
-	  *(xi + first - 2), *(xi + first - 1),
-#endif /* WZERO */
-	  calc_pot.d2tab + first);
-      else			/* format >= 4 ! */
-	spline_ne(calc_pot.xcoord + first, xi + first, calc_pot.last[col] - first + 1,
-#ifdef WZERO
-	  (calc_pot.begin[col] <= 0.0 ? *(xi + first - 2)
-	    : 0.5 / xi[first]), (calc_pot.end[col] >= 0.0 ? *(xi + first - 1)
-	    : -0.5 / xi[calc_pot.last[col]]),
-#else /* WZERO */
-	  *(xi + first - 2), *(xi + first - 1),
+	*(xi + first - 2), *(xi + first - 1)
 #endif /* WZERO */
-	  calc_pot.d2tab + first);
+	);
     }
 #endif /* PARABOLA */
 
@@ -189,10 +224,20 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
     myconf = nconf;
 #endif /* MPI */
 
-    /* region containing loop over configurations */
+    t_prof = prof_stop(PROF_SETUP, t_prof);
+
+    /* region containing loop over configurations,
+       configurations are distributed among the threads of each process */
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:tmpsum,rho_sum_loc)
+#endif /* _OPENMP */
     {
       atom_t *atom;
-      int   h, j;
+      int   h, i, k;
+#ifdef MPI
+      double t_conf;		/* start time of the current configuration */
+#endif /* MPI */
+      double t_phase;		/* start of the current phase of the profile */
       int   n_i, n_j;
       int   self;
       int   uf;
@@ -203,12 +248,14 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
       int   us, stresses;
 #endif /* STRESS */
 
-      /* pointer for neighbor table */
-      neigh_t *neigh;
+      /* packed neighbor table */
+      const neigh_table_t *nt = &neigh_tab;
+      int   nr, col_rho, k0, nn;
+      double r;
+      vector *dist_r;
 
       /* pair variables */
       double phi_val, phi_grad;
-      double r;
       vector tmp_force;
 
       /* eam variables */
@@ -216,9 +263,46 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
       double eam_force;
       double rho_val, rho_grad, rho_grad_j;
 
+      /* values and gradients of pair and transfer functions of a neighbor block */
+      double *phi_v, *phi_g, *rho_v, *rho_g;
+#if !defined NORESCALE && !defined APOT
+      /* range of the atomic densities of this thread */
+      double *rho_lo, *rho_hi;
+#endif /* !NORESCALE && !APOT */
+
+      if (NULL == spline_buf) {
+	spline_buf = (double *)malloc((4 * MAX(maxneigh, 1) + 2 * ntypes) * sizeof(double));
+	if (NULL == spline_buf)
+	  error(1, "Cannot allocate memory for the spline values");
+#ifdef _OPENMP
+#pragma omp critical
+#endif /* _OPENMP */
+	reg_for_free(spline_buf, "spline_buf");
+      }
+      phi_v = spline_buf;
+      phi_g = phi_v + MAX(maxneigh, 1);
+      rho_v = phi_g + MAX(maxneigh, 1);
+      rho_g = rho_v + MAX(maxneigh, 1);
+#if !defined NORESCALE && !defined APOT
+      rho_lo = rho_g + MAX(maxneigh, 1);
+      rho_hi = rho_lo + ntypes;
+      for (i = 0; i < ntypes; i++) {
+	rho_lo[i] = 1e100;
+	rho_hi[i] = -1e100;
+      }
+#endif /* !NORESCALE && !APOT */
+
       /* loop over configurations */
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif /* _OPENMP */
       for (h = firstconf; h < firstconf + myconf; h++) {
-	uf = conf_uf[h - firstconf];
+#ifdef MPI
+	t_conf = wall_time();
+#endif /* MPI */
+	t_phase = prof_start();
+	/* flag 5 only needs the atomic densities */
+	uf = (5 == flag) ? 0 : conf_uf[h - firstconf];
 #ifdef STRESS
 	us = conf_us[h - firstconf];
 #endif /* STRESS */
@@ -254,20 +338,25 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
 	for (i = 0; i < inconf[h]; i++) {
 	  atom = conf_atoms + i + cnfstart[h] - firstatom;
 	  n_i = 3 * (cnfstart[h] + i);
+	  /* pair and transfer functions of all neighbors at once */
+	  k0 = nt->start[i + cnfstart[h] - firstatom];
+	  nn = nt->start[i + cnfstart[h] - firstatom + 1] - k0;
+	  splint_comb_vec(&calc_pot, nn, nt->slot[0] + k0, nt->shift[0] + k0, nt->step[0] + k0, phi_v,
+	    phi_g);
+	  splint_comb_vec(&calc_pot, nn, nt->slot[1] + k0, nt->shift[1] + k0, nt->step[1] + k0, rho_v,
+	    rho_g);
 	  /* loop over neighbors */
-	  for (j = 0; j < atom->num_neigh; j++) {
-	    neigh = atom->neigh + j;
+	  for (k = k0; k < k0 + nn; k++) {
+	    nr = nt->nr[k];
+	    r = nt->r[k];
+	    dist_r = nt->dist_r + k;
 	    /* In small cells, an atom might interact with itself */
-	    self = (neigh->nr == i + cnfstart[h]) ? 1 : 0;
+	    self = (nr == i + cnfstart[h]) ? 1 : 0;
 
 	    /* pair potential part */
-	    if (neigh->r < calc_pot.end[neigh->col[0]]) {
-	      /* fn value and grad are calculated in the same step */
-	      if (uf)
-		phi_val =
-		  splint_comb_dir(&calc_pot, xi, neigh->slot[0], neigh->shift[0], neigh->step[0], &phi_grad);
-	      else
-		phi_val = splint_dir(&calc_pot, xi, neigh->slot[0], neigh->shift[0], neigh->step[0]);
+	    if (r < calc_pot.end[nt->col[0][k]]) {
+	      phi_val = phi_v[k - k0];
+	      phi_grad = phi_g[k - k0];
 	      /* avoid double counting if atom is interacting with a copy of itself */
 	      if (self) {
 		phi_val *= 0.5;
@@ -279,26 +368,26 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
 
 	      /* calculate forces */
 	      if (uf) {
-		tmp_force.x = neigh->dist_r.x * phi_grad;
-		tmp_force.y = neigh->dist_r.y * phi_grad;
-		tmp_force.z = neigh->dist_r.z * phi_grad;
+		tmp_force.x = dist_r->x * phi_grad;
+		tmp_force.y = dist_r->y * phi_grad;
+		tmp_force.z = dist_r->z * phi_grad;
 		forces[n_i + 0] += tmp_force.x;
 		forces[n_i + 1] += tmp_force.y;
 		forces[n_i + 2] += tmp_force.z;
 		/* actio = reactio */
-		n_j = 3 * neigh->nr;
+		n_j = 3 * nr;
 		forces[n_j + 0] -= tmp_force.x;
 		forces[n_j + 1] -= tmp_force.y;
 		forces[n_j + 2] -= tmp_force.z;
 #ifdef STRESS
 		/* also calculate pair stresses */
 		if (us) {
-		  forces[stresses + 0] -= neigh->dist.x * tmp_force.x;
-		  forces[stresses + 1] -= neigh->dist.y * tmp_force.y;
-		  forces[stresses + 2] -= neigh->dist.z * tmp_force.z;
-		  forces[stresses + 3] -= neigh->dist.x * tmp_force.y;
-		  forces[stresses + 4] -= neigh->dist.y * tmp_force.z;
-		  forces[stresses + 5] -= neigh->dist.z * tmp_force.x;
+		  forces[stresses + 0] -= dist_r->x * r * tmp_force.x;
+		  forces[stresses + 1] -= dist_r->y * r * tmp_force.y;
+		  forces[stresses + 2] -= dist_r->z * r * tmp_force.z;
+		  forces[stresses + 3] -= dist_r->x * r * tmp_force.y;
+		  forces[stresses + 4] -= dist_r->y * r * tmp_force.z;
+		  forces[stresses + 5] -= dist_r->z * r * tmp_force.x;
 		}
 #endif /* STRESS */
 	      }
@@ -306,29 +395,37 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
 
 	    /* neighbor in range */
 	    /* calculate atomic densities */
-	    if (atom->type == neigh->type) {
+	    col_rho = nt->col[1][k];
+	    if (atom->type == nt->type[k]) {
 	      /* then transfer(a->b)==transfer(b->a) */
-	      if (neigh->r < calc_pot.end[neigh->col[1]]) {
-		rho_val = splint_dir(&calc_pot, xi, neigh->slot[1], neigh->shift[1], neigh->step[1]);
+	      if (r < calc_pot.end[col_rho]) {
+		rho_val = rho_v[k - k0];
 		atom->rho += rho_val;
 		/* avoid double counting if atom is interacting with a
 		   copy of itself */
 		if (!self) {
-		  conf_atoms[neigh->nr - firstatom].rho += rho_val;
+		  conf_atoms[nr - firstatom].rho += rho_val;
 		}
 	      }
 	    } else {
 	      /* transfer(a->b)!=transfer(b->a) */
-	      if (neigh->r < calc_pot.end[neigh->col[1]]) {
-		atom->rho += splint_dir(&calc_pot, xi, neigh->slot[1], neigh->shift[1], neigh->step[1]);
+	      if (r < calc_pot.end[col_rho]) {
+		atom->rho += rho_v[k - k0];
 	      }
 	      /* cannot use slot/shift to access splines */
-	      if (neigh->r < calc_pot.end[paircol + atom->type])
-		conf_atoms[neigh->nr - firstatom].rho +=
-		  splint(&calc_pot, xi, paircol + atom->type, neigh->r);
+	      if (r < calc_pot.end[paircol + atom->type])
+		conf_atoms[nr - firstatom].rho += splint(&calc_pot, xi, paircol + atom->type, r);
 	    }
 	  }			/* loop over all neighbors */
 
+#if !defined NORESCALE && !defined APOT
+	  /* range of the densities before they are limited to the domain of F */
+	  if (5 == flag) {
+	    rho_lo[atom->type] = MIN(rho_lo[atom->type], atom->rho);
+	    rho_hi[atom->type] = MAX(rho_hi[atom->type], atom->rho);
+	  }
+#endif /* !NORESCALE && !APOT */
+
 	  col_F = paircol + ntypes + atom->type;	/* column of F */
 #ifndef NORESCALE
 	  if (atom->rho > calc_pot.end[col_F]) {
@@ -399,54 +496,60 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
 	  /* sum up rho */
 	  rho_sum_loc += atom->rho;
 	}			/* second loop over atoms */
+	t_phase = prof_stop(PROF_PAIR, t_phase);
 
 	/* 3rd loop over atom: EAM force */
 	if (uf) {		/* only required if we calc forces */
 	  for (i = 0; i < inconf[h]; i++) {
 	    atom = conf_atoms + i + cnfstart[h] - firstatom;
 	    n_i = 3 * (cnfstart[h] + i);
-	    for (j = 0; j < atom->num_neigh; j++) {
+	    /* transfer function gradients of all neighbors at once */
+	    k0 = nt->start[i + cnfstart[h] - firstatom];
+	    nn = nt->start[i + cnfstart[h] - firstatom + 1] - k0;
+	    splint_comb_vec(&calc_pot, nn, nt->slot[1] + k0, nt->shift[1] + k0, nt->step[1] + k0, rho_v,
+	      rho_g);
+	    for (k = k0; k < k0 + nn; k++) {
 	      /* loop over neighbors */
-	      neigh = atom->neigh + j;
+	      nr = nt->nr[k];
+	      r = nt->r[k];
+	      dist_r = nt->dist_r + k;
+	      col_rho = nt->col[1][k];
 	      /* In small cells, an atom might interact with itself */
-	      self = (neigh->nr == i + cnfstart[h]) ? 1 : 0;
+	      self = (nr == i + cnfstart[h]) ? 1 : 0;
 	      col_F = paircol + ntypes + atom->type;	/* column of F */
-	      r = neigh->r;
 	      /* are we within reach? */
-	      if ((r < calc_pot.end[neigh->col[1]]) || (r < calc_pot.end[col_F - ntypes])) {
-		rho_grad =
-		  (r < calc_pot.end[neigh->col[1]]) ? splint_grad_dir(&calc_pot, xi, neigh->slot[1],
-		  neigh->shift[1], neigh->step[1]) : 0.0;
-		if (atom->type == neigh->type)	/* use actio = reactio */
+	      if ((r < calc_pot.end[col_rho]) || (r < calc_pot.end[col_F - ntypes])) {
+		rho_grad = (r < calc_pot.end[col_rho]) ? rho_g[k - k0] : 0.0;
+		if (atom->type == nt->type[k])	/* use actio = reactio */
 		  rho_grad_j = rho_grad;
 		else
 		  rho_grad_j =
 		    (r < calc_pot.end[col_F - ntypes]) ? splint_grad(&calc_pot, xi, col_F - ntypes, r) : 0.;
 		/* now we know everything - calculate forces */
-		eam_force = (rho_grad * atom->gradF + rho_grad_j * conf_atoms[(neigh->nr) - firstatom].gradF);
+		eam_force = (rho_grad * atom->gradF + rho_grad_j * conf_atoms[nr - firstatom].gradF);
 		/* avoid double counting if atom is interacting with a copy of itself */
 		if (self)
 		  eam_force *= 0.5;
-		tmp_force.x = neigh->dist_r.x * eam_force;
-		tmp_force.y = neigh->dist_r.y * eam_force;
-		tmp_force.z = neigh->dist_r.z * eam_force;
+		tmp_force.x = dist_r->x * eam_force;
+		tmp_force.y = dist_r->y * eam_force;
+		tmp_force.z = dist_r->z * eam_force;
 		forces[n_i + 0] += tmp_force.x;
 		forces[n_i + 1] += tmp_force.y;
 		forces[n_i + 2] += tmp_force.z;
 		/* actio = reactio */
-		n_j = 3 * neigh->nr;
+		n_j = 3 * nr;
 		forces[n_j + 0] -= tmp_force.x;
 		forces[n_j + 1] -= tmp_force.y;
 		forces[n_j + 2] -= tmp_force.z;
 #ifdef STRESS
 		/* and stresses */
 		if (us) {
-		  forces[stresses + 0] -= neigh->dist.x * tmp_force.x;
-		  forces[stresses + 1] -= neigh->dist.y * tmp_force.y;
-		  forces[stresses + 2] -= neigh->dist.z * tmp_force.z;
-		  forces[stresses + 3] -= neigh->dist.x * tmp_force.y;
-		  forces[stresses + 4] -= neigh->dist.y * tmp_force.z;
-		  forces[stresses + 5] -= neigh->dist.z * tmp_force.x;
+		  forces[stresses + 0] -= dist_r->x * r * tmp_force.x;
+		  forces[stresses + 1] -= dist_r->y * r * tmp_force.y;
+		  forces[stresses + 2] -= dist_r->z * r * tmp_force.z;
+		  forces[stresses + 3] -= dist_r->x * r * tmp_force.y;
+		  forces[stresses + 4] -= dist_r->y * r * tmp_force.z;
+		  forces[stresses + 5] -= dist_r->z * r * tmp_force.x;
 		}
 #endif /* STRESS */
 	      }			/* within reach */
@@ -467,6 +570,7 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
 		(dsquare(forces[n_i + 0]) + dsquare(forces[n_i + 1]) + dsquare(forces[n_i + 2]));
 	  }			/* third loop over atoms */
 	}
+	t_phase = prof_stop(PROF_MANY, t_phase);
 
 	/* use forces */
 	/* energy contributions */
@@ -486,12 +590,48 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
 #endif /* STRESS */
 	/* limiting constraints per configuration */
 	tmpsum += conf_weight[h] * dsquare(forces[limit_p + h]);
+	prof_stop(PROF_SUM, t_phase);
+#ifdef MPI
+	conf_time[h - firstconf] += wall_time() - t_conf;
+#endif /* MPI */
       }				/* loop over configurations */
+
+#if !defined NORESCALE && !defined APOT
+      if (5 == flag) {
+#ifdef _OPENMP
+#pragma omp critical
+#endif /* _OPENMP */
+	for (i = 0; i < ntypes; i++) {
+	  rho_min[i] = MIN(rho_min[i], rho_lo[i]);
+	  rho_max[i] = MAX(rho_max[i], rho_hi[i]);
+	}
+      }
+#endif /* !NORESCALE && !APOT */
     }				/* parallel region */
+
+    t_prof = prof_start();
+
+#if !defined NORESCALE && !defined APOT
+    /* flag 5: combine the density ranges of all processes, no forces needed */
+    if (5 == flag) {
 #ifdef MPI
-    /* Reduce rho_sum */
-    rho_sum = 0.0;
-    MPI_Reduce(&rho_sum_loc, &rho_sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+      MPI_Allreduce(MPI_IN_PLACE, rho_min, ntypes, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+      MPI_Allreduce(MPI_IN_PLACE, rho_max, ntypes, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+      prof_stop(PROF_MPI, t_prof);
+#endif /* MPI */
+      if (0 == myid)
+	return 0.0;
+      continue;
+    }
+#endif /* !NORESCALE && !APOT */
+#ifdef MPI
+    /* Reduce rho_sum, a single column of the jacobian only needs the local part */
+    if (local_forces)
+      rho_sum = rho_sum_loc;
+    else {
+      rho_sum = 0.0;
+      MPI_Reduce(&rho_sum_loc, &rho_sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    }
 #else /* MPI */
     rho_sum = rho_sum_loc;
 #endif /* MPI */
@@ -559,7 +699,13 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
     }				/* only root process */
 #endif /* !NOPUNISH */
 
+    t_prof = prof_stop(PROF_SUM, t_prof);
+
 #ifdef MPI
+    /* a single column of the jacobian only needs the local part */
+    if (local_forces)
+      return tmpsum;
+
     /* reduce global sum */
     sum = 0.0;
     MPI_Reduce(&tmpsum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
@@ -571,9 +717,11 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, forces + natoms * 3,
 	conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_STENS, forces + natoms * 3 + nconf,
 	conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
       /* punishment constraints */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, forces + natoms * 3 + 7 * nconf,
 	conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
@@ -584,14 +732,17 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(forces + natoms * 3 + firstconf, myconf, MPI_DOUBLE,
 	forces + natoms * 3, conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(forces + natoms * 3 + nconf + 6 * firstconf, myconf, MPI_STENS,
 	forces + natoms * 3 + nconf, conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
       /* punishment constraints */
       MPI_Gatherv(forces + natoms * 3 + 7 * nconf + firstconf, myconf, MPI_DOUBLE,
 	forces + natoms * 3 + 7 * nconf, conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
     }
     /* no need to pick up dummy constraints - are already @ root */
+    prof_stop(PROF_MPI, t_prof);
 #else
     sum = tmpsum;		/* global sum = local sum  */
 #endif /* MPI */
@@ -599,6 +750,7 @@ double calc_forces_eam(double *xi_opt, double *forces, int flag)
     /* root process exits this function now */
     if (0 == myid) {
       fcalls++;			/* Increase function call counter */
+      prof_force();
       if (isnan(sum)) {
 #ifdef DEBUG
 	printf("\n--> Force is nan! <--\n\n");
@@ -33,8 +33,10 @@
 
 #include "potfit.h"
 
+#include "ewald.h"
 #include "functions.h"
 #include "potential.h"
+#include "profile.h"
 #include "splines.h"
 #include "utils.h"
 
@@ -90,6 +92,7 @@
 double calc_forces_elstat(double *xi_opt, double *forces, int flag)
 {
   double tmpsum, sum = 0.;
+  double t_prof;		/* start of the current phase of the profile */
   int   first, col, ne, size, i;
   double *xi = NULL;
   apot_table_t *apt = &apot_table;
@@ -120,6 +123,7 @@ double calc_forces_elstat(double *xi_opt, double *forces, int flag)
 
   /* This is the start of an infinite loop */
   while (1) {
+    t_prof = prof_start();
     tmpsum = 0.;		/* sum of squares of local process */
 
 #if defined APOT && !defined MPI
@@ -130,26 +134,56 @@ double calc_forces_elstat(double *xi_opt, double *forces, int flag)
 #endif /* APOT && !MPI */
 
 #ifdef MPI
-    /* exchange potential and flag value */
+    if (local_forces) {
+      /* a single column of the jacobian, no communication */
+#ifdef APOT
+      /* every process corrects its own copy of the parameters */
+      apot_check_params(xi_opt);
+      if (format == 0)
+	update_calc_table(xi_opt, xi, 0);
+#endif /* APOT */
+    } else {
+      /* exchange potential and flag value */
 #ifndef APOT
-    MPI_Bcast(xi, calc_pot.len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      MPI_Bcast(xi, calc_pot.len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 #endif /* APOT */
-    MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      t_prof = prof_stop(PROF_MPI, t_prof);
 
-    if (flag == 1)
-      break;			/* Exception: flag 1 means clean up */
+      if (flag == 1)
+	break;			/* Exception: flag 1 means clean up */
 
 #ifdef APOT
-    if (myid == 0)
-      apot_check_params(xi_opt);
-    MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    if (format == 0)
-      update_calc_table(xi_opt, xi, 0);
+      if (myid == 0)
+	apot_check_params(xi_opt);
+      MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      if (format == 0)
+	update_calc_table(xi_opt, xi, 0);
 #else /* APOT */
-    /* if flag==2 then the potential parameters have changed -> sync */
-    if (flag == 2)
-      potsync();
+      /* if flag==2 then the potential parameters have changed -> sync */
+      if (flag == 2)
+	potsync();
 #endif /* APOT */
+
+      /* flag 3: all processes evaluate the columns of the jacobian */
+      if (flag == 3) {
+	gamma_columns(xi_opt);
+	if (myid == 0)
+	  return 0.0;
+	continue;
+      }
+
+      /* flag 4: all processes evaluate a batch of parameter vectors */
+      if (flag == 4) {
+	batch_forces();
+	if (myid == 0)
+	  return 0.0;
+	continue;
+      }
+
+      /* move configurations to other processes if the load is unbalanced */
+      balance_configs();
+    }
 #endif /* MPI */
 
     /* local arrays for electrostatic parameters */
@@ -195,25 +229,29 @@ double calc_forces_elstat(double *xi_opt, double *forces, int flag)
     /* init second derivatives for splines */
     for (col = 0; col < paircol; col++) {
       first = calc_pot.first[col];
-      if (format == 3 || format == 0) {
-	spline_ed(calc_pot.step[col], xi + first,
-	  calc_pot.last[col] - first + 1, *(xi + first - 2), 0.0, calc_pot.d2tab + first);
-      } else {			/* format >= 4 ! */
-	spline_ne(calc_pot.xcoord + first, xi + first,
-	  calc_pot.last[col] - first + 1, *(xi + first - 2), 0.0, calc_pot.d2tab + first);
-      }
+      spline_col(&calc_pot, xi, col, *(xi + first - 2), 0.0);
     }
 
 #ifndef MPI
     myconf = nconf;
 #endif /* MPI */
 
+    /* the tails in the neighbor tables only change with kappa */
+    if (dp_kappa != tail_kappa)
+      init_tails(dp_kappa);
+
+    t_prof = prof_stop(PROF_SETUP, t_prof);
+
     /* region containing loop over configurations,
        also OMP-parallelized region */
     {
       int   self;
       vector tmp_force;
       int   h, j, type1, type2, uf, us, stresses;
+#ifdef MPI
+      double t_conf;		/* start time of the current configuration */
+#endif /* MPI */
+      double t_phase;		/* start of the current phase of the profile */
       int   n_i, n_j;
       double fnval, grad, fnval_tail, grad_tail, grad_i, grad_j;
 #ifdef DIPOLE
@@ -224,6 +262,10 @@ double calc_forces_elstat(double *xi_opt, double *forces, int flag)
 
       /* loop over configurations: M A I N LOOP CONTAINING ALL ATOM-LOOPS */
       for (h = firstconf; h < firstconf + myconf; h++) {
+#ifdef MPI
+	t_conf = wall_time();
+#endif /* MPI */
+	t_phase = prof_start();
 	uf = conf_uf[h - firstconf];
 #ifdef STRESS
 	us = conf_us[h - firstconf];
@@ -274,10 +316,6 @@ double calc_forces_elstat(double *xi_opt, double *forces, int flag)
 	    type2 = neigh->type;
 	    col = neigh->col[0];
 
-	    /* updating tail-functions - only necessary with variing kappa */
-	    if (!apt->sw_kappa)
-	      elstat_shift(neigh->r, dp_kappa, &neigh->fnval_el, &neigh->grad_el, &neigh->ggrad_el);
-
 	    /* In small cells, an atom might interact with itself */
 	    self = (neigh->nr == i + cnfstart[h]) ? 1 : 0;
 
@@ -405,115 +443,12 @@ double calc_forces_elstat(double *xi_opt, double *forces, int flag)
 
 	  }			/* loop over neighbours */
 	}			/* end S E C O N D loop over atoms */
+	t_phase = prof_stop(PROF_PAIR, t_phase);
 
 #ifdef DIPOLE
 	/* T H I R D loop: calculate whole dipole moment for every atom */
-	double rp, dp_sum;
-	int   dp_converged = 0, dp_it = 0;
-	double max_diff = 10;
-
-	while (dp_converged == 0) {
-	  dp_sum = 0;
-	  for (i = 0; i < inconf[h]; i++) {	/* atoms */
-	    atom = conf_atoms + i + cnfstart[h] - firstatom;
-	    type1 = atom->type;
-	    if (dp_alpha[type1]) {
-
-	      if (dp_it) {
-		/* note: mixing parameter is different from that on in IMD */
-		atom->E_tot.x = (1 - dp_mix) * atom->E_ind.x + dp_mix * atom->E_old.x + atom->E_stat.x;
-		atom->E_tot.y = (1 - dp_mix) * atom->E_ind.y + dp_mix * atom->E_old.y + atom->E_stat.y;
-		atom->E_tot.z = (1 - dp_mix) * atom->E_ind.z + dp_mix * atom->E_old.z + atom->E_stat.z;
-	      } else {
-		atom->E_tot.x = atom->E_ind.x + atom->E_stat.x;
-		atom->E_tot.y = atom->E_ind.y + atom->E_stat.y;
-		atom->E_tot.z = atom->E_ind.z + atom->E_stat.z;
-	      }
-
-	      atom->p_ind.x = dp_alpha[type1] * atom->E_tot.x + atom->p_sr.x;
-	      atom->p_ind.y = dp_alpha[type1] * atom->E_tot.y + atom->p_sr.y;
-	      atom->p_ind.z = dp_alpha[type1] * atom->E_tot.z + atom->p_sr.z;
-
-	      atom->E_old.x = atom->E_ind.x;
-	      atom->E_old.y = atom->E_ind.y;
-	      atom->E_old.z = atom->E_ind.z;
-
-	      atom->E_ind.x = 0.;
-	      atom->E_ind.y = 0.;
-	      atom->E_ind.z = 0.;
-	    }
-	  }
-
-	  for (i = 0; i < inconf[h]; i++) {	/* atoms */
-	    atom = conf_atoms + i + cnfstart[h] - firstatom;
-	    type1 = atom->type;
-	    for (j = 0; j < atom->num_neigh; j++) {	/* neighbors */
-	      neigh = atom->neigh + j;
-	      type2 = neigh->type;
-	      col = neigh->col[0];
-	      /* In small cells, an atom might interact with itself */
-	      self = (neigh->nr == i + cnfstart[h]) ? 1 : 0;
-
-	      if (neigh->r < dp_cut && dp_alpha[type1] && dp_alpha[type2]) {
-
-		rp = SPROD(conf_atoms[neigh->nr - firstatom].p_ind, neigh->dist_r);
-		atom->E_ind.x +=
-		  neigh->grad_el * (3 * rp * neigh->dist_r.x - conf_atoms[neigh->nr - firstatom].p_ind.x);
-		atom->E_ind.y +=
-		  neigh->grad_el * (3 * rp * neigh->dist_r.y - conf_atoms[neigh->nr - firstatom].p_ind.y);
-		atom->E_ind.z +=
-		  neigh->grad_el * (3 * rp * neigh->dist_r.z - conf_atoms[neigh->nr - firstatom].p_ind.z);
-
-		if (!self) {
-		  rp = SPROD(atom->p_ind, neigh->dist_r);
-		  conf_atoms[neigh->nr - firstatom].E_ind.x +=
-		    neigh->grad_el * (3 * rp * neigh->dist_r.x - atom->p_ind.x);
-		  conf_atoms[neigh->nr - firstatom].E_ind.y +=
-		    neigh->grad_el * (3 * rp * neigh->dist_r.y - atom->p_ind.y);
-		  conf_atoms[neigh->nr - firstatom].E_ind.z +=
-		    neigh->grad_el * (3 * rp * neigh->dist_r.z - atom->p_ind.z);
-		}
-	      }
-	    }
-	  }
-
-	  for (i = 0; i < inconf[h]; i++) {	/* atoms */
-	    atom = conf_atoms + i + cnfstart[h] - firstatom;
-	    type1 = atom->type;
-	    if (dp_alpha[type1]) {
-	      dp_sum += dsquare(dp_alpha[type1] * (atom->E_old.x - atom->E_ind.x));
-	      dp_sum += dsquare(dp_alpha[type1] * (atom->E_old.y - atom->E_ind.y));
-	      dp_sum += dsquare(dp_alpha[type1] * (atom->E_old.z - atom->E_ind.z));
-	    }
-	  }
-
-	  dp_sum /= 3 * inconf[h];
-	  dp_sum = sqrt(dp_sum);
-
-	  if (dp_it) {
-	    if ((dp_sum > max_diff) || (dp_it > 50)) {
-	      dp_converged = 1;
-	      for (i = 0; i < inconf[h]; i++) {	/* atoms */
-		atom = conf_atoms + i + cnfstart[h] - firstatom;
-		type1 = atom->type;
-		if (dp_alpha[type1]) {
-		  atom->p_ind.x = dp_alpha[type1] * atom->E_stat.x + atom->p_sr.x;
-		  atom->p_ind.y = dp_alpha[type1] * atom->E_stat.y + atom->p_sr.y;
-		  atom->p_ind.z = dp_alpha[type1] * atom->E_stat.z + atom->p_sr.z;
-		  atom->E_ind.x = atom->E_stat.x;
-		  atom->E_ind.y = atom->E_stat.y;
-		  atom->E_ind.z = atom->E_stat.z;
-		}
-	      }
-	    }
-	  }
-
-	  if (dp_sum < dp_tol) {
-	    dp_converged = 1;
-	  }
-
-	  dp_it++;
-	}			/* end T H I R D loop over atoms */
+	dp_iter_sum[h] += dipole_iteration(h, dp_alpha);
+	dp_iter_calls[h]++;
 
 
 	/* F O U R T H  loop: calculate monopole-dipole and dipole-dipole forces */
@@ -687,8 +622,19 @@ double calc_forces_elstat(double *xi_opt, double *forces, int flag)
 	    }
 	  }			/* loop over neighbours */
 	}			/* end F O U R T H loop over atoms */
+	t_phase = prof_stop(PROF_DIPOLE, t_phase);
 #endif /* DIPOLE */
 
+	/* reciprocal space part of the Ewald sum */
+	if (ewald) {
+	  double *rec_stress = NULL;
+#ifdef STRESS
+	  if (uf && us)
+	    rec_stress = forces + stresses;
+#endif /* STRESS */
+	  forces[energy_p + h] += ewald_recip(h, charge, dp_kappa, forces, uf, rec_stress);
+	  t_phase = prof_stop(PROF_EWALD, t_phase);
+	}
 
 	/* F I F T H  loop: self energy contributions and sum-up force contributions */
 	double qq;
@@ -754,9 +700,15 @@ double calc_forces_elstat(double *xi_opt, double *forces, int flag)
 	  }
 	}
 #endif /* STRESS */
+	prof_stop(PROF_SUM, t_phase);
+#ifdef MPI
+	conf_time[h - firstconf] += wall_time() - t_conf;
+#endif /* MPI */
       }				/* end M A I N loop over configurations */
     }				/* parallel region */
 
+    t_prof = prof_start();
+
     /* dummy constraints (global) */
 #ifdef APOT
     /* add punishment for out of bounds (mostly for powell_lsq) */
@@ -767,7 +719,13 @@ double calc_forces_elstat(double *xi_opt, double *forces, int flag)
 
     sum = tmpsum;		/* global sum = local sum  */
 
+    t_prof = prof_stop(PROF_SUM, t_prof);
+
 #ifdef MPI
+    /* a single column of the jacobian only needs the local part */
+    if (local_forces)
+      return tmpsum;
+
     /* reduce global sum */
     sum = 0.;
     MPI_Reduce(&tmpsum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
@@ -779,9 +737,11 @@ double calc_forces_elstat(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, forces + natoms * 3,
 	conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_STENS, forces + natoms * 3 + nconf,
 	conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
     } else {
       /* forces */
       MPI_Gatherv(forces + firstatom * 3, myatoms, MPI_VECTOR, forces, atom_len,
@@ -789,15 +749,19 @@ double calc_forces_elstat(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(forces + natoms * 3 + firstconf, myconf, MPI_DOUBLE,
 	forces + natoms * 3, conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(forces + natoms * 3 + nconf + 6 * firstconf, myconf, MPI_STENS,
 	forces + natoms * 3 + nconf, conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
     }
+    prof_stop(PROF_MPI, t_prof);
 #endif /* MPI */
 
     /* root process exits this function now */
     if (myid == 0) {
       fcalls++;			/* Increase function call counter */
+      prof_force();
       if (isnan(sum)) {
 #ifdef DEBUG
 	printf("\n--> Force is nan! <--\n\n");
@@ -37,6 +37,7 @@
 
 #include "functions.h"
 #include "potential.h"
+#include "profile.h"
 #include "splines.h"
 #include "utils.h"
 
@@ -98,7 +99,8 @@
 
 double calc_forces_meam(double *xi_opt, double *forces, int flag)
 {
-  int   first, col, i;
+  int   first, col;
+  double t_prof;		/* start of the current phase of the profile */
   double *xi = NULL;
 
   /* Some useful temp variables */
@@ -119,6 +121,7 @@ double calc_forces_meam(double *xi_opt, double *forces, int flag)
 
   /* This is the start of an infinite loop */
   while (1) {
+    t_prof = prof_start();
 
     /* Reset tmpsum and rho_sum_loc
        tmpsum = Sum of all the forces, energies and constraints
@@ -134,25 +137,54 @@ double calc_forces_meam(double *xi_opt, double *forces, int flag)
 #endif /* APOT && !MPI */
 
 #ifdef MPI
-    /* exchange potential and flag value */
+    if (local_forces) {
+      /* a single column of the jacobian, no communication */
+#ifdef APOT
+      /* every process corrects its own copy of the parameters */
+      apot_check_params(xi_opt);
+      update_calc_table(xi_opt, xi, 0);
+#endif /* APOT */
+    } else {
+      /* exchange potential and flag value */
 #ifndef APOT
-    MPI_Bcast(xi, calc_pot.len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      MPI_Bcast(xi, calc_pot.len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 #endif /* APOT */
-    MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      t_prof = prof_stop(PROF_MPI, t_prof);
 
-    if (1 == flag)
-      break;			/* Exception: flag 1 means clean up */
+      if (1 == flag)
+	break;			/* Exception: flag 1 means clean up */
 
 #ifdef APOT
-    if (0 == myid)
-      apot_check_params(xi_opt);
-    MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    update_calc_table(xi_opt, xi, 0);
+      if (0 == myid)
+	apot_check_params(xi_opt);
+      MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      update_calc_table(xi_opt, xi, 0);
 #else
-    /* if flag==2 then the potential parameters have changed -> sync */
-    if (2 == flag)
-      potsync();
+      /* if flag==2 then the potential parameters have changed -> sync */
+      if (2 == flag)
+	potsync();
 #endif /* APOT */
+
+      /* flag 3: all processes evaluate the columns of the jacobian */
+      if (3 == flag) {
+	gamma_columns(xi_opt);
+	if (0 == myid)
+	  return 0.0;
+	continue;
+      }
+
+      /* flag 4: all processes evaluate a batch of parameter vectors */
+      if (4 == flag) {
+	batch_forces();
+	if (0 == myid)
+	  return 0.0;
+	continue;
+      }
+
+      /* move configurations to other processes if the load is unbalanced */
+      balance_configs();
+    }
 #endif /* MPI */
 
     /* First step is to initialize 2nd derivatives for splines */
@@ -181,11 +213,21 @@ double calc_forces_meam(double *xi_opt, double *forces, int flag)
     myconf = nconf;
 #endif /* MPI */
 
-    /* region containing loop over configurations */
+    t_prof = prof_stop(PROF_SETUP, t_prof);
+
+    /* region containing loop over configurations,
+       configurations are distributed among the threads of each process */
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:tmpsum,rho_sum_loc)
+#endif /* _OPENMP */
     {
       /* Temp variables */
       atom_t *atom;		/* atom pointer */
-      int   h, j, k;
+      int   h, i, j, k;
+#ifdef MPI
+      double t_conf;		/* start time of the current configuration */
+#endif /* MPI */
+      double t_phase;		/* start of the current phase of the profile */
       int   n_i, n_j, n_k;
       int   uf;
 #ifdef APOT
@@ -216,7 +258,14 @@ double calc_forces_meam(double *xi_opt, double *forces, int flag)
       angl *n_angl;
 
       /* Loop over configurations */
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif /* _OPENMP */
       for (h = firstconf; h < firstconf + myconf; h++) {
+#ifdef MPI
+	t_conf = wall_time();
+#endif /* MPI */
+	t_phase = prof_start();
 	uf = conf_uf[h - firstconf];
 #ifdef STRESS
 	us = conf_us[h - firstconf];
@@ -605,6 +654,7 @@ double calc_forces_meam(double *xi_opt, double *forces, int flag)
 	    }			/* End outer loop over angles (neighbor atom j) */
 	  }			/* uf */
 	}			/* END OF SECOND LOOP OVER ATOM i */
+	t_phase = prof_stop(PROF_MANY, t_phase);
 
 	/* 3RD LOOP OVER ATOM i */
 	/* Sum up the square of the forces for each atom
@@ -656,12 +706,21 @@ double calc_forces_meam(double *xi_opt, double *forces, int flag)
 	forces[limit_p + h] *= conf_weight[h];
 	tmpsum += dsquare(forces[limit_p + h]);
 #endif /* !NORESCALE */
+	prof_stop(PROF_SUM, t_phase);
+#ifdef MPI
+	conf_time[h - firstconf] += wall_time() - t_conf;
+#endif /* MPI */
       }				/* END MAIN LOOP OVER CONFIGURATIONS */
     }
 
+    t_prof = prof_start();
+
 #ifdef MPI
-    /* Reduce the rho_sum into root node */
-    MPI_Reduce(&rho_sum_loc, &rho_sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    /* Reduce rho_sum, a single column of the jacobian only needs the local part */
+    if (local_forces)
+      rho_sum = rho_sum_loc;
+    else
+      MPI_Reduce(&rho_sum_loc, &rho_sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
 #else
     rho_sum = rho_sum_loc;
 #endif // MPI
@@ -681,7 +740,13 @@ double calc_forces_meam(double *xi_opt, double *forces, int flag)
     }
 #endif /* NORESCALE */
 
+    t_prof = prof_stop(PROF_SUM, t_prof);
+
 #ifdef MPI
+    /* a single column of the jacobian only needs the local part */
+    if (local_forces)
+      return tmpsum;
+
     /* Reduce the global sum from all the tmpsum's */
     sum = 0.0;
     MPI_Reduce(&tmpsum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
@@ -693,9 +758,11 @@ double calc_forces_meam(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, forces + natoms * 3,
 	conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_STENS, forces + natoms * 3 + nconf,
 	conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
       /* punishment constraints */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, forces + natoms * 3 + 7 * nconf,
 	conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
@@ -706,14 +773,17 @@ double calc_forces_meam(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(forces + natoms * 3 + firstconf, myconf, MPI_DOUBLE,
 	forces + natoms * 3, conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(forces + natoms * 3 + nconf + 6 * firstconf, myconf, MPI_STENS,
 	forces + natoms * 3 + nconf, conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
       /* punishment constraints */
       MPI_Gatherv(forces + natoms * 3 + 7 * nconf + firstconf, myconf, MPI_DOUBLE,
 	forces + natoms * 3 + 7 * nconf, conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
     }
     /* no need to pick up dummy constraints - are already @ root */
+    prof_stop(PROF_MPI, t_prof);
 #else
     /* Set tmpsum to sum - only matters when not running MPI */
     sum = tmpsum;
@@ -723,6 +793,7 @@ double calc_forces_meam(double *xi_opt, double *forces, int flag)
     if (myid == 0) {
       /* Increment function calls */
       fcalls++;
+      prof_force();
       /* If total sum is NAN return large number instead */
       if (isnan(sum)) {
 #ifdef DEBUG
@@ -34,9 +34,16 @@
 
 #include "functions.h"
 #include "potential.h"
+#include "profile.h"
 #include "splines.h"
 #include "utils.h"
 
+/* spline values of a neighbor block, allocated once by each thread */
+static double *spline_buf = NULL;
+#ifdef _OPENMP
+#pragma omp threadprivate(spline_buf)
+#endif /* _OPENMP */
+
 /****************************************************************
  *
  *  compute forces using pair potentials with spline interpolation
@@ -88,7 +95,8 @@
 
 double calc_forces_pair(double *xi_opt, double *forces, int flag)
 {
-  int   first, col, i;
+  int   first, col;
+  double t_prof;		/* start of the current phase of the profile */
   double *xi = NULL;
 
   /* Some useful temp variables */
@@ -108,6 +116,7 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
 
   /* This is the start of an infinite loop */
   while (1) {
+    t_prof = prof_start();
     tmpsum = 0.0;		/* sum of squares of local process */
 
 #if defined APOT && !defined MPI
@@ -118,25 +127,54 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
 #endif /* APOT && !MPI */
 
 #ifdef MPI
+    if (local_forces) {
+      /* a single column of the jacobian, no communication */
+#ifdef APOT
+      /* every process corrects its own copy of the parameters */
+      apot_check_params(xi_opt);
+      update_calc_table(xi_opt, xi, 0);
+#endif /* APOT */
+    } else {
 #ifndef APOT
-    /* exchange potential and flag value */
-    MPI_Bcast(xi, calc_pot.len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      /* exchange potential and flag value */
+      MPI_Bcast(xi, calc_pot.len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 #endif /* APOT */
-    MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      t_prof = prof_stop(PROF_MPI, t_prof);
 
-    if (1 == flag)
-      break;			/* Exception: flag 1 means clean up */
+      if (1 == flag)
+	break;			/* Exception: flag 1 means clean up */
 
 #ifdef APOT
-    if (0 == myid)
-      apot_check_params(xi_opt);
-    MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    update_calc_table(xi_opt, xi, 0);
+      if (0 == myid)
+	apot_check_params(xi_opt);
+      MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      update_calc_table(xi_opt, xi, 0);
 #else /* APOT */
-    /* if flag==2 then the potential parameters have changed -> sync */
-    if (2 == flag)
-      potsync();
+      /* if flag==2 then the potential parameters have changed -> sync */
+      if (2 == flag)
+	potsync();
 #endif /* APOT */
+
+      /* flag 3: all processes evaluate the columns of the jacobian */
+      if (3 == flag) {
+	gamma_columns(xi_opt);
+	if (0 == myid)
+	  return 0.0;
+	continue;
+      }
+
+      /* flag 4: all processes evaluate a batch of parameter vectors */
+      if (4 == flag) {
+	batch_forces();
+	if (0 == myid)
+	  return 0.0;
+	continue;
+      }
+
+      /* move configurations to other processes if the load is unbalanced */
+      balance_configs();
+    }
 #endif /* MPI */
 
     /* init second derivatives for splines */
@@ -144,22 +182,27 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
     /* pair potentials */
     for (col = 0; col < paircol; col++) {
       first = calc_pot.first[col];
-      if (0 == format || 3 == format)
-	spline_ed(calc_pot.step[col], xi + first,
-	  calc_pot.last[col] - first + 1, *(xi + first - 2), 0.0, calc_pot.d2tab + first);
-      else			/* format >= 4 ! */
-	spline_ne(calc_pot.xcoord + first, xi + first,
-	  calc_pot.last[col] - first + 1, *(xi + first - 2), 0.0, calc_pot.d2tab + first);
+      spline_col(&calc_pot, xi, col, *(xi + first - 2), 0.0);
     }
 
 #ifndef MPI
     myconf = nconf;
 #endif /* MPI */
 
-    /* region containing loop over configurations */
+    t_prof = prof_stop(PROF_SETUP, t_prof);
+
+    /* region containing loop over configurations,
+       configurations are distributed among the threads of each process */
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:tmpsum)
+#endif /* _OPENMP */
     {
       atom_t *atom;
-      int   h, j;
+      int   h, i, k;
+#ifdef MPI
+      double t_conf;		/* start time of the current configuration */
+#endif /* MPI */
+      double t_phase;		/* start of the current phase of the profile */
       int   n_i, n_j;
       int   self;
       int   uf;
@@ -167,15 +210,38 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
       int   us, stresses;
 #endif /* STRESS */
 
-      /* pointer for neighbor table */
-      neigh_t *neigh;
+      /* packed neighbor table */
+      const neigh_table_t *nt = &neigh_tab;
+      int   nr, k0;
+      double r;
+      vector *dist_r;
 
       /* pair variables */
       double phi_val, phi_grad;
+      double *phi_v, *phi_g;	/* values and gradients of a neighbor block */
       vector tmp_force;
 
+      if (NULL == spline_buf) {
+	spline_buf = (double *)malloc(2 * MAX(maxneigh, 1) * sizeof(double));
+	if (NULL == spline_buf)
+	  error(1, "Cannot allocate memory for the spline values");
+#ifdef _OPENMP
+#pragma omp critical
+#endif /* _OPENMP */
+	reg_for_free(spline_buf, "spline_buf");
+      }
+      phi_v = spline_buf;
+      phi_g = phi_v + MAX(maxneigh, 1);
+
       /* loop over configurations */
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif /* _OPENMP */
       for (h = firstconf; h < firstconf + myconf; h++) {
+#ifdef MPI
+	t_conf = wall_time();
+#endif /* MPI */
+	t_phase = prof_start();
 	uf = conf_uf[h - firstconf];
 #ifdef STRESS
 	us = conf_us[h - firstconf];
@@ -213,20 +279,22 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
 	for (i = 0; i < inconf[h]; i++) {
 	  atom = conf_atoms + i + cnfstart[h] - firstatom;
 	  n_i = 3 * (cnfstart[h] + i);
+	  /* pair potential of all neighbors at once */
+	  k0 = nt->start[i + cnfstart[h] - firstatom];
+	  splint_comb_vec(&calc_pot, nt->start[i + cnfstart[h] - firstatom + 1] - k0, nt->slot[0] + k0,
+	    nt->shift[0] + k0, nt->step[0] + k0, phi_v, phi_g);
 	  /* loop over neighbors */
-	  for (j = 0; j < atom->num_neigh; j++) {
-	    neigh = atom->neigh + j;
+	  for (k = k0; k < nt->start[i + cnfstart[h] - firstatom + 1]; k++) {
+	    nr = nt->nr[k];
+	    r = nt->r[k];
+	    dist_r = nt->dist_r + k;
 	    /* In small cells, an atom might interact with itself */
-	    self = (neigh->nr == i + cnfstart[h]) ? 1 : 0;
+	    self = (nr == i + cnfstart[h]) ? 1 : 0;
 
 	    /* pair potential part */
-	    if (neigh->r < calc_pot.end[neigh->col[0]]) {
-	      /* fn value and grad are calculated in the same step */
-	      if (uf)
-		phi_val =
-		  splint_comb_dir(&calc_pot, xi, neigh->slot[0], neigh->shift[0], neigh->step[0], &phi_grad);
-	      else
-		phi_val = splint_dir(&calc_pot, xi, neigh->slot[0], neigh->shift[0], neigh->step[0]);
+	    if (r < calc_pot.end[nt->col[0][k]]) {
+	      phi_val = phi_v[k - k0];
+	      phi_grad = phi_g[k - k0];
 
 	      /* avoid double counting if atom is interacting with a copy of itself */
 	      if (self) {
@@ -239,26 +307,26 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
 
 	      /* calculate forces */
 	      if (uf) {
-		tmp_force.x = neigh->dist_r.x * phi_grad;
-		tmp_force.y = neigh->dist_r.y * phi_grad;
-		tmp_force.z = neigh->dist_r.z * phi_grad;
+		tmp_force.x = dist_r->x * phi_grad;
+		tmp_force.y = dist_r->y * phi_grad;
+		tmp_force.z = dist_r->z * phi_grad;
 		forces[n_i + 0] += tmp_force.x;
 		forces[n_i + 1] += tmp_force.y;
 		forces[n_i + 2] += tmp_force.z;
 		/* actio = reactio */
-		n_j = 3 * neigh->nr;
+		n_j = 3 * nr;
 		forces[n_j + 0] -= tmp_force.x;
 		forces[n_j + 1] -= tmp_force.y;
 		forces[n_j + 2] -= tmp_force.z;
 #ifdef STRESS
 		/* also calculate pair stresses */
 		if (us) {
-		  forces[stresses + 0] -= neigh->dist.x * tmp_force.x;
-		  forces[stresses + 1] -= neigh->dist.y * tmp_force.y;
-		  forces[stresses + 2] -= neigh->dist.z * tmp_force.z;
-		  forces[stresses + 3] -= neigh->dist.x * tmp_force.y;
-		  forces[stresses + 4] -= neigh->dist.y * tmp_force.z;
-		  forces[stresses + 5] -= neigh->dist.z * tmp_force.x;
+		  forces[stresses + 0] -= dist_r->x * r * tmp_force.x;
+		  forces[stresses + 1] -= dist_r->y * r * tmp_force.y;
+		  forces[stresses + 2] -= dist_r->z * r * tmp_force.z;
+		  forces[stresses + 3] -= dist_r->x * r * tmp_force.y;
+		  forces[stresses + 4] -= dist_r->y * r * tmp_force.z;
+		  forces[stresses + 5] -= dist_r->z * r * tmp_force.x;
 		}
 #endif /* STRESS */
 	      }
@@ -282,6 +350,7 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
 		(dsquare(forces[n_i + 0]) + dsquare(forces[n_i + 1]) + dsquare(forces[n_i + 2]));
 	  }
 	}			/* second loop over atoms */
+	t_phase = prof_stop(PROF_PAIR, t_phase);
 
 	/* energy contributions */
 	forces[energy_p + h] /= (double)inconf[h];
@@ -299,9 +368,15 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
 	}
 #endif /* STRESS */
 
+	prof_stop(PROF_SUM, t_phase);
+#ifdef MPI
+	conf_time[h - firstconf] += wall_time() - t_conf;
+#endif /* MPI */
       }				/* loop over configurations */
     }				/* parallel region */
 
+    t_prof = prof_start();
+
     /* dummy constraints (global) */
 #ifdef APOT
     /* add punishment for out of bounds (mostly for powell_lsq) */
@@ -310,7 +385,13 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
     }
 #endif /* APOT */
 
+    t_prof = prof_stop(PROF_SUM, t_prof);
+
 #ifdef MPI
+    /* a single column of the jacobian only needs the local part */
+    if (local_forces)
+      return tmpsum;
+
     /* reduce global sum */
     sum = 0.0;
     MPI_Reduce(&tmpsum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
@@ -322,9 +403,11 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, forces + natoms * 3,
 	conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_STENS, forces + natoms * 3 + nconf,
 	conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
     } else {
       /* forces */
       MPI_Gatherv(forces + firstatom * 3, myatoms, MPI_VECTOR, forces, atom_len,
@@ -332,10 +415,13 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(forces + natoms * 3 + firstconf, myconf, MPI_DOUBLE,
 	forces + natoms * 3, conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(forces + natoms * 3 + nconf + 6 * firstconf, myconf, MPI_STENS,
 	forces + natoms * 3 + nconf, conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
     }
+    prof_stop(PROF_MPI, t_prof);
 #else
     sum = tmpsum;		/* global sum = local sum  */
 #endif /* MPI */
@@ -343,6 +429,7 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
     /* root process exits this function now */
     if (0 == myid) {
       fcalls++;			/* Increase function call counter */
+      prof_force();
       if (isnan(sum)) {
 #ifdef DEBUG
 	printf("\n--> Force is nan! <--\n\n");
@@ -358,4 +445,277 @@ double calc_forces_pair(double *xi_opt, double *forces, int flag)
   return -1.0;
 }
 
+/* reverse index of the neighbor table: the neighbors interacting
+   via column col are found at [col_start[col], col_start[col + 1]) */
+static int *col_start = NULL;
+static int *col_neigh = NULL;	/* index into neigh_tab */
+static int *col_atom = NULL;	/* local atom of the neighbor */
+static int col_gen = 0;		/* generation of neigh_tab the index belongs to */
+
+/****************************************************************
+ *
+ *  init_col_index: build the reverse index from the columns
+ *     of the potential to the neighbors in range
+ *
+ ****************************************************************/
+
+static void init_col_index(void)
+{
+  int   i, k, col, nlocal;
+  int  *pos;
+  void *p[3];
+  const neigh_table_t *nt = &neigh_tab;
+
+#ifdef MPI
+  nlocal = myatoms;
+#else
+  nlocal = natoms;
+#endif /* MPI */
+
+  /* the neighbor table was packed again */
+  if (NULL != col_start) {
+    p[0] = col_start;
+    p[1] = col_neigh;
+    p[2] = col_atom;
+    free_registered(p, 3);
+  }
+  col_gen = nt->gen;
+
+  col_start = (int *)malloc((paircol + 1) * sizeof(int));
+  pos = (int *)malloc((paircol + 1) * sizeof(int));
+  if (NULL == col_start || NULL == pos)
+    error(1, "Cannot allocate memory for the reverse neighbor index");
+  reg_for_free(col_start, "col_start");
+
+  for (col = 0; col <= paircol; col++)
+    col_start[col] = 0;
+  for (k = 0; k < nt->len; k++)
+    if (nt->r[k] < calc_pot.end[nt->col[0][k]])
+      col_start[nt->col[0][k] + 1]++;
+  for (col = 0; col < paircol; col++)
+    col_start[col + 1] += col_start[col];
+
+  col_neigh = (int *)malloc((col_start[paircol] + 1) * sizeof(int));
+  col_atom = (int *)malloc((col_start[paircol] + 1) * sizeof(int));
+  if (NULL == col_neigh || NULL == col_atom)
+    error(1, "Cannot allocate memory for the reverse neighbor index");
+  reg_for_free(col_neigh, "col_neigh");
+  reg_for_free(col_atom, "col_atom");
+
+  for (col = 0; col < paircol; col++)
+    pos[col] = col_start[col];
+  for (i = 0; i < nlocal; i++)
+    for (k = nt->start[i]; k < nt->start[i + 1]; k++)
+      if (nt->r[k] < calc_pot.end[nt->col[0][k]]) {
+	col = nt->col[0][k];
+	col_neigh[pos[col]] = k;
+	col_atom[pos[col]++] = i;
+      }
+
+  free(pos);
+
+  return;
+}
+
+/****************************************************************
+ *
+ *  dforces_col: force vector of the spline through the values dy
+ *     in column col of the potential table (with left gradient yp1),
+ *     i.e. the derivative of the force vector if dy are the
+ *     derivatives of the tabulated values
+ *
+ *  Only the entries of the local configurations are set.
+ *
+ ****************************************************************/
+
+static void dforces_col(int col, double *dy, double yp1, double *dforces)
+{
+  static double *d2 = NULL;
+  int   first, h, i, k, l;
+  int   n_i, n_j, nr;
+  int   uf;
+#ifdef STRESS
+  int   us, stresses;
+#endif /* STRESS */
+  double r, phi_val, phi_grad;
+  pot_table_t pt;
+  atom_t *atom;
+  vector *dist_r, tmp_force;
+  const neigh_table_t *nt = &neigh_tab;
+
+  if (NULL == col_start || col_gen != nt->gen)
+    init_col_index();
+  if (NULL == d2) {
+    d2 = (double *)malloc(calc_pot.len * sizeof(double));
+    if (NULL == d2)
+      error(1, "Cannot allocate memory for the spline derivatives");
+    reg_for_free(d2, "d2");
+  }
+
+#ifndef MPI
+  myconf = nconf;
+#endif /* MPI */
+
+  /* reset the local entries */
+  for (h = firstconf; h < firstconf + myconf; h++) {
+    for (i = 3 * cnfstart[h]; i < 3 * (cnfstart[h] + inconf[h]); i++)
+      dforces[i] = 0.0;
+    dforces[energy_p + h] = 0.0;
+#ifdef STRESS
+    for (i = 0; i < 6; i++)
+      dforces[stress_p + 6 * h + i] = 0.0;
+#endif /* STRESS */
+  }
+
+  /* second derivatives of this column only */
+  first = calc_pot.first[col];
+  if (0 == format || 3 == format)
+    spline_ed(calc_pot.step[col], dy + first, calc_pot.last[col] - first + 1, yp1, 0.0, d2 + first);
+  else
+    spline_ne(calc_pot.xcoord + first, dy + first, calc_pot.last[col] - first + 1, yp1, 0.0, d2 + first);
+  pt = calc_pot;
+  pt.d2tab = d2;
+
+  for (l = col_start[col]; l < col_start[col + 1]; l++) {
+    k = col_neigh[l];
+    i = col_atom[l];
+    atom = conf_atoms + i;
+    h = atom->conf;
+    uf = conf_uf[h - firstconf];
+    n_i = 3 * (firstatom + i);
+    nr = nt->nr[k];
+    r = nt->r[k];
+    dist_r = nt->dist_r + k;
+
+    phi_val = splint_comb_dir(&pt, dy, nt->slot[0][k], nt->shift[0][k], nt->step[0][k], &phi_grad);
+
+    /* avoid double counting if atom is interacting with a copy of itself */
+    if (nr == firstatom + i) {
+      phi_val *= 0.5;
+      phi_grad *= 0.5;
+    }
+
+    dforces[energy_p + h] += phi_val;
+
+    if (uf) {
+      tmp_force.x = dist_r->x * phi_grad;
+      tmp_force.y = dist_r->y * phi_grad;
+      tmp_force.z = dist_r->z * phi_grad;
+      dforces[n_i + 0] += tmp_force.x;
+      dforces[n_i + 1] += tmp_force.y;
+      dforces[n_i + 2] += tmp_force.z;
+      /* actio = reactio */
+      n_j = 3 * nr;
+      dforces[n_j + 0] -= tmp_force.x;
+      dforces[n_j + 1] -= tmp_force.y;
+      dforces[n_j + 2] -= tmp_force.z;
+#ifdef STRESS
+      us = conf_us[h - firstconf];
+      stresses = stress_p + 6 * h;
+      if (us) {
+	dforces[stresses + 0] -= dist_r->x * r * tmp_force.x;
+	dforces[stresses + 1] -= dist_r->y * r * tmp_force.y;
+	dforces[stresses + 2] -= dist_r->z * r * tmp_force.z;
+	dforces[stresses + 3] -= dist_r->x * r * tmp_force.y;
+	dforces[stresses + 4] -= dist_r->y * r * tmp_force.z;
+	dforces[stresses + 5] -= dist_r->z * r * tmp_force.x;
+      }
+#endif /* STRESS */
+    }
+  }
+
+  /* same scaling as the force vector */
+  for (h = firstconf; h < firstconf + myconf; h++) {
+#ifdef FWEIGHT
+    if (conf_uf[h - firstconf])
+      for (i = cnfstart[h]; i < cnfstart[h] + inconf[h]; i++) {
+	atom = conf_atoms + i - firstatom;
+	dforces[3 * i + 0] /= FORCE_EPS + atom->absforce;
+	dforces[3 * i + 1] /= FORCE_EPS + atom->absforce;
+	dforces[3 * i + 2] /= FORCE_EPS + atom->absforce;
+      }
+#endif /* FWEIGHT */
+    dforces[energy_p + h] /= (double)inconf[h];
+#ifdef STRESS
+    if (conf_uf[h - firstconf] && conf_us[h - firstconf])
+      for (i = 0; i < 6; i++)
+	dforces[stress_p + 6 * h + i] /= conf_vol[h - firstconf];
+    else
+      for (i = 0; i < 6; i++)
+	dforces[stress_p + 6 * h + i] = 0.0;
+#endif /* STRESS */
+  }
+
+  return;
+}
+
+/****************************************************************
+ *
+ *  calc_dforces_pair: derivative of the force vector with respect
+ *     to the free parameter xi[n]
+ *
+ *  Pair forces, energies and stresses are linear in the tabulated
+ *  values, so the derivative is the force vector of the spline through
+ *  the derivatives of the tabulated values. These are the unit vector
+ *  e_n for tabulated potentials (formats 3 and 4) and the analytic
+ *  derivatives of the potential function for analytic potentials,
+ *  see apot_dtable(). Only the neighbors interacting via the column of
+ *  xi[n] contribute, they are taken from the reverse index.
+ *
+ *  h is the step for numerical derivatives of analytic functions.
+ *  Only the entries of the local configurations are set.
+ *
+ *  returns 0 if the derivative is not available
+ *
+ ****************************************************************/
+
+int calc_dforces_pair(double *xi, int n, double h, double *dforces)
+{
+  static double *dy = NULL;
+  int   i, col;
+  double yp1;
+
+  if (NULL == dy) {
+    dy = (double *)malloc(calc_pot.len * sizeof(double));
+    if (NULL == dy)
+      error(1, "Cannot allocate memory for the spline derivatives");
+    reg_for_free(dy, "dy");
+    for (i = 0; i < calc_pot.len; i++)
+      dy[i] = 0.0;
+  }
+
+#ifdef APOT
+  if (0 != format || -1 == (col = apot_dtable(xi, n, h, dy)))
+    return 0;
+  /* the calc table has a natural spline at the left end */
+  yp1 = calc_pot.table[calc_pot.first[col] - 2];
+  dforces_col(col, dy, yp1, dforces);
+#else
+  if (3 != format && 4 != format)
+    return 0;
+
+  /* find the column of xi[n], the two gradients are stored in front */
+  for (col = 0; col < paircol; col++)
+    if (n <= calc_pot.last[col])
+      break;
+  if (col == paircol || n == calc_pot.first[col] - 1) {
+    /* the gradient at the end is fixed to zero */
+    dforces_col(0, dy, 0.0, dforces);
+    return 1;
+  }
+
+  /* spline through the unit vector (or unit gradient) */
+  if (n == calc_pot.first[col] - 2) {
+    yp1 = 1.0;
+  } else {
+    dy[n] = 1.0;
+    yp1 = (xi[calc_pot.first[col] - 2] > 0.99e30) ? xi[calc_pot.first[col] - 2] : 0.0;
+  }
+  dforces_col(col, dy, yp1, dforces);
+  dy[n] = 0.0;
+#endif /* APOT */
+
+  return 1;
+}
+
 #endif /* PAIR */
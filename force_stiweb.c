@@ -33,11 +33,83 @@
 
 #include "potfit.h"
 
+#include "config.h"
 #include "functions.h"
 #include "potential.h"
+#include "profile.h"
 #include "splines.h"
 #include "utils.h"
 
+/* parameters of the last call, per column: p, q, delta, a1, gamma, a2 */
+static double *sw_last = NULL;
+static int *pair_new = NULL;	/* power[] and f_cut of the neighbors are outdated */
+static int *cut_new = NULL;	/* f and df of the neighbors are outdated */
+static double *sw_cut = NULL;	/* active and largest possible cutoff of each column */
+
+/****************************************************************
+ *
+ *  check_stiweb_params: compare the parameters that enter the
+ *	cached neighbor quantities with those of the last call and
+ *	prune the neighbor lists to the active cutoffs
+ *
+ ****************************************************************/
+
+static void check_stiweb_params(void)
+{
+  int   i;
+  double *last;
+  const sw_t *sw = &apot_table.sw;
+
+  if (NULL == sw_last) {
+    sw_last = (double *)malloc(6 * paircol * sizeof(double));
+    pair_new = (int *)malloc(paircol * sizeof(int));
+    cut_new = (int *)malloc(paircol * sizeof(int));
+    if (NULL == sw_last || NULL == pair_new || NULL == cut_new)
+      error(1, "Cannot allocate memory for the Stillinger-Weber cache");
+    reg_for_free(sw_last, "sw_last");
+    reg_for_free(pair_new, "pair_new");
+    reg_for_free(cut_new, "cut_new");
+    sw_cut = (double *)malloc(2 * paircol * sizeof(double));
+    if (NULL == sw_cut)
+      error(1, "Cannot allocate memory for the Stillinger-Weber cutoffs");
+    reg_for_free(sw_cut, "sw_cut");
+    for (i = 0; i < paircol; i++) {
+      pair_new[i] = 1;
+      cut_new[i] = 1;
+    }
+  } else {
+    for (i = 0; i < paircol; i++) {
+      last = sw_last + 6 * i;
+      pair_new[i] = (last[0] != *(sw->p[i]) || last[1] != *(sw->q[i])
+	|| last[2] != *(sw->delta[i]) || last[3] != *(sw->a1[i]));
+      cut_new[i] = (last[4] != *(sw->gamma[i]) || last[5] != *(sw->a2[i]));
+    }
+  }
+
+  for (i = 0; i < paircol; i++) {
+    last = sw_last + 6 * i;
+    last[0] = *(sw->p[i]);
+    last[1] = *(sw->q[i]);
+    last[2] = *(sw->delta[i]);
+    last[3] = *(sw->a1[i]);
+    last[4] = *(sw->gamma[i]);
+    last[5] = *(sw->a2[i]);
+  }
+
+  /* drop the neighbors outside of a1 and a2 */
+  for (i = 0; i < paircol; i++) {
+    sw_cut[i] = MAX(*(sw->a1[i]), *(sw->a2[i]));
+    sw_cut[paircol + i] = MAX(apot_table.end[i], apot_table.end[paircol + i]);
+  }
+  if (prune_neighbors(sw_cut, sw_cut + paircol))
+    for (i = 0; i < paircol; i++) {
+      pair_new[i] = 1;
+      cut_new[i] = 1;
+    }
+
+  return;
+}
+
 /****************************************************************
  *
  *  compute forces using Stillinger-Weber potentials with spline interpolation
@@ -89,18 +161,17 @@
 
 double calc_forces_stiweb(double *xi_opt, double *forces, int flag)
 {
-  int   col, i;
   double tmpsum = 0.0, sum = 0.0;
+  double t_prof;		/* start of the current phase of the profile */
   const sw_t *sw = &apot_table.sw;
 
 #ifndef MPI
   myconf = nconf;
-  /* access flag to shut up compiler warnings */
-  i = flag;
 #endif /* !MPI */
 
   /* This is the start of an infinite loop */
   while (1) {
+    t_prof = prof_start();
     tmpsum = 0.0;		/* sum of squares of local process */
 
 #ifndef MPI
@@ -108,22 +179,62 @@ double calc_forces_stiweb(double *xi_opt, double *forces, int flag)
 #endif /* !MPI */
 
 #ifdef MPI
-    MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (local_forces) {
+      /* a single column of the jacobian, no communication */
+      /* every process corrects its own copy of the parameters */
+      apot_check_params(xi_opt);
+    } else {
+      MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      t_prof = prof_stop(PROF_MPI, t_prof);
+
+      if (1 == flag)
+	break;			/* Exception: flag 1 means clean up */
+
+      if (0 == myid)
+	apot_check_params(xi_opt);
+      MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+      /* flag 3: all processes evaluate the columns of the jacobian */
+      if (3 == flag) {
+	gamma_columns(xi_opt);
+	if (0 == myid)
+	  return 0.0;
+	continue;
+      }
 
-    if (1 == flag)
-      break;			/* Exception: flag 1 means clean up */
+      /* flag 4: all processes evaluate a batch of parameter vectors */
+      if (4 == flag) {
+	batch_forces();
+	if (0 == myid)
+	  return 0.0;
+	continue;
+      }
 
-    if (0 == myid)
-      apot_check_params(xi_opt);
-    MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      /* move configurations to other processes if the load is unbalanced */
+      balance_configs();
+    }
 #endif /* MPI */
 
     update_stiweb_pointers(xi_opt);
 
-    /* region containing loop over configurations */
+    /* the neighbor distances are fixed, only the terms of changed
+       parameters need to be evaluated again */
+    check_stiweb_params();
+
+    t_prof = prof_stop(PROF_SETUP, t_prof);
+
+    /* region containing loop over configurations,
+       configurations are distributed among the threads of each process */
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:tmpsum)
+#endif /* _OPENMP */
     {
       atom_t *atom;
-      int   h, j, k;
+      int   col, h, i, j, k;
+#ifdef MPI
+      double t_conf;		/* start time of the current configuration */
+#endif /* MPI */
+      double t_phase;		/* start of the current phase of the profile */
       int   n_i, n_j, n_k;
       int   self, uf;
 #ifdef STRESS
@@ -137,7 +248,7 @@ double calc_forces_stiweb(double *xi_opt, double *forces, int flag)
 
       /* pair variables */
       double phi_r, phi_a, inv_c, f_cut;
-      double power[2], x[2], y[2];
+      double x[2], y[2];
       double tmp, tmp_r;
       double v2_val, v2_grad;
       vector tmp_force;
@@ -151,7 +262,14 @@ double calc_forces_stiweb(double *xi_opt, double *forces, int flag)
       vector force_j, force_k;
 
       /* loop over configurations */
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif /* _OPENMP */
       for (h = firstconf; h < firstconf + myconf; h++) {
+#ifdef MPI
+	t_conf = wall_time();
+#endif /* MPI */
+	t_phase = prof_start();
 	uf = conf_uf[h - firstconf];
 	/* reset energies and stresses */
 	forces[energy_p + h] = 0.0;
@@ -190,16 +308,19 @@ double calc_forces_stiweb(double *xi_opt, double *forces, int flag)
 	    /* pair potential part */
 	    col = neigh_j->col[0];
 	    if (neigh_j->r < *(sw->a1[col])) {
-	      /* fn value and grad are calculated in the same step */
-	      x[0] = neigh_j->r;
-	      x[1] = x[0];
-	      y[0] = -*(sw->p[col]);
-	      y[1] = -*(sw->q[col]);
-	      power_m(2, power, x, y);
-	      phi_r = *(sw->A[col]) * power[0];
-	      phi_a = -*(sw->B[col]) * power[1];
 	      inv_c = 1.0 / (neigh_j->r - *(sw->a1[col]));
-	      f_cut = exp(*(sw->delta[col]) * inv_c);
+	      if (pair_new[col]) {
+		/* fn value and grad are calculated in the same step */
+		x[0] = neigh_j->r;
+		x[1] = x[0];
+		y[0] = -*(sw->p[col]);
+		y[1] = -*(sw->q[col]);
+		power_m(2, neigh_j->power, x, y);
+		neigh_j->f_cut = exp(*(sw->delta[col]) * inv_c);
+	      }
+	      phi_r = *(sw->A[col]) * neigh_j->power[0];
+	      phi_a = -*(sw->B[col]) * neigh_j->power[1];
+	      f_cut = neigh_j->f_cut;
 	      v2_val = (phi_r + phi_a) * f_cut;
 	      if (uf) {
 		v2_grad = -v2_val * *(sw->delta[col]) * inv_c * inv_c
@@ -237,7 +358,7 @@ double calc_forces_stiweb(double *xi_opt, double *forces, int flag)
 
 	    /* calculate for later */
 	    col = neigh_j->col[0];
-	    if (neigh_j->r < *(sw->a2[col])) {
+	    if (cut_new[col] && neigh_j->r < *(sw->a2[col])) {
 	      tmp_r = neigh_j->r - *(sw->a2[col]);
 	      if (tmp_r < -0.01 * *(sw->gamma[col])) {
 		tmp_r = 1.0 / tmp_r;
@@ -335,6 +456,7 @@ double calc_forces_stiweb(double *xi_opt, double *forces, int flag)
 	  }			/* j */
 	}
 	/* end second loop over all atoms */
+	t_phase = prof_stop(PROF_MANY, t_phase);
 
 	/* third loop over all atoms, sum up forces */
 	if (uf) {
@@ -372,15 +494,27 @@ double calc_forces_stiweb(double *xi_opt, double *forces, int flag)
 	}
 #endif /* STRESS */
 	/* limiting constraints per configuration */
+	prof_stop(PROF_SUM, t_phase);
+#ifdef MPI
+	conf_time[h - firstconf] += wall_time() - t_conf;
+#endif /* MPI */
       }				/* loop over configurations */
     }				/* parallel region */
 
+    t_prof = prof_start();
+
     /* dummy constraints (global) */
     /* add punishment for out of bounds (mostly for powell_lsq) */
     if (0 == myid) {
       tmpsum += apot_punish(xi_opt, forces);
     }
+    t_prof = prof_stop(PROF_SUM, t_prof);
+
 #ifdef MPI
+    /* a single column of the jacobian only needs the local part */
+    if (local_forces)
+      return tmpsum;
+
     /* reduce global sum */
     sum = 0.0;
     MPI_Reduce(&tmpsum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
@@ -392,9 +526,11 @@ double calc_forces_stiweb(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, forces + natoms * 3,
 	conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_STENS, forces + natoms * 3 + nconf,
 	conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
     } else {
       /* forces */
       MPI_Gatherv(forces + firstatom * 3, myatoms, MPI_VECTOR, forces, atom_len,
@@ -402,10 +538,13 @@ double calc_forces_stiweb(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(forces + natoms * 3 + firstconf, myconf, MPI_DOUBLE,
 	forces + natoms * 3, conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(forces + natoms * 3 + nconf + 6 * firstconf, myconf, MPI_STENS,
 	forces + natoms * 3 + nconf, conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
     }
+    prof_stop(PROF_MPI, t_prof);
 #else
     sum = tmpsum;		/* global sum = local sum  */
 #endif /* MPI */
@@ -413,6 +552,7 @@ double calc_forces_stiweb(double *xi_opt, double *forces, int flag)
     /* root process exits this function now */
     if (0 == myid) {
       fcalls++;			/* Increase function call counter */
+      prof_force();
       if (isnan(sum)) {
 #ifdef DEBUG
 	printf("\n--> Force is nan! <--\n\n");
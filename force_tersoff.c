@@ -32,11 +32,91 @@
 
 #include "potfit.h"
 
+#include "config.h"
 #include "functions.h"
 #include "potential.h"
+#include "profile.h"
 #include "splines.h"
 #include "utils.h"
 
+/* parameters of the last call, per column: lambda, mu, gamma, n, c, d, h, S, R */
+static double *ts_last = NULL;
+/* the cached terms of neighbors and angles of a column are outdated */
+static int *cut_new = NULL;	/* f and df, depend on S and R */
+static int *lambda_new = NULL;	/* exp_lambda */
+static int *mu_new = NULL;	/* exp_mu */
+static int *bond_new = NULL;	/* zeta_n and b_ij, depend on gamma and n */
+static int *angle_new = NULL;	/* g and dg, depend on c, d and h */
+static double *ts_cut = NULL;	/* active and largest possible cutoff of each column */
+
+/****************************************************************
+ *
+ *  check_tersoff_params: compare the parameters that enter the
+ *	cached neighbor and angle terms with those of the last call
+ *	and prune the neighbor lists to the active cutoffs
+ *
+ ****************************************************************/
+
+static void check_tersoff_params(void)
+{
+  int   i;
+  double *last;
+  const tersoff_t *tersoff = &apot_table.tersoff;
+
+  if (NULL == ts_last) {
+    ts_last = (double *)malloc(9 * paircol * sizeof(double));
+    cut_new = (int *)malloc(5 * paircol * sizeof(int));
+    if (NULL == ts_last || NULL == cut_new)
+      error(1, "Cannot allocate memory for the Tersoff cache");
+    reg_for_free(ts_last, "ts_last");
+    reg_for_free(cut_new, "cut_new");
+    ts_cut = (double *)malloc(2 * paircol * sizeof(double));
+    if (NULL == ts_cut)
+      error(1, "Cannot allocate memory for the Tersoff cutoffs");
+    reg_for_free(ts_cut, "ts_cut");
+    lambda_new = cut_new + paircol;
+    mu_new = lambda_new + paircol;
+    bond_new = mu_new + paircol;
+    angle_new = bond_new + paircol;
+    for (i = 0; i < 5 * paircol; i++)
+      cut_new[i] = 1;
+  } else {
+    for (i = 0; i < paircol; i++) {
+      last = ts_last + 9 * i;
+      lambda_new[i] = (last[0] != *(tersoff->lambda[i]));
+      mu_new[i] = (last[1] != *(tersoff->mu[i]));
+      bond_new[i] = (last[2] != *(tersoff->gamma[i]) || last[3] != *(tersoff->n[i]));
+      angle_new[i] = (last[4] != *(tersoff->c[i]) || last[5] != *(tersoff->d[i])
+	|| last[6] != *(tersoff->h[i]));
+      cut_new[i] = (last[7] != *(tersoff->S[i]) || last[8] != *(tersoff->R[i]));
+    }
+  }
+
+  for (i = 0; i < paircol; i++) {
+    last = ts_last + 9 * i;
+    last[0] = *(tersoff->lambda[i]);
+    last[1] = *(tersoff->mu[i]);
+    last[2] = *(tersoff->gamma[i]);
+    last[3] = *(tersoff->n[i]);
+    last[4] = *(tersoff->c[i]);
+    last[5] = *(tersoff->d[i]);
+    last[6] = *(tersoff->h[i]);
+    last[7] = *(tersoff->S[i]);
+    last[8] = *(tersoff->R[i]);
+  }
+
+  /* drop the neighbors outside of S */
+  for (i = 0; i < paircol; i++) {
+    ts_cut[i] = *(tersoff->S[i]);
+    ts_cut[paircol + i] = apot_table.end[i];
+  }
+  if (prune_neighbors(ts_cut, ts_cut + paircol))
+    for (i = 0; i < 5 * paircol; i++)
+      cut_new[i] = 1;
+
+  return;
+}
+
 /****************************************************************
  *
  *  compute forces using pair potentials with spline interpolation
@@ -89,6 +169,7 @@
 double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
 {
   double tmpsum = 0.0, sum = 0.0;
+  double t_prof;		/* start of the current phase of the profile */
   const tersoff_t *tersoff = &apot_table.tersoff;
 
 #ifndef MPI
@@ -97,6 +178,7 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
 
   /* This is the start of an infinite loop */
   while (1) {
+    t_prof = prof_start();
     tmpsum = 0.;		/* sum of squares of local process */
 
 #ifndef MPI
@@ -104,25 +186,65 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
 #endif /* !MPI */
 
 #ifdef MPI
-    MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (local_forces) {
+      /* a single column of the jacobian, no communication */
+      /* every process corrects its own copy of the parameters */
+      apot_check_params(xi_opt);
+    } else {
+      MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      t_prof = prof_stop(PROF_MPI, t_prof);
+
+      if (flag == 1)
+	break;			/* Exception: flag 1 means clean up */
+
+      if (myid == 0)
+	apot_check_params(xi_opt);
+      MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+      /* flag 3: all processes evaluate the columns of the jacobian */
+      if (flag == 3) {
+	gamma_columns(xi_opt);
+	if (myid == 0)
+	  return 0.0;
+	continue;
+      }
 
-    if (flag == 1)
-      break;			/* Exception: flag 1 means clean up */
+      /* flag 4: all processes evaluate a batch of parameter vectors */
+      if (flag == 4) {
+	batch_forces();
+	if (myid == 0)
+	  return 0.0;
+	continue;
+      }
 
-    if (myid == 0)
-      apot_check_params(xi_opt);
-    MPI_Bcast(xi_opt, ndimtot, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      /* move configurations to other processes if the load is unbalanced */
+      balance_configs();
+    }
 #endif /* MPI */
 
     update_tersoff_pointers(xi_opt);
 
-    /* region containing loop over configurations */
+    /* the geometry is fixed, only the terms which depend on
+       changed parameters need to be evaluated again */
+    check_tersoff_params();
+
+    t_prof = prof_stop(PROF_SETUP, t_prof);
+
+    /* region containing loop over configurations,
+       configurations are distributed among the threads of each process */
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:tmpsum)
+#endif /* _OPENMP */
     {
       atom_t *atom;		/* pointer to current atom */
       neigh_t *neigh_j;		/* pointer to current neighbor j (first neighbor loop) */
       neigh_t *neigh_k;		/* pointer to current neighbor k (second neighbor loop) */
       angl *n_angl;		/* pointer to current angular table */
       int   h;			/* counter for configurations */
+#ifdef MPI
+      double t_conf;		/* start time of the current configuration */
+#endif /* MPI */
+      double t_phase;		/* start of the current phase of the profile */
       int   i;			/* counter for atoms */
       int   j;			/* counter for neighbors (first loop) */
       int   k;			/* counter for neighbors (second loop) */
@@ -152,7 +274,14 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
       vector dcos_j, dcos_k;
 
       /* loop over configurations */
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif /* _OPENMP */
       for (h = firstconf; h < firstconf + myconf; h++) {
+#ifdef MPI
+	t_conf = wall_time();
+#endif /* MPI */
+	t_phase = prof_start();
 	uf = conf_uf[h - firstconf];
 
 	/* reset energies and stresses */
@@ -195,18 +324,26 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
 	      self = (neigh_j->nr == i + cnfstart[h]) ? 1 : 0;
 
 	      /* calculate cutoff function f_c and store it for every neighbor */
-	      cut_tmp = M_PI / (*(tersoff->S[col_j]) - *(tersoff->R[col_j]));
-	      cut_tmp_j = cut_tmp * (neigh_j->r - *(tersoff->R[col_j]));
-	      if (neigh_j->r < *(tersoff->R[col_j])) {
-		neigh_j->f = 1.0;
-		neigh_j->df = 0.0;
-	      } else {
-		neigh_j->f = 0.5 * (1.0 + cos(cut_tmp_j));
-		neigh_j->df = -0.5 * cut_tmp * sin(cut_tmp_j);
+	      if (cut_new[col_j]) {
+		cut_tmp = M_PI / (*(tersoff->S[col_j]) - *(tersoff->R[col_j]));
+		cut_tmp_j = cut_tmp * (neigh_j->r - *(tersoff->R[col_j]));
+		if (neigh_j->r < *(tersoff->R[col_j])) {
+		  neigh_j->f = 1.0;
+		  neigh_j->df = 0.0;
+		} else {
+		  neigh_j->f = 0.5 * (1.0 + cos(cut_tmp_j));
+		  neigh_j->df = -0.5 * cut_tmp * sin(cut_tmp_j);
+		}
 	      }
 
+	      /* the exponentials are not cached outside of the old cutoff */
+	      if (lambda_new[col_j] || cut_new[col_j])
+		neigh_j->exp_lambda = exp(-*(tersoff->lambda[col_j]) * neigh_j->r);
+	      if (mu_new[col_j] || cut_new[col_j])
+		neigh_j->exp_mu = exp(-*(tersoff->mu[col_j]) * neigh_j->r);
+
 	      /* calculate pair part f_c*A*exp(-lambda*r) and the derivative */
-	      tmp = exp(-*(tersoff->lambda[col_j]) * neigh_j->r);
+	      tmp = neigh_j->exp_lambda;
 	      phi_val = neigh_j->f * *(tersoff->A[col_j]) * tmp;
 	      phi_grad = neigh_j->df - *(tersoff->lambda[col_j]) * neigh_j->f;
 	      phi_grad *= *(tersoff->A[col_j]) * tmp;
@@ -281,9 +418,13 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
 		  tmp_jk = 1.0 / (neigh_j->r * neigh_k->r);
 		  cos_theta = n_angl->cos;
 
-		  tmp_1 = *(tersoff->h[col_j]) - cos_theta;
-		  tmp_2 = 1.0 / (tersoff->d2[col_j] + tmp_1 * tmp_1);
-		  g_theta = 1.0 + tersoff->c2[col_j] / tersoff->d2[col_j] - tersoff->c2[col_j] * tmp_2;
+		  if (angle_new[col_j] || cut_new[col_j] || cut_new[col_k]) {
+		    tmp_1 = *(tersoff->h[col_j]) - cos_theta;
+		    tmp_2 = 1.0 / (tersoff->d2[col_j] + tmp_1 * tmp_1);
+		    n_angl->g = 1.0 + tersoff->c2[col_j] / tersoff->d2[col_j] - tersoff->c2[col_j] * tmp_2;
+		    n_angl->dg = 2.0 * tersoff->c2[col_j] * tmp_1 * tmp_2 * tmp_2;
+		  }
+		  g_theta = n_angl->g;
 
 		  /* zeta */
 		  zeta += neigh_k->f * *(tersoff->omega[col_k]) * g_theta;
@@ -299,8 +440,7 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
 		  dcos_k.y = tmp_jk * neigh_j->dist.y - tmp_k2 * neigh_k->dist.y;
 		  dcos_k.z = tmp_jk * neigh_j->dist.z - tmp_k2 * neigh_k->dist.z;
 
-		  tmp_3 = 2.0 * tersoff->c2[col_j] * tmp_1 * tmp_2 * tmp_2 * neigh_k->f *
-		    *(tersoff->omega[col_k]);
+		  tmp_3 = n_angl->dg * neigh_k->f * *(tersoff->omega[col_k]);
 
 		  tmp_grad = neigh_k->df / neigh_k->r * g_theta * *(tersoff->omega[col_k]);
 
@@ -318,14 +458,20 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
 		}
 	      }			/* k */
 
-	      phi_a = 0.5 * *(tersoff->B[col_j]) * exp(-*(tersoff->mu[col_j]) * neigh_j->r);
+	      phi_a = 0.5 * *(tersoff->B[col_j]) * neigh_j->exp_mu;
 
-	      tmp_pow_1 = *(tersoff->gamma[col_j]) * zeta;
-	      power_1(&tmp_4, &tmp_pow_1, tersoff->n[col_j]);
+	      /* the bond order only changes with zeta, gamma and n */
+	      if (bond_new[col_j] || cut_new[col_j] || zeta != neigh_j->zeta) {
+		tmp_pow_1 = *(tersoff->gamma[col_j]) * zeta;
+		power_1(&neigh_j->zeta_n, &tmp_pow_1, tersoff->n[col_j]);
 
-	      tmp_pow_1 = 1.0 + tmp_4;
-	      tmp_pow_2 = -1.0 / (2.0 * *(tersoff->n[col_j]));
-	      power_1(&b_ij, &tmp_pow_1, &tmp_pow_2);
+		tmp_pow_1 = 1.0 + neigh_j->zeta_n;
+		tmp_pow_2 = -1.0 / (2.0 * *(tersoff->n[col_j]));
+		power_1(&neigh_j->b_ij, &tmp_pow_1, &tmp_pow_2);
+		neigh_j->zeta = zeta;
+	      }
+	      tmp_4 = neigh_j->zeta_n;
+	      b_ij = neigh_j->b_ij;
 
 	      phi_val = -b_ij * phi_a;
 
@@ -412,6 +558,7 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
 	  }
 	}
 	/* end second loop over all atoms */
+	t_phase = prof_stop(PROF_MANY, t_phase);
 
 	/* third loop over all atoms, sum up forces */
 	if (uf) {
@@ -450,9 +597,15 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
 	}
 #endif /* STRESS */
 
+	prof_stop(PROF_SUM, t_phase);
+#ifdef MPI
+	conf_time[h - firstconf] += wall_time() - t_conf;
+#endif /* MPI */
       }				/* loop over configurations */
     }				/* parallel region */
 
+    t_prof = prof_start();
+
 #ifdef APOT
     /* add punishment for out of bounds (mostly for powell_lsq) */
     if (myid == 0)
@@ -460,7 +613,13 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
 #endif /* APOT */
 
     sum = tmpsum;		/* global sum = local sum  */
+    t_prof = prof_stop(PROF_SUM, t_prof);
+
 #ifdef MPI
+    /* a single column of the jacobian only needs the local part */
+    if (local_forces)
+      return tmpsum;
+
     /* reduce global sum */
     sum = 0.0;
     MPI_Reduce(&tmpsum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
@@ -472,9 +631,11 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, forces + natoms * 3,
 	conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_STENS, forces + natoms * 3 + nconf,
 	conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
     } else {
       /* forces */
       MPI_Gatherv(forces + firstatom * 3, myatoms, MPI_VECTOR, forces, atom_len,
@@ -482,15 +643,19 @@ double calc_forces_tersoff(double *xi_opt, double *forces, int flag)
       /* energies */
       MPI_Gatherv(forces + natoms * 3 + firstconf, myconf, MPI_DOUBLE,
 	forces + natoms * 3, conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef STRESS
       /* stresses */
       MPI_Gatherv(forces + natoms * 3 + nconf + 6 * firstconf, myconf, MPI_STENS,
 	forces + natoms * 3 + nconf, conf_len, conf_dist, MPI_STENS, 0, MPI_COMM_WORLD);
+#endif /* STRESS */
     }
+    prof_stop(PROF_MPI, t_prof);
 #endif /* MPI */
 
     /* root process exits this function now */
     if (myid == 0) {
       fcalls++;			/* Increase function call counter */
+      prof_force();
       if (isnan(sum)) {
 #ifdef DEBUG
 	printf("\n--> Force is nan! <--\n\n");
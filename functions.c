@@ -40,6 +40,7 @@
 /* macro for simplified addition of new potential functions */
 #define str(s) #s
 #define add_pot(a,b) add_potential(str(a),b,&a ## _value)
+#define add_grad(a) add_gradient(str(a),&a ## _grad)
 
 /****************************************************************
  *
@@ -92,6 +93,22 @@ void apot_init(void)
   add_pot(sheng_rho, 5);
   add_pot(sheng_F, 4);
 
+  /* analytic derivatives, all others are calculated numerically */
+  add_grad(lj);
+  add_grad(eopp);
+  add_grad(morse);
+#ifndef COULOMB
+  add_grad(buck);
+#endif /* COULOMB */
+  add_grad(softshell);
+  add_grad(power);
+  add_grad(power_decay);
+  add_grad(exp_decay);
+  add_grad(parabola);
+  add_grad(const);
+  add_grad(sqrt);
+  add_grad(mexp_decay);
+
 #ifdef STIWEB
   add_pot(stiweb_2, 6);
   add_pot(stiweb_3, 2);
@@ -106,6 +123,7 @@ void apot_init(void)
   reg_for_free(function_table.name, "function_table.name");
   reg_for_free(function_table.n_par, "function_table.n_par");
   reg_for_free(function_table.fvalue, "function_table.fvalue");
+  reg_for_free(function_table.fgrad, "function_table.fgrad");
   for (i = 0; i < n_functions; i++)
     reg_for_free(function_table.name[i], "function_table.name[i]");
 
@@ -135,7 +153,9 @@ void add_potential(char *name, int parameter, fvalue_pointer fval)
   function_table.name[k] = (char *)malloc(255 * sizeof(char));
   function_table.n_par = (int *)realloc(function_table.n_par, (k + 1) * sizeof(int));
   function_table.fvalue = (fvalue_pointer *) realloc(function_table.fvalue, (k + 1) * sizeof(fvalue_pointer));
-  if (function_table.name[k] == NULL || function_table.n_par == NULL || function_table.fvalue == NULL)
+  function_table.fgrad = (fgrad_pointer *) realloc(function_table.fgrad, (k + 1) * sizeof(fgrad_pointer));
+  if (function_table.name[k] == NULL || function_table.n_par == NULL || function_table.fvalue == NULL
+    || function_table.fgrad == NULL)
     error(1, "Could not allocate memory for function_table!");
 
   /* assign values */
@@ -144,12 +164,35 @@ void add_potential(char *name, int parameter, fvalue_pointer fval)
   strncpy(function_table.name[k], name, strlen(name));
   function_table.n_par[k] = parameter;
   function_table.fvalue[k] = fval;
+  function_table.fgrad[k] = NULL;
 
   n_functions++;
 
   return;
 }
 
+/****************************************************************
+ *
+ * add analytic derivatives to an existing function
+ *
+ ****************************************************************/
+
+void add_gradient(char *name, fgrad_pointer fgrad)
+{
+  int   i;
+
+  for (i = 0; i < n_functions; i++) {
+    if (strcmp(function_table.name[i], name) == 0) {
+      if (function_table.n_par[i] > APOT_GRAD_PAR)
+	error(1, "Too many parameters for analytic derivatives of \"%s\".", name);
+      function_table.fgrad[i] = fgrad;
+      return;
+    }
+  }
+
+  error(1, "There is no potential with the name \"%s\".", name);
+}
+
 /****************************************************************
  *
  * return the number of parameters for a specific analytic potential
@@ -183,6 +226,7 @@ int apot_assign_functions(apot_table_t *apt)
     for (j = 0; j < n_functions; j++) {
       if (strcmp(apt->names[i], function_table.name[j]) == 0) {
 	apt->fvalue[i] = function_table.fvalue[j];
+	apt->fgrad[i] = function_table.fgrad[j];
 	break;
       }
       if (j == n_functions - 1)
@@ -273,7 +317,7 @@ void check_apot_functions(void)
 
 void lj_value(double r, double *p, double *f)
 {
-  static double sig_d_rad6, sig_d_rad12;
+  double sig_d_rad6, sig_d_rad12;
 
   sig_d_rad6 = (p[1] * p[1]) / (r * r);
   sig_d_rad6 = sig_d_rad6 * sig_d_rad6 * sig_d_rad6;
@@ -294,7 +338,7 @@ void lj_value(double r, double *p, double *f)
 
 void eopp_value(double r, double *p, double *f)
 {
-  static double x[2], y[2], power[2];
+  double x[2], y[2], power[2];
 
   x[0] = r;
   x[1] = r;
@@ -333,7 +377,7 @@ void morse_value(double r, double *p, double *f)
 
 void ms_value(double r, double *p, double *f)
 {
-  static double x;
+  double x;
 
   x = 1. - r / p[2];
 
@@ -352,7 +396,7 @@ void ms_value(double r, double *p, double *f)
 
 void buck_value(double r, double *p, double *f)
 {
-  static double x, y;
+  double x, y;
 
   x = (p[1] * p[1]) / (r * r);
   y = x * x * x;
@@ -370,7 +414,7 @@ void buck_value(double r, double *p, double *f)
 
 void softshell_value(double r, double *p, double *f)
 {
-  static double x, y;
+  double x, y;
 
   x = p[0] / r;
   y = p[1];
@@ -390,7 +434,7 @@ void softshell_value(double r, double *p, double *f)
 
 void eopp_exp_value(double r, double *p, double *f)
 {
-  static double power;
+  double power;
 
   power_1(&power, &r, &p[3]);
 
@@ -409,7 +453,7 @@ void eopp_exp_value(double r, double *p, double *f)
 
 void meopp_value(double r, double *p, double *f)
 {
-  static double x[2], y[2], power[2];
+  double x[2], y[2], power[2];
 
   x[0] = r - p[6];
   x[1] = r;
@@ -431,7 +475,7 @@ void meopp_value(double r, double *p, double *f)
 
 void power_value(double r, double *p, double *f)
 {
-  static double x, y, power;
+  double x, y, power;
 
   x = r;
   y = p[1];
@@ -451,7 +495,7 @@ void power_value(double r, double *p, double *f)
 
 void power_decay_value(double r, double *p, double *f)
 {
-  static double x, y, power;
+  double x, y, power;
 
   x = 1. / r;
   y = p[1];
@@ -486,7 +530,7 @@ void exp_decay_value(double r, double *p, double *f)
 
 void bjs_value(double r, double *p, double *f)
 {
-  static double power;
+  double power;
 
   if (r == 0)
     *f = 0;
@@ -521,7 +565,7 @@ void parabola_value(double r, double *p, double *f)
 
 void csw_value(double r, double *p, double *f)
 {
-  static double power;
+  double power;
 
   power_1(&power, &r, &p[3]);
 
@@ -540,7 +584,7 @@ void csw_value(double r, double *p, double *f)
 
 void csw2_value(double r, double *p, double *f)
 {
-  static double power;
+  double power;
 
   power_1(&power, &r, &p[3]);
 
@@ -559,7 +603,7 @@ void csw2_value(double r, double *p, double *f)
 
 void universal_value(double r, double *p, double *f)
 {
-  static double x[2], y[2], power[2];
+  double x[2], y[2], power[2];
 
   x[0] = r;
   x[1] = r;
@@ -624,7 +668,7 @@ void mexp_decay_value(double r, double *p, double *f)
 
 void strmm_value(double r, double *p, double *f)
 {
-  static double r_0;
+  double r_0;
 
   r_0 = r - p[4];
 
@@ -675,7 +719,7 @@ void double_exp_value(double r, double *p, double *f)
 
 void poly_5_value(double r, double *p, double *f)
 {
-  static double dr;
+  double dr;
 
   dr = (r - 1.) * (r - 1.);
 
@@ -694,7 +738,7 @@ void poly_5_value(double r, double *p, double *f)
 
 void kawamura_value(double r, double *p, double *f)
 {
-  static double r6;
+  double r6;
 
   r6 = r * r * r;
   r6 *= r6;
@@ -706,7 +750,7 @@ void kawamura_value(double r, double *p, double *f)
 
 void kawamura_mix_value(double r, double *p, double *f)
 {
-  static double r6;
+  double r6;
 
   r6 = r * r * r;
   r6 *= r6;
@@ -740,9 +784,9 @@ void exp_plus_value(double r, double *p, double *f)
 
 void mishin_value(double r, double *p, double *f)
 {
-  static double z;
-  static double temp;
-  static double power;
+  double z;
+  double temp;
+  double power;
 
   z = r - p[3];
   temp = exp(-p[5] * r);
@@ -764,7 +808,7 @@ void mishin_value(double r, double *p, double *f)
 
 void gen_lj_value(double r, double *p, double *f)
 {
-  static double x[2], y[2], power[2];
+  double x[2], y[2], power[2];
 
   x[0] = r / p[3];
   x[1] = x[0];
@@ -788,7 +832,7 @@ void gen_lj_value(double r, double *p, double *f)
 
 void gljm_value(double r, double *p, double *f)
 {
-  static double x[3], y[3], power[3];
+  double x[3], y[3], power[3];
 
   x[0] = r / p[3];
   x[1] = x[0];
@@ -834,7 +878,7 @@ void vas_value(double r, double *p, double *f)
 
 void vpair_value(double r, double *p, double *f)
 {
-  static double x[7], y, z;
+  double x[7], y, z;
 
   y = r;
   z = p[1];
@@ -860,7 +904,7 @@ void vpair_value(double r, double *p, double *f)
 
 void sheng_phi1_value(double r, double *p, double *f)
 {
-  static double x, y, z;
+  double x, y, z;
 
   x = -p[1] * r * r;
   y = r - p[4];
@@ -873,7 +917,7 @@ void sheng_phi1_value(double r, double *p, double *f)
 
 void sheng_phi2_value(double r, double *p, double *f)
 {
-  static double x, y, z;
+  double x, y, z;
 
   x = -p[1] * r * r;
   y = r - p[3];
@@ -886,8 +930,8 @@ void sheng_phi2_value(double r, double *p, double *f)
 
 void sheng_rho_value(double r, double *p, double *f)
 {
-  static double sig_d_rad6, sig_d_rad12, x, y, power;
-  static int h, k;
+  double sig_d_rad6, sig_d_rad12, x, y, power;
+  int h, k;
 
   h = (r > 1.45) ? 1 : 0;
   k = (r <= 1.45) ? 1 : 0;
@@ -907,7 +951,7 @@ void sheng_rho_value(double r, double *p, double *f)
 
 void sheng_F_value(double r, double *p, double *f)
 {
-  static double x, y, power;
+  double x, y, power;
 
   x = r;
   y = p[1];
@@ -928,7 +972,7 @@ void sheng_F_value(double r, double *p, double *f)
 
 void stiweb_2_value(double r, double *p, double *f)
 {
-  static double x[2], y[2], power[2];
+  double x[2], y[2], power[2];
 
   x[0] = r;
   x[1] = r;
@@ -1027,6 +1071,196 @@ void newpot_value(double r, double *p, double *f)
 
 /* end of template */
 
+/****************************************************************
+ *
+ * analytic derivatives of some of the potential functions
+ *
+ * *dr receives the derivative with respect to r,
+ * dp[i] the derivative with respect to the parameter p[i]
+ *
+ * functions without an entry here are differentiated numerically
+ *
+ ****************************************************************/
+
+void lj_grad(double r, double *p, double *dr, double *dp)
+{
+  double sig_d_rad6, sig_d_rad12;
+
+  sig_d_rad6 = (p[1] * p[1]) / (r * r);
+  sig_d_rad6 = sig_d_rad6 * sig_d_rad6 * sig_d_rad6;
+  sig_d_rad12 = dsquare(sig_d_rad6);
+
+  *dr = 4. * p[0] * (6. * sig_d_rad6 - 12. * sig_d_rad12) / r;
+  dp[0] = 4. * (sig_d_rad12 - sig_d_rad6);
+  dp[1] = 4. * p[0] * (12. * sig_d_rad12 - 6. * sig_d_rad6) / p[1];
+
+  return;
+}
+
+void eopp_grad(double r, double *p, double *dr, double *dp)
+{
+  double x[2], y[2], power[2];
+  double c, s, logr;
+
+  x[0] = r;
+  x[1] = r;
+  y[0] = p[1];
+  y[1] = p[3];
+
+  power_m(2, power, x, y);
+
+  c = cos(p[4] * r + p[5]);
+  s = sin(p[4] * r + p[5]);
+  logr = log(r);
+
+  *dr = -p[0] * p[1] / (power[0] * r) - (p[2] / power[1]) * (p[3] * c / r + p[4] * s);
+  dp[0] = 1. / power[0];
+  dp[1] = -p[0] * logr / power[0];
+  dp[2] = c / power[1];
+  dp[3] = -p[2] * c * logr / power[1];
+  dp[4] = -p[2] * s * r / power[1];
+  dp[5] = -p[2] * s / power[1];
+
+  return;
+}
+
+void morse_grad(double r, double *p, double *dr, double *dp)
+{
+  double e1, e2;
+
+  e1 = exp(-p[1] * (r - p[2]));
+  e2 = e1 * e1;
+
+  *dr = -2. * p[0] * p[1] * (e2 - e1);
+  dp[0] = e2 - 2. * e1;
+  dp[1] = -2. * p[0] * (r - p[2]) * (e2 - e1);
+  dp[2] = 2. * p[0] * p[1] * (e2 - e1);
+
+  return;
+}
+
+void buck_grad(double r, double *p, double *dr, double *dp)
+{
+  double x, y, e;
+
+  x = (p[1] * p[1]) / (r * r);
+  y = x * x * x;
+  e = exp(-r / p[1]);
+
+  *dr = -p[0] * e / p[1] + 6. * p[2] * y / r;
+  dp[0] = e;
+  dp[1] = p[0] * e * r / (p[1] * p[1]) - 6. * p[2] * y / p[1];
+  dp[2] = -y;
+
+  return;
+}
+
+void softshell_grad(double r, double *p, double *dr, double *dp)
+{
+  double x, y, f;
+
+  x = p[0] / r;
+  y = p[1];
+
+  power_1(&f, &x, &y);
+
+  *dr = -p[1] * f / r;
+  dp[0] = p[1] * f / p[0];
+  dp[1] = f * log(x);
+
+  return;
+}
+
+void power_grad(double r, double *p, double *dr, double *dp)
+{
+  double x, y, power;
+
+  x = r;
+  y = p[1];
+
+  power_1(&power, &x, &y);
+
+  *dr = p[0] * p[1] * power / r;
+  dp[0] = power;
+  dp[1] = p[0] * power * log(r);
+
+  return;
+}
+
+void power_decay_grad(double r, double *p, double *dr, double *dp)
+{
+  double x, y, power;
+
+  x = 1. / r;
+  y = p[1];
+
+  power_1(&power, &x, &y);
+
+  *dr = -p[0] * p[1] * power / r;
+  dp[0] = power;
+  dp[1] = -p[0] * power * log(r);
+
+  return;
+}
+
+void exp_decay_grad(double r, double *p, double *dr, double *dp)
+{
+  double e;
+
+  e = exp(-p[1] * r);
+
+  *dr = -p[0] * p[1] * e;
+  dp[0] = e;
+  dp[1] = -p[0] * r * e;
+
+  return;
+}
+
+void parabola_grad(double r, double *p, double *dr, double *dp)
+{
+  *dr = 2. * r * p[0] + p[1];
+  dp[0] = r * r;
+  dp[1] = r;
+  dp[2] = 1.;
+
+  return;
+}
+
+void const_grad(double r, double *p, double *dr, double *dp)
+{
+  *dr = 0.0 * r * p[0];
+  dp[0] = 1.;
+
+  return;
+}
+
+void sqrt_grad(double r, double *p, double *dr, double *dp)
+{
+  double f;
+
+  f = p[0] * sqrt(r / p[1]);
+
+  *dr = 0.5 * f / r;
+  dp[0] = sqrt(r / p[1]);
+  dp[1] = -0.5 * f / p[1];
+
+  return;
+}
+
+void mexp_decay_grad(double r, double *p, double *dr, double *dp)
+{
+  double e;
+
+  e = exp(-p[1] * (r - p[2]));
+
+  *dr = -p[0] * p[1] * e;
+  dp[0] = e;
+  dp[1] = -p[0] * (r - p[2]) * e;
+  dp[2] = p[0] * p[1] * e;
+
+  return;
+}
+
 /****************************************************************
  *
  * end of analytic potentials
@@ -1044,7 +1278,7 @@ double cutoff(double r, double r0, double h)
   if ((r - r0) > 0)
     return 0;
 
-  static double val;
+  double val;
 
   val = (r - r0) / h;
   val *= val;
@@ -1177,7 +1411,16 @@ double apot_punish(double *params, double *forces)
 
 double apot_grad(double r, double *p, void (*function) (double, double *, double *))
 {
+  int   i;
   double a, b, h = 0.0001;
+  double dp[APOT_GRAD_PAR];
+
+  /* use the analytic derivative if there is one */
+  for (i = 0; i < apot_table.number; i++)
+    if (apot_table.fvalue[i] == function && NULL != apot_table.fgrad[i]) {
+      apot_table.fgrad[i] (r, p, &a, dp);
+      return a;
+    }
 
   function(r + h, p, &a);
   function(r - h, p, &b);
@@ -1185,6 +1428,73 @@ double apot_grad(double r, double *p, void (*function) (double, double *, double
   return (a - b) / (2. * h);
 }
 
+/****************************************************************
+ *
+ * apot_dtable: derivatives of the tabulated values of a potential
+ *     in calc_pot with respect to the parameter xi_opt[k],
+ *     including the smooth cutoff function
+ *
+ *     h is the step for functions without analytic derivatives
+ *
+ *     only the column of the potential is written to dtable;
+ *     returns the column or -1 if xi_opt[k] does not belong to a
+ *     single potential function (globals, chemical potentials, ...)
+ *
+ ****************************************************************/
+
+int apot_dtable(double *xi_opt, int k, double h, double *dtable)
+{
+  int   col, j, l, n;
+  double *p, r, f, f1, dr, c, x, store;
+  double dp[APOT_GRAD_PAR];
+
+  for (col = 0; col < apot_table.number; col++)
+    if (k >= opt_pot.first[col] && k < opt_pot.first[col] + apot_table.n_par[col])
+      break;
+  if (col == apot_table.number || invar_pot[col])
+    return -1;
+
+  p = xi_opt + opt_pot.first[col];
+  n = k - opt_pot.first[col];
+
+  for (j = 0; j < APOT_STEPS; j++) {
+    l = calc_pot.first[col] + j;
+    r = calc_pot.xcoord[l];
+
+    /* the last parameter of a smooth potential is the cutoff width */
+    if (smooth_pot[col] && n == apot_table.n_par[col] - 1) {
+      if (r > apot_table.end[col]) {
+	dtable[l] = 0.0;
+	continue;
+      }
+      apot_table.fvalue[col] (r, p, &f);
+      x = dsquare(dsquare((r - apot_table.end[col]) / p[n]));
+      dtable[l] = -4.0 * f * x / (p[n] * dsquare(1.0 + x));
+      continue;
+    }
+
+    if (NULL != apot_table.fgrad[col]) {
+      apot_table.fgrad[col] (r, p, &dr, dp);
+      f = dp[n];
+    } else {
+      store = p[n];
+      apot_table.fvalue[col] (r, p, &f);
+      p[n] += h;
+      apot_table.fvalue[col] (r, p, &f1);
+      p[n] = store;
+      f = (f1 - f) / h;
+    }
+
+    if (smooth_pot[col]) {
+      c = cutoff(r, apot_table.end[col], p[apot_table.n_par[col] - 1]);
+      dtable[l] = f * c;
+    } else
+      dtable[l] = f;
+  }
+
+  return col;
+}
+
 #ifdef COULOMB
 
 /****************************************************************
@@ -1195,7 +1505,7 @@ double apot_grad(double r, double *p, void (*function) (double, double *, double
 
 void ms_init(double r, double *pot, double *grad, double *p)
 {
-  static double x[4];
+  double x[4];
 
   x[0] = 1 - r / p[2];
   x[1] = exp(p[1] * x[0]);
@@ -1216,7 +1526,7 @@ void ms_init(double r, double *pot, double *grad, double *p)
 
 void buck_init(double r, double *pot, double *grad, double *p)
 {
-  static double x[3];
+  double x[3];
 
   x[0] = dsquare(p[1]) / dsquare(r);
   x[1] = p[2] * x[0] * x[0] * x[0];
@@ -1236,7 +1546,7 @@ void buck_init(double r, double *pot, double *grad, double *p)
 
 void ms_shift(double r, double *p, double *f)
 {
-  static double pot, grad, pot_cut, grad_cut;
+  double pot, grad, pot_cut, grad_cut;
 
   ms_init(r, &pot, &grad, p);
   ms_init(dp_cut, &pot_cut, &grad_cut, p);
@@ -1254,7 +1564,7 @@ void ms_shift(double r, double *p, double *f)
 
 void buck_shift(double r, double *p, double *f)
 {
-  static double pot, grad, pot_cut, grad_cut;
+  double pot, grad, pot_cut, grad_cut;
 
   buck_init(r, &pot, &grad, p);
   buck_init(dp_cut, &pot_cut, &grad_cut, p);
@@ -1272,7 +1582,7 @@ void buck_shift(double r, double *p, double *f)
 
 void elstat_value(double r, double dp_kappa, double *ftail, double *gtail, double *ggtail)
 {
-  static double x[4];
+  double x[4];
 
   x[0] = r * r;
   x[1] = dp_kappa * dp_kappa;
@@ -1290,19 +1600,27 @@ void elstat_value(double r, double dp_kappa, double *ftail, double *gtail, doubl
  *
  * shifted tail of coloumb potential
  *
+ * With the Ewald sum the tail is not shifted, the remainder
+ * is taken care of in reciprocal space.
+ *
  ****************************************************************/
 
 void elstat_shift(double r, double dp_kappa, double *fnval_tail, double *grad_tail, double *ggrad_tail)
 {
-  static double ftail, gtail, ggtail, ftail_cut, gtail_cut, ggtail_cut;
-  static double x[3];
+  double ftail, gtail, ggtail, ftail_cut, gtail_cut, ggtail_cut;
+  double x[3];
 
   x[0] = r * r;
   x[1] = dp_cut * dp_cut;
   x[2] = x[0] - x[1];
 
   elstat_value(r, dp_kappa, &ftail, &gtail, &ggtail);
-  elstat_value(dp_cut, dp_kappa, &ftail_cut, &gtail_cut, &ggtail_cut);
+  if (ewald) {
+    ftail_cut = 0.;
+    gtail_cut = 0.;
+    ggtail_cut = 0.;
+  } else
+    elstat_value(dp_cut, dp_kappa, &ftail_cut, &gtail_cut, &ggtail_cut);
 
   *fnval_tail = ftail - ftail_cut - x[2] * gtail_cut / 2;
   *grad_tail = gtail - gtail_cut;
@@ -1316,6 +1634,160 @@ void elstat_shift(double r, double dp_kappa, double *fnval_tail, double *grad_ta
   return;
 }
 
+/****************************************************************
+ *
+ * tabulated tail of the electrostatic potential
+ *
+ * The shifted tail is tabulated on an equidistant grid between
+ * the smallest neighbor distance and dp_cut. Each grid point holds
+ * fnval, grad and ggrad together with their derivatives in r, so
+ * that cubic Hermite interpolation can be used in between.
+ * The grid is refined until the interpolation error halfway
+ * between the grid points is below dp_tail_tol times the largest
+ * value in the table.
+ *
+ ****************************************************************/
+
+#define TAIL_MINLEN 64
+#define TAIL_MAXLEN 65536
+
+static double *tail_tab = NULL;	/* 6 values for every grid point */
+static int tail_len = 0;	/* number of intervals of the grid */
+static int tail_size = 0;	/* number of intervals allocated */
+static double tail_begin;	/* first grid point */
+static double tail_step;	/* distance of the grid points */
+static double tail_kappa_tab;	/* kappa of the table */
+
+/* exact shifted tail and its derivatives in r, cut holds the tail at dp_cut */
+static void elstat_tail_row(double r, double dp_kappa, double *cut, double *row)
+{
+  double t[4], x[3];
+
+  elstat_value(r, dp_kappa, t, t + 1, t + 2);
+  x[0] = r * r;
+  x[1] = x[0] - dp_cut * dp_cut;
+  x[2] = 2 * dp_eps * dp_kappa * exp(-x[0] * dp_kappa * dp_kappa) / sqrt(M_PI);
+  /* third derivative (1/r d/dr)^3 of the tail */
+  t[3] = -(5 * t[2] + 4 * dp_kappa * dp_kappa * dp_kappa * dp_kappa * x[2]) / x[0];
+
+  row[0] = t[0] - cut[0] - x[1] * cut[1] / 2;
+  row[2] = t[1] - cut[1];
+  row[3] = r * t[2];
+  row[4] = 0.;
+  row[5] = 0.;
+#ifdef DIPOLE
+  row[0] -= x[1] * x[1] * cut[2] / 8;
+  row[2] -= x[1] * cut[2] / 2;
+  row[4] = t[2] - cut[2];
+  row[3] = r * row[4];
+  row[5] = r * t[3];
+#endif /* DIPOLE */
+  row[1] = r * row[2];
+
+  return;
+}
+
+void elstat_table(double dp_kappa)
+{
+  int   i, k, n, ok;
+  double r, cut[3], row[6], val[3], scale[3];
+  void *p_old;
+
+  tail_kappa_tab = dp_kappa;
+  tail_len = 0;
+  if (0. == dp_tail_tol)
+    return;
+
+  tail_begin = dp_cut;
+  for (i = 0; i < ntypes * ntypes; i++)
+    tail_begin = MIN(tail_begin, 0.95 * rmin[i]);
+  if (tail_begin >= dp_cut)
+    return;
+
+  if (ewald)
+    cut[0] = cut[1] = cut[2] = 0.;
+  else
+    elstat_value(dp_cut, dp_kappa, cut, cut + 1, cut + 2);
+
+  for (n = MAX(tail_size, TAIL_MINLEN);; n *= 2) {
+    if (n > tail_size) {
+      if (NULL != tail_tab) {
+	p_old = tail_tab;
+	free_registered(&p_old, 1);
+      }
+      tail_tab = (double *)malloc(6 * (n + 1) * sizeof(double));
+      if (NULL == tail_tab)
+	error(1, "Cannot allocate memory for the electrostatic tail table");
+      reg_for_free(tail_tab, "electrostatic tail table");
+      tail_size = n;
+    }
+    tail_step = (dp_cut - tail_begin) / n;
+    scale[0] = scale[1] = scale[2] = 0.;
+    for (k = 0; k <= n; k++) {
+      elstat_tail_row(tail_begin + k * tail_step, dp_kappa, cut, tail_tab + 6 * k);
+      for (i = 0; i < 3; i++)
+	scale[i] = MAX(scale[i], fabs(tail_tab[6 * k + 2 * i]));
+    }
+    tail_len = n;
+
+    /* compare with the exact tail halfway between the grid points */
+    for (ok = 1, k = 0; ok && k < n; k++) {
+      r = tail_begin + (k + 0.5) * tail_step;
+      elstat_tail_row(r, dp_kappa, cut, row);
+      elstat_tail(r, val, val + 1, val + 2);
+      for (i = 0; i < 3; i++)
+	if (fabs(val[i] - row[2 * i]) > dp_tail_tol * scale[i])
+	  ok = 0;
+    }
+    if (ok || n >= TAIL_MAXLEN)
+      break;
+  }
+
+  return;
+}
+
+/****************************************************************
+ *
+ * shifted tail of the coulomb potential from the table
+ *
+ ****************************************************************/
+
+void elstat_tail(double r, double *fnval_tail, double *grad_tail, double *ggrad_tail)
+{
+  int   k;
+  double t, h[4], *p;
+
+  if (r >= dp_cut) {
+    *fnval_tail = 0.;
+    *grad_tail = 0.;
+    *ggrad_tail = 0.;
+    return;
+  }
+
+  /* distances below the table are evaluated directly */
+  if (0 == tail_len || r < tail_begin) {
+    elstat_shift(r, tail_kappa_tab, fnval_tail, grad_tail, ggrad_tail);
+    return;
+  }
+
+  t = (r - tail_begin) / tail_step;
+  k = MIN((int)t, tail_len - 1);
+  t -= k;
+  p = tail_tab + 6 * k;
+
+  /* cubic Hermite basis */
+  h[0] = (1 + 2 * t) * (1 - t) * (1 - t);
+  h[1] = t * (1 - t) * (1 - t) * tail_step;
+  h[2] = t * t * (3 - 2 * t);
+  h[3] = t * t * (t - 1) * tail_step;
+
+  *fnval_tail = h[0] * p[0] + h[1] * p[1] + h[2] * p[6] + h[3] * p[7];
+  *grad_tail = h[0] * p[2] + h[1] * p[3] + h[2] * p[8] + h[3] * p[9];
+  *ggrad_tail = h[0] * p[4] + h[1] * p[5] + h[2] * p[10] + h[3] * p[11];
+
+  return;
+}
+
 #endif /* COULOMB */
 
 #ifdef DIPOLE
@@ -1328,7 +1800,7 @@ void elstat_shift(double r, double dp_kappa, double *fnval_tail, double *grad_ta
 
 double shortrange_value(double r, double a, double b, double c)
 {
-  static double x[5];
+  double x[5];
 
   x[0] = b * r;
   x[1] = x[0] * x[0];
@@ -1347,7 +1819,7 @@ double shortrange_value(double r, double a, double b, double c)
 
 void shortrange_term(double r, double b, double c, double *srval_tail, double *srgrad_tail)
 {
-  static double x[6];
+  double x[6];
 
   x[0] = b * r;
   x[1] = x[0] * x[0];
@@ -1362,6 +1834,215 @@ void shortrange_term(double r, double b, double c, double *srval_tail, double *s
   return;
 }
 
+/****************************************************************
+ *
+ * dipole_iteration: self-consistent induced dipoles of configuration h
+ *
+ *	p = alpha * (E_stat + E_ind(p)) + p_sr is solved as a fixed point
+ *	problem with Anderson mixing of the last dp_hist iterations,
+ *	dp_hist = 0 is simple linear mixing with the parameter dp_mix.
+ *	The dipoles of the previous call are used as starting point.
+ *	Returns the number of iterations.
+ *
+ ****************************************************************/
+
+/* mixing history and linear system, allocated once by each thread
+   for the largest configuration */
+static double *dp_buf = NULL;
+#ifdef _OPENMP
+#pragma omp threadprivate(dp_buf)
+#endif /* _OPENMP */
+
+int dipole_iteration(int h, double *dp_alpha)
+{
+  int   i, j, k, l, n, m, p, it = 0, nhist = 0, slot = 0;
+  double beta = 1.0 - dp_mix, res, rp, tmp, scale;
+  double max_diff = 10;
+  double *x, *g, *f, *f_old, *g_old, *df, *dg, *mat, *gam;
+  atom_t *atom, *atom_j;
+  neigh_t *neigh;
+
+  if (NULL == dp_buf) {
+    for (n = 0, i = 0; i < nconf; i++)
+      n = MAX(n, 3 * inconf[i]);
+    dp_buf = (double *)malloc(((5 + 2 * dp_hist) * n + dp_hist * (dp_hist + 1)) * sizeof(double));
+    if (NULL == dp_buf)
+      error(1, "Cannot allocate memory for the dipole iteration");
+#ifdef _OPENMP
+#pragma omp critical
+#endif /* _OPENMP */
+    reg_for_free(dp_buf, "dp_buf");
+  }
+
+  n = 3 * inconf[h];
+  x = dp_buf;
+  g = x + n;
+  f = g + n;
+  f_old = f + n;
+  g_old = f_old + n;
+  df = g_old + n;
+  dg = df + dp_hist * n;
+  mat = dg + dp_hist * n;
+  gam = mat + dp_hist * dp_hist;
+
+  /* start with the dipoles of the previous call */
+  for (i = 0; i < inconf[h]; i++) {
+    atom = conf_atoms + i + cnfstart[h] - firstatom;
+    x[3 * i + 0] = atom->p_ind.x;
+    x[3 * i + 1] = atom->p_ind.y;
+    x[3 * i + 2] = atom->p_ind.z;
+  }
+
+  while (1) {
+    /* induced field of the current dipoles */
+    for (i = 0; i < inconf[h]; i++) {
+      atom = conf_atoms + i + cnfstart[h] - firstatom;
+      atom->p_ind.x = x[3 * i + 0];
+      atom->p_ind.y = x[3 * i + 1];
+      atom->p_ind.z = x[3 * i + 2];
+      atom->E_ind.x = 0.0;
+      atom->E_ind.y = 0.0;
+      atom->E_ind.z = 0.0;
+    }
+    for (i = 0; i < inconf[h]; i++) {
+      atom = conf_atoms + i + cnfstart[h] - firstatom;
+      for (j = 0; j < atom->num_neigh; j++) {
+	neigh = atom->neigh + j;
+	if (neigh->r < dp_cut && dp_alpha[atom->type] && dp_alpha[neigh->type]) {
+	  atom_j = conf_atoms + neigh->nr - firstatom;
+	  rp = SPROD(atom_j->p_ind, neigh->dist_r);
+	  atom->E_ind.x += neigh->grad_el * (3 * rp * neigh->dist_r.x - atom_j->p_ind.x);
+	  atom->E_ind.y += neigh->grad_el * (3 * rp * neigh->dist_r.y - atom_j->p_ind.y);
+	  atom->E_ind.z += neigh->grad_el * (3 * rp * neigh->dist_r.z - atom_j->p_ind.z);
+	  /* In small cells, an atom might interact with itself */
+	  if (atom_j != atom) {
+	    rp = SPROD(atom->p_ind, neigh->dist_r);
+	    atom_j->E_ind.x += neigh->grad_el * (3 * rp * neigh->dist_r.x - atom->p_ind.x);
+	    atom_j->E_ind.y += neigh->grad_el * (3 * rp * neigh->dist_r.y - atom->p_ind.y);
+	    atom_j->E_ind.z += neigh->grad_el * (3 * rp * neigh->dist_r.z - atom->p_ind.z);
+	  }
+	}
+      }
+    }
+
+    /* new dipoles and residual */
+    res = 0.0;
+    for (i = 0; i < inconf[h]; i++) {
+      atom = conf_atoms + i + cnfstart[h] - firstatom;
+      if (dp_alpha[atom->type]) {
+	g[3 * i + 0] = dp_alpha[atom->type] * (atom->E_stat.x + atom->E_ind.x) + atom->p_sr.x;
+	g[3 * i + 1] = dp_alpha[atom->type] * (atom->E_stat.y + atom->E_ind.y) + atom->p_sr.y;
+	g[3 * i + 2] = dp_alpha[atom->type] * (atom->E_stat.z + atom->E_ind.z) + atom->p_sr.z;
+      } else {
+	g[3 * i + 0] = x[3 * i + 0];
+	g[3 * i + 1] = x[3 * i + 1];
+	g[3 * i + 2] = x[3 * i + 2];
+      }
+    }
+    for (k = 0; k < n; k++) {
+      f[k] = g[k] - x[k];
+      res += dsquare(f[k]);
+    }
+    res = sqrt(res / n);
+    it++;
+
+    if (res < dp_tol) {
+      memcpy(x, g, n * sizeof(double));
+      break;
+    }
+
+    /* no convergence: use the dipoles of the static field */
+    if ((it > 1 && res > max_diff) || it > 50) {
+      for (i = 0; i < inconf[h]; i++) {
+	atom = conf_atoms + i + cnfstart[h] - firstatom;
+	if (dp_alpha[atom->type]) {
+	  x[3 * i + 0] = dp_alpha[atom->type] * atom->E_stat.x + atom->p_sr.x;
+	  x[3 * i + 1] = dp_alpha[atom->type] * atom->E_stat.y + atom->p_sr.y;
+	  x[3 * i + 2] = dp_alpha[atom->type] * atom->E_stat.z + atom->p_sr.z;
+	  atom->E_ind.x = atom->E_stat.x;
+	  atom->E_ind.y = atom->E_stat.y;
+	  atom->E_ind.z = atom->E_stat.z;
+	}
+      }
+      break;
+    }
+
+    /* store the differences to the previous iteration */
+    if (dp_hist > 0 && it > 1) {
+      for (k = 0; k < n; k++) {
+	df[slot * n + k] = f[k] - f_old[k];
+	dg[slot * n + k] = g[k] - g_old[k];
+      }
+      slot = (slot + 1) % dp_hist;
+      nhist = MIN(nhist + 1, dp_hist);
+    }
+    memcpy(f_old, f, n * sizeof(double));
+    memcpy(g_old, g, n * sizeof(double));
+
+    /* least squares coefficients of the history: (dF^T dF) gam = dF^T f */
+    m = nhist;
+    for (j = 0; j < m; j++) {
+      for (l = j; l < m; l++) {
+	for (tmp = 0.0, k = 0; k < n; k++)
+	  tmp += df[j * n + k] * df[l * n + k];
+	mat[j * m + l] = mat[l * m + j] = tmp;
+      }
+      for (gam[j] = 0.0, k = 0; k < n; k++)
+	gam[j] += df[j * n + k] * f[k];
+    }
+    /* Gaussian elimination, the history is dropped if it is degenerate */
+    for (scale = 0.0, j = 0; j < m; j++)
+      scale = MAX(scale, mat[j * m + j]);
+    for (j = 0; j < m; j++) {
+      for (p = j, l = j + 1; l < m; l++)
+	if (fabs(mat[l * m + j]) > fabs(mat[p * m + j]))
+	  p = l;
+      if (fabs(mat[p * m + j]) <= 1e-12 * scale) {
+	m = nhist = slot = 0;
+	break;
+      }
+      if (p != j) {
+	for (l = 0; l < m; l++) {
+	  tmp = mat[j * m + l];
+	  mat[j * m + l] = mat[p * m + l];
+	  mat[p * m + l] = tmp;
+	}
+	tmp = gam[j];
+	gam[j] = gam[p];
+	gam[p] = tmp;
+      }
+      for (l = j + 1; l < m; l++) {
+	tmp = mat[l * m + j] / mat[j * m + j];
+	for (k = j; k < m; k++)
+	  mat[l * m + k] -= tmp * mat[j * m + k];
+	gam[l] -= tmp * gam[j];
+      }
+    }
+    for (j = m - 1; j >= 0; j--) {
+      for (l = j + 1; l < m; l++)
+	gam[j] -= mat[j * m + l] * gam[l];
+      gam[j] /= mat[j * m + j];
+    }
+
+    /* mixed step, corrected by the history */
+    for (k = 0; k < n; k++) {
+      tmp = x[k] + beta * f[k];
+      for (j = 0; j < m; j++)
+	tmp -= gam[j] * (dg[j * n + k] - (1.0 - beta) * df[j * n + k]);
+      x[k] = tmp;
+    }
+  }
+
+  for (i = 0; i < inconf[h]; i++) {
+    atom = conf_atoms + i + cnfstart[h] - firstatom;
+    atom->p_ind.x = x[3 * i + 0];
+    atom->p_ind.y = x[3 * i + 1];
+    atom->p_ind.z = x[3 * i + 2];
+  }
+
+  return it;
+}
+
 #endif /* DIPOLE */
 
 /****************************************************************
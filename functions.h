@@ -82,6 +82,22 @@ void  tersoff_pot_value(double, double *, double *);
 void  tersoff_mix_value(double, double *, double *);
 #endif /* TERSOFF */
 
+/* analytic derivatives with respect to r and the parameters */
+#define APOT_GRAD_PAR 16	/* maximum number of parameters */
+
+void  lj_grad(double, double *, double *, double *);
+void  eopp_grad(double, double *, double *, double *);
+void  morse_grad(double, double *, double *, double *);
+void  buck_grad(double, double *, double *, double *);
+void  softshell_grad(double, double *, double *, double *);
+void  power_grad(double, double *, double *, double *);
+void  power_decay_grad(double, double *, double *, double *);
+void  exp_decay_grad(double, double *, double *, double *);
+void  parabola_grad(double, double *, double *, double *);
+void  const_grad(double, double *, double *, double *);
+void  sqrt_grad(double, double *, double *, double *);
+void  mexp_decay_grad(double, double *, double *, double *);
+
 /* template for new potential function called newpot */
 
 /* "newpot" potential */
@@ -92,11 +108,13 @@ void  newpot_value(double, double *, double *);
 /* functions for analytic potential initialization */
 void  apot_init(void);
 void  add_potential(char *, int, fvalue_pointer);
+void  add_gradient(char *, fgrad_pointer);
 int   apot_assign_functions(apot_table_t *);
 int   apot_check_params(double *);
 int   apot_parameters(char *);
 void  check_apot_functions(void);
 double apot_grad(double, double *, void (*function) (double, double *, double *));
+int   apot_dtable(double *, int, double, double *);
 double apot_punish(double *, double *);
 double cutoff(double, double, double);
 
@@ -123,10 +141,13 @@ void  ms_shift(double, double *, double *);
 void  buck_shift(double, double *, double *);
 void  elstat_value(double, double, double *, double *, double *);
 void  elstat_shift(double, double, double *, double *, double *);
+void  elstat_table(double);
+void  elstat_tail(double, double *, double *, double *);
 #endif /* COULOMB */
 #ifdef DIPOLE
 double shortrange_value(double, double, double, double);
 void  shortrange_term(double, double, double, double *, double *);
+int   dipole_iteration(int, double *);
 #endif /* DIPOLE */
 
 #endif /* FUNCTIONS_H */
@@ -32,6 +32,7 @@
 
 #include "potfit.h"
 
+#include "config.h"
 #include "utils.h"
 
 /****************************************************************
@@ -43,10 +44,26 @@
 void init_mpi(int argc, char **argv)
 {
   /* Initialize MPI */
+#ifdef _OPENMP
+  int   provided;
+
+  /* only the master thread of each process communicates */
+  if (MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided) != MPI_SUCCESS && myid == 0)
+    fprintf(stderr, "MPI_Init_thread failed!\n");
+#else
   if (MPI_Init(&argc, &argv) != MPI_SUCCESS && myid == 0)
     fprintf(stderr, "MPI_Init failed!\n");
+#endif /* _OPENMP */
   MPI_Comm_size(MPI_COMM_WORLD, &num_cpus);
   MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+#ifdef _OPENMP
+  /* the loops over configurations run OpenMP threads between MPI calls */
+  if (provided < MPI_THREAD_FUNNELED) {
+    if (0 == myid)
+      warning(1, "The MPI library does not support threads, using a single OpenMP thread.\n");
+    omp_set_num_threads(1);
+  }
+#endif /* _OPENMP */
 }
 
 
@@ -68,6 +85,155 @@ void shutdown_mpi(void)
   MPI_Finalize();		/* Shutdown */
 }
 
+/****************************************************************
+ *
+ * fill_partition: Assign contiguous blocks of configurations with
+ *	a total cost of at most maxload to the processes, leaving
+ *	at least one configuration for each of the remaining
+ *	processes. Returns 1 if all configurations could be placed.
+ *
+ ****************************************************************/
+
+static int fill_partition(double *cost, double maxload)
+{
+  int   h = 0, p;
+  double load;
+
+  for (p = 0; p < num_cpus; p++) {
+    conf_dist[p] = h;
+    load = 0.0;
+    while (h < nconf && load + cost[h] <= maxload && nconf - h > num_cpus - 1 - p)
+      load += cost[h++];
+    conf_len[p] = h - conf_dist[p];
+  }
+
+  return (h == nconf);
+}
+
+/****************************************************************
+ *
+ * set_atom_dist: Atoms of the processes from conf_dist and conf_len
+ *
+ ****************************************************************/
+
+static void set_atom_dist(void)
+{
+  int   h, i;
+
+  for (i = 0; i < num_cpus; i++) {
+    atom_dist[i] = (conf_dist[i] < nconf) ? cnfstart[conf_dist[i]] : natoms;
+    atom_len[i] = 0;
+    for (h = conf_dist[i]; h < conf_dist[i] + conf_len[i]; h++)
+      atom_len[i] += inconf[h];
+  }
+
+  return;
+}
+
+/****************************************************************
+ *
+ * load_ratio: Ratio of the largest to the average load of the
+ *	processes, if configuration h costs cost[h]
+ *
+ ****************************************************************/
+
+static double load_ratio(double *cost)
+{
+  int   h, i;
+  double load, maxload = 0.0, total = 0.0;
+
+  for (i = 0; i < num_cpus; i++) {
+    load = 0.0;
+    for (h = conf_dist[i]; h < conf_dist[i] + conf_len[i]; h++)
+      load += cost[h];
+    maxload = MAX(maxload, load);
+    total += load;
+  }
+
+  return (total > 0.0) ? maxload * num_cpus / total : 1.0;
+}
+
+static int cmp_cost(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/****************************************************************
+ *
+ * best_ratio: Lower bound of load_ratio() for any distribution.
+ *	No process can be faster than its most expensive configuration,
+ *	and one process gets at least nconf / num_cpus configurations,
+ *	which cost no less than the same number of the cheapest ones.
+ *
+ ****************************************************************/
+
+static double best_ratio(double *cost)
+{
+  static double *sorted = NULL;
+  int   h, k;
+  double least = 0.0, total = 0.0;
+
+  if (NULL == sorted) {
+    sorted = (double *)malloc(MAX(nconf, 1) * sizeof(double));
+    if (NULL == sorted)
+      error(1, "Cannot allocate memory for the load balancing");
+    reg_for_free(sorted, "sorted configuration timings");
+  }
+
+  for (h = 0; h < nconf; h++) {
+    sorted[h] = cost[h];
+    total += cost[h];
+  }
+  qsort(sorted, nconf, sizeof(double), cmp_cost);
+
+  k = (nconf + num_cpus - 1) / num_cpus;
+  for (h = 0; h < k; h++)
+    least += sorted[h];
+  if (nconf > 0)
+    least = MAX(least, sorted[nconf - 1]);
+
+  return (total > 0.0) ? MAX(1.0, least * num_cpus / total) : 1.0;
+}
+
+/****************************************************************
+ *
+ * partition_configs: Distribute the configurations to the processes
+ *	such that the largest sum of cost[] on one process is minimal.
+ *	The configurations of each process stay contiguous, which the
+ *	offsets firstconf and firstatom rely on. Only called by root.
+ *	Returns the ratio of the largest to the average load.
+ *
+ ****************************************************************/
+
+static double partition_configs(double *cost)
+{
+  int   h, i;
+  double lo = 0.0, hi = 0.0, mid;
+
+  for (h = 0; h < nconf; h++) {
+    lo = MAX(lo, cost[h]);
+    hi += cost[h];
+  }
+
+  /* bisection for the smallest feasible load of a single process */
+  for (i = 0; i < 64 && lo < hi; i++) {
+    mid = 0.5 * (lo + hi);
+    if (mid <= lo || mid >= hi)
+      break;
+    if (fill_partition(cost, mid))
+      hi = mid;
+    else
+      lo = mid;
+  }
+  fill_partition(cost, hi);
+  set_atom_dist();
+
+  return load_ratio(cost);
+}
+
 /****************************************************************
  *
  * broadcast_param: Broadcast parameters etc to other nodes
@@ -86,7 +252,9 @@ void broadcast_params()
   angl  testangl;
 #endif /* THREEBODY */
   atom_t testatom;
-  int   calclen, size, i, each, odd, count;
+  MPI_Datatype tmptype;
+  double *cost;
+  int   calclen, size, i, count;
 #ifdef APOT
   int   j;
 #endif /* APOT */
@@ -182,8 +350,11 @@ void broadcast_params()
   }
   displs[0] = 0;
 
-  MPI_Type_create_struct(size, blklens, displs, typen, &MPI_NEIGH);
+  /* the extent has to match the structure for sending arrays */
+  MPI_Type_create_struct(size, blklens, displs, typen, &tmptype);
+  MPI_Type_create_resized(tmptype, 0, sizeof(neigh_t), &MPI_NEIGH);
   MPI_Type_commit(&MPI_NEIGH);
+  MPI_Type_free(&tmptype);
 
 #ifdef THREEBODY
   /* MPI_ANGL */
@@ -215,8 +386,10 @@ void broadcast_params()
   }
   displs[0] = 0;
 
-  MPI_Type_struct(size, blklens, displs, typen, &MPI_ANGL);
+  MPI_Type_create_struct(size, blklens, displs, typen, &tmptype);
+  MPI_Type_create_resized(tmptype, 0, sizeof(angl), &MPI_ANGL);
   MPI_Type_commit(&MPI_ANGL);
+  MPI_Type_free(&tmptype);
 #endif /* THREEBODY */
 
   /* MPI_ATOM */
@@ -245,8 +418,6 @@ void broadcast_params()
   blklens[size] = 1;         	typen[size++] = MPI_VECTOR;   	/* p_sr */
   blklens[size] = 1;         	typen[size++] = MPI_VECTOR;   	/* E_ind */
   blklens[size] = 1;         	typen[size++] = MPI_VECTOR;   	/* p_ind */
-  blklens[size] = 1;        	typen[size++] = MPI_VECTOR;   	/* E_old */
-  blklens[size] = 1;        	typen[size++] = MPI_VECTOR;   	/* E_tot */
 #endif /* DIPOLE */
 #ifdef THREEBODY
   blklens[size] = 1;         	typen[size++] = MPI_INT;    	/* num_angl */
@@ -282,8 +453,6 @@ void broadcast_params()
   MPI_Address(&testatom.p_sr, 		&displs[count++]);
   MPI_Address(&testatom.E_ind, 		&displs[count++]);
   MPI_Address(&testatom.p_ind, 		&displs[count++]);
-  MPI_Address(&testatom.E_old, 		&displs[count++]);
-  MPI_Address(&testatom.E_tot, 		&displs[count++]);
 #endif /* DIPOLE */
 #ifdef THREEBODY
   MPI_Address(&testatom.num_angl, 	&displs[count++]);
@@ -300,8 +469,10 @@ void broadcast_params()
   }
   displs[0] = 0;
 
-  MPI_Type_create_struct(size, blklens, displs, typen, &MPI_ATOM);
+  MPI_Type_create_struct(size, blklens, displs, typen, &tmptype);
+  MPI_Type_create_resized(tmptype, 0, sizeof(atom_t), &MPI_ATOM);
   MPI_Type_commit(&MPI_ATOM);
+  MPI_Type_free(&tmptype);
 
   /* Distribute fundamental parameters */
   MPI_Bcast(&mdim, 1, MPI_INT, 0, MPI_COMM_WORLD);
@@ -309,12 +480,19 @@ void broadcast_params()
   MPI_Bcast(&natoms, 1, MPI_INT, 0, MPI_COMM_WORLD);
   MPI_Bcast(&nconf, 1, MPI_INT, 0, MPI_COMM_WORLD);
   MPI_Bcast(&opt, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&profile, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&balance_steps, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&balance_threshold, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 #ifdef COULOMB
   MPI_Bcast(&dp_cut, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&dp_tail_tol, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&ewald, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&ewald_tol, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 #endif /* COULOMB */
 #ifdef DIPOLE
   MPI_Bcast(&dp_tol, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
   MPI_Bcast(&dp_mix, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&dp_hist, 1, MPI_INT, 0, MPI_COMM_WORLD);
 #endif /* DIPOLE */
   if (myid > 0) {
     inconf = (int *)malloc(nconf * sizeof(int));
@@ -325,11 +503,18 @@ void broadcast_params()
     reg_for_free(cnfstart, "cnfstart");
     reg_for_free(force_0, "force_0");
     reg_for_free(conf_weight, "conf_weight");
+#ifdef COULOMB
+    boxes = (vector *)malloc(3 * nconf * sizeof(vector));
+    reg_for_free(boxes, "boxes");
+#endif /* COULOMB */
   }
   MPI_Bcast(inconf, nconf, MPI_INT, 0, MPI_COMM_WORLD);
   MPI_Bcast(cnfstart, nconf, MPI_INT, 0, MPI_COMM_WORLD);
   MPI_Bcast(force_0, mdim, MPI_DOUBLE, 0, MPI_COMM_WORLD);
   MPI_Bcast(conf_weight, nconf, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#ifdef COULOMB
+  MPI_Bcast(boxes, 9 * nconf, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#endif /* COULOMB */
   MPI_Bcast(&maxneigh, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
   /* Broadcast weights... */
@@ -405,6 +590,7 @@ void broadcast_params()
     rcut = (double *)malloc(ntypes * ntypes * sizeof(double));
     rmin = (double *)malloc(ntypes * ntypes * sizeof(double));
     apot_table.fvalue = (fvalue_pointer *) malloc(apot_table.number * sizeof(fvalue_pointer));
+    apot_table.fgrad = (fgrad_pointer *) malloc(apot_table.number * sizeof(fgrad_pointer));
     opt_pot.table = (double *)malloc(opt_pot.len * sizeof(double));
     opt_pot.first = (int *)malloc(apot_table.number * sizeof(int));
     reg_for_free(calc_list, "calc_list");
@@ -420,9 +606,19 @@ void broadcast_params()
     reg_for_free(rcut, "rcut");
     reg_for_free(rmin, "rmin");
     reg_for_free(apot_table.fvalue, "apot_table.fvalue");
+    reg_for_free(apot_table.fgrad, "apot_table.fgrad");
     reg_for_free(opt_pot.table, "opt_pot.first");
     reg_for_free(opt_pot.first, "opt_pot.first");
+    /* the names are needed by apot_check_params */
+    apot_table.names = (char **)malloc(apot_table.number * sizeof(char *));
+    reg_for_free(apot_table.names, "apot_table.names");
+    for (i = 0; i < apot_table.number; i++) {
+      apot_table.names[i] = (char *)malloc(20 * sizeof(char));
+      reg_for_free(apot_table.names[i], "apot_table.names[%d]", i);
+    }
   }
+  for (i = 0; i < apot_table.number; i++)
+    MPI_Bcast(apot_table.names[i], 20, MPI_CHAR, 0, MPI_COMM_WORLD);
   MPI_Bcast(smooth_pot, apot_table.number, MPI_INT, 0, MPI_COMM_WORLD);
   MPI_Bcast(invar_pot, apot_table.number, MPI_INT, 0, MPI_COMM_WORLD);
   MPI_Bcast(calc_list, opt_pot.len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
@@ -430,6 +626,7 @@ void broadcast_params()
   MPI_Bcast(rcut, ntypes * ntypes, MPI_DOUBLE, 0, MPI_COMM_WORLD);
   MPI_Bcast(rmin, ntypes * ntypes, MPI_DOUBLE, 0, MPI_COMM_WORLD);
   MPI_Bcast(apot_table.fvalue, apot_table.number, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(apot_table.fgrad, apot_table.number, MPI_DOUBLE, 0, MPI_COMM_WORLD);
   MPI_Bcast(apot_table.end, apot_table.number, MPI_DOUBLE, 0, MPI_COMM_WORLD);
   MPI_Bcast(apot_table.begin, apot_table.number, MPI_DOUBLE, 0, MPI_COMM_WORLD);
   MPI_Bcast(apot_table.idxpot, apot_table.number, MPI_INT, 0, MPI_COMM_WORLD);
@@ -469,25 +666,28 @@ void broadcast_params()
 #endif /* APOT */
 
   /* Distribute configurations */
-  /* Each node: nconf/num_cpus configurations.
-     Last nconf%num_cpus nodes: 1 additional config */
-  each = (nconf / num_cpus);
-  odd = (nconf % num_cpus) - num_cpus;
+  /* The cost of a configuration is estimated from the number of
+     atoms, neighbors and angles, which dominate calc_forces */
   if (myid == 0) {
     atom_len = (int *)malloc(num_cpus * sizeof(int));
     atom_dist = (int *)malloc(num_cpus * sizeof(int));
     conf_len = (int *)malloc(num_cpus * sizeof(int));
     conf_dist = (int *)malloc(num_cpus * sizeof(int));
-    for (i = 0; i < num_cpus; i++)
-      conf_dist[i] = i * each + (((i + odd) > 0) ? (i + odd) : 0);
-    for (i = 0; i < num_cpus - 1; i++)
-      conf_len[i] = conf_dist[i + 1] - conf_dist[i];
-    conf_len[num_cpus - 1] = nconf - conf_dist[num_cpus - 1];
-    for (i = 0; i < num_cpus; i++)
-      atom_dist[i] = cnfstart[i * each + (((i + odd) > 0) ? (i + odd) : 0)];
-    for (i = 0; i < num_cpus - 1; i++)
-      atom_len[i] = atom_dist[i + 1] - atom_dist[i];
-    atom_len[num_cpus - 1] = natoms - atom_dist[num_cpus - 1];
+    cost = (double *)malloc(MAX(nconf, 1) * sizeof(double));
+    if (NULL == atom_len || NULL == atom_dist || NULL == conf_len || NULL == conf_dist || NULL == cost)
+      error(1, "Cannot allocate memory for the distribution of configurations");
+    for (i = 0; i < nconf; i++) {
+      cost[i] = inconf[i];
+      for (count = cnfstart[i]; count < cnfstart[i] + inconf[i]; count++) {
+	cost[i] += atoms[count].num_neigh;
+#ifdef THREEBODY
+	cost[i] += atoms[count].num_angl;
+#endif /* THREEBODY */
+      }
+    }
+    printf("Distributed %d configurations to %d processes, largest load %.1f%% of the average.\n", nconf,
+      num_cpus, 100.0 * partition_configs(cost));
+    free(cost);
     reg_for_free(atom_len, "atom_len");
     reg_for_free(atom_dist, "atom_dist");
     reg_for_free(conf_len, "conf_len");
@@ -497,16 +697,11 @@ void broadcast_params()
   MPI_Scatter(atom_dist, 1, MPI_INT, &firstatom, 1, MPI_INT, 0, MPI_COMM_WORLD);
   MPI_Scatter(conf_len, 1, MPI_INT, &myconf, 1, MPI_INT, 0, MPI_COMM_WORLD);
   MPI_Scatter(conf_dist, 1, MPI_INT, &firstconf, 1, MPI_INT, 0, MPI_COMM_WORLD);
-  /* this broadcasts all atoms */
-  conf_atoms = (atom_t *)malloc(myatoms * sizeof(atom_t));
-  for (i = 0; i < natoms; i++) {
-    if (myid == 0)
-      testatom = atoms[i];
-    MPI_Bcast(&testatom, 1, MPI_ATOM, 0, MPI_COMM_WORLD);
-    if (i >= firstatom && i < (firstatom + myatoms)) {
-      conf_atoms[i - firstatom] = testatom;
-    }
-  }
+  /* every process only receives its own atoms */
+  conf_atoms = (atom_t *)malloc(MAX(myatoms, 1) * sizeof(atom_t));
+  if (NULL == conf_atoms)
+    error(1, "Cannot allocate memory for the local atoms");
+  MPI_Scatterv(atoms, atom_len, atom_dist, MPI_ATOM, conf_atoms, myatoms, MPI_ATOM, 0, MPI_COMM_WORLD);
   broadcast_neighbors();
 #ifdef THREEBODY
   broadcast_angles();
@@ -522,75 +717,402 @@ void broadcast_params()
   reg_for_free(conf_uf, "conf_uf");
   reg_for_free(conf_us, "conf_us");
   reg_for_free(conf_atoms, "conf_atoms");
+
+  conf_time = (double *)calloc(MAX(myconf, 1), sizeof(double));
+  if (NULL == conf_time)
+    error(1, "Cannot allocate memory for the timings of the configurations");
+  reg_for_free(conf_time, "conf_time");
 }
 
 /****************************************************************
  *
- * scatter dynamic neighbor table
+ * scatter dynamic neighbor table: each process receives the
+ *	neighbors of its own configurations, one message per
+ *	configuration, and keeps them in one block per configuration
+ *	like read_config() does. Afterwards the root process only
+ *	keeps the full neighbor table if the MEAM rescale() needs it.
  *
  ****************************************************************/
 
 void broadcast_neighbors()
 {
-  int   i, j, neighs;
-  neigh_t neigh;
-  atom_t *atom;
-
-  for (i = 0; i < natoms; i++) {
-    atom = conf_atoms + i - firstatom;
-    if (myid == 0)
-      neighs = atoms[i].num_neigh;
-    MPI_Bcast(&neighs, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    if (i >= firstatom && i < (firstatom + myatoms)) {
-      atom->neigh = (neigh_t *)malloc(neighs * sizeof(neigh_t));
-      reg_for_free(atom->neigh, "broadcast atom[%d]->neigh", i);
-    }
-    for (j = 0; j < neighs; j++) {
-      if (myid == 0)
-	neigh = atoms[i].neigh[j];
-      MPI_Bcast(&neigh, 1, MPI_NEIGH, 0, MPI_COMM_WORLD);
-      if (i >= firstatom && i < (firstatom + myatoms)) {
-	atom->neigh[j] = neigh;
+  int   h, i, n, p, first;
+  neigh_t *block;
+  MPI_Status status;
+
+  if (0 == myid) {
+    for (p = 1; p < num_cpus; p++)
+      for (h = conf_dist[p]; h < conf_dist[p] + conf_len[p]; h++) {
+	for (n = 0, i = cnfstart[h]; i < cnfstart[h] + inconf[h]; i++)
+	  n += atoms[i].num_neigh;
+	MPI_Send(atoms[cnfstart[h]].neigh, n, MPI_NEIGH, p, h, MPI_COMM_WORLD);
       }
+  }
+
+  for (h = firstconf; h < firstconf + myconf; h++) {
+    first = cnfstart[h] - firstatom;
+    for (n = 0, i = first; i < first + inconf[h]; i++)
+      n += conf_atoms[i].num_neigh;
+    block = (neigh_t *)malloc(MAX(n, 1) * sizeof(neigh_t));
+    if (NULL == block)
+      error(1, "Cannot allocate memory for neighbor table of configuration %d", h);
+#ifndef NEIGH_TABLE
+    /* with NEIGH_TABLE it is released by pack_neighbors() */
+    reg_for_free(block, "local neighbor table configuration %d", h);
+#endif /* !NEIGH_TABLE */
+    if (0 == myid)
+      memcpy(block, atoms[cnfstart[h]].neigh, n * sizeof(neigh_t));
+    else
+      MPI_Recv(block, n, MPI_NEIGH, 0, h, MPI_COMM_WORLD, &status);
+    for (i = first; i < first + inconf[h]; i++) {
+      conf_atoms[i].neigh = block;
+      block += conf_atoms[i].num_neigh;
     }
   }
+
+  /* only the MEAM rescale() works on the neighbor table of the full atoms array */
+  if (0 == myid) {
+    for (h = 0; h < nconf; h++) {
+#if defined MEAM && !defined APOT && !defined NORESCALE
+      reg_for_free(atoms[cnfstart[h]].neigh, "neighbor table configuration %d", h);
+#else
+      free(atoms[cnfstart[h]].neigh);
+#endif /* MEAM && !APOT && !NORESCALE */
+    }
+#if !defined MEAM || defined APOT || defined NORESCALE
+    for (i = 0; i < natoms; i++)
+      atoms[i].neigh = NULL;
+#endif /* !MEAM || APOT || NORESCALE */
+  }
+
+  return;
 }
 
 #ifdef THREEBODY
 
 /***************************************************************************
  *
- * scatter dynamic angle table
+ * scatter dynamic angle table, see broadcast_neighbors()
  *
  **************************************************************************/
 
 void broadcast_angles()
 {
-  int   i, j, nangles;
-  angl  angle;
-  atom_t *atom;
-
-  for (i = 0; i < natoms; ++i) {
-    atom = conf_atoms + i - firstatom;
-    if (myid == 0)
-      nangles = atoms[i].num_angl;
-    MPI_Bcast(&nangles, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    if (i >= firstatom && i < (firstatom + myatoms)) {
-      atom->angl_part = (angl *) malloc(nangles * sizeof(angl));
-      reg_for_free(atom->angl_part, "broadcast atom[%d]->angle_part", i);
-    }
-    for (j = 0; j < nangles; ++j) {
-      if (myid == 0)
-	angle = atoms[i].angl_part[j];
-      MPI_Bcast(&angle, 1, MPI_ANGL, 0, MPI_COMM_WORLD);
-      if (i >= firstatom && i < (firstatom + myatoms)) {
-	atom->angl_part[j] = angle;
+  int   h, i, n, p, first;
+  angl *block;
+  MPI_Status status;
+
+  if (0 == myid) {
+    for (p = 1; p < num_cpus; p++)
+      for (h = conf_dist[p]; h < conf_dist[p] + conf_len[p]; h++) {
+	for (n = 0, i = cnfstart[h]; i < cnfstart[h] + inconf[h]; i++)
+	  n += atoms[i].num_angl;
+	MPI_Send(atoms[cnfstart[h]].angl_part, n, MPI_ANGL, p, h, MPI_COMM_WORLD);
       }
+  }
+
+  for (h = firstconf; h < firstconf + myconf; h++) {
+    first = cnfstart[h] - firstatom;
+    for (n = 0, i = first; i < first + inconf[h]; i++)
+      n += conf_atoms[i].num_angl;
+    block = (angl *) malloc(MAX(n, 1) * sizeof(angl));
+    if (NULL == block)
+      error(1, "Cannot allocate memory for angular part of configuration %d", h);
+    reg_for_free(block, "local angular part configuration %d", h);
+    if (0 == myid)
+      memcpy(block, atoms[cnfstart[h]].angl_part, n * sizeof(angl));
+    else
+      MPI_Recv(block, n, MPI_ANGL, 0, h, MPI_COMM_WORLD, &status);
+    for (i = first; i < first + inconf[h]; i++) {
+      conf_atoms[i].angl_part = block;
+      block += conf_atoms[i].num_angl;
+    }
+  }
+
+  if (0 == myid) {
+    for (h = 0; h < nconf; h++) {
+#if defined PAIR || defined APOT || defined NORESCALE
+      free(atoms[cnfstart[h]].angl_part);
+#else
+      reg_for_free(atoms[cnfstart[h]].angl_part, "angular part configuration %d", h);
+#endif /* PAIR || APOT || NORESCALE */
     }
+#if defined PAIR || defined APOT || defined NORESCALE
+    for (i = 0; i < natoms; i++)
+      atoms[i].angl_part = NULL;
+#endif /* PAIR || APOT || NORESCALE */
   }
+
+  return;
+}
+
+#endif /* THREEBODY */
+
+/****************************************************************
+ *
+ * conf_owner: Process of configuration h in a distribution
+ *
+ ****************************************************************/
+
+static int conf_owner(int h, int *dist, int *len)
+{
+  int   p;
+
+  for (p = 0; p < num_cpus; p++)
+    if (h >= dist[p] && h < dist[p] + len[p])
+      return p;
+
+  return -1;
 }
 
+/****************************************************************
+ *
+ * balance_configs: Every balance_steps force calculations the
+ *	measured times of the configurations are collected on the
+ *	root process. If the largest load of a process exceeds the
+ *	average by more than balance_threshold, the configurations
+ *	are distributed again with partition_configs() and moved to
+ *	their new processes together with their neighbors and angles.
+ *	Called by all processes from calc_forces.
+ *
+ *	The timings are noisy, so configurations are only moved if two
+ *	checks in a row find the load too uneven, the largest load is
+ *	expected to drop by at least BALANCE_GAIN and the best possible
+ *	distribution is noticeably better than the current one. If the
+ *	next check shows that a migration did not gain that much, the
+ *	interval between the checks is doubled.
+ *
+ *	The processes run the same binary, so atoms, neighbors and
+ *	angles are sent as raw bytes including the cached terms.
+ *
+ ****************************************************************/
+
+/* smallest relative gain of the largest load worth a migration */
+#define BALANCE_GAIN 0.05
+/* largest factor between the checks after migrations without gain */
+#define BALANCE_BACKOFF 64
+
+void balance_configs(void)
+{
+  static int count = 0;
+  static int backoff = 1;	/* balance_steps between the checks */
+  static int uneven = 0;	/* the last check found an uneven load */
+  static double last_ratio = 0.0;	/* load before the last migration */
+  static int *maps = NULL;	/* old and new conf_dist and conf_len */
+  static double *all_time = NULL;
+  int   h, i, n, p, first, nreq = 0, nold = 0, moved = 0, moved_atoms = 0;
+  int   new_firstconf, new_myconf, new_firstatom, new_myatoms;
+  int  *old_dist, *old_len, *new_dist, *new_len;
+  double t_start, old_ratio = 1.0, new_ratio = 1.0;
+  atom_t *new_atoms;
+  neigh_t *nblock;
+#ifdef THREEBODY
+  angl *ablock;
+#endif /* THREEBODY */
+  void *p_old[5];
+  void **old_blocks;
+  MPI_Request *req;
+  MPI_Status status;
+
+  if (balance_steps < 1 || num_cpus < 2 || ++count < backoff * balance_steps)
+    return;
+  count = 0;
+
+  t_start = wall_time();
+
+  if (NULL == maps) {
+    maps = (int *)malloc(4 * num_cpus * sizeof(int));
+    all_time = (double *)malloc(MAX(nconf, 1) * sizeof(double));
+    if (NULL == maps || NULL == all_time)
+      error(1, "Cannot allocate memory for the load balancing");
+    reg_for_free(maps, "balance maps");
+    reg_for_free(all_time, "configuration timings");
+  }
+  old_dist = maps;
+  old_len = maps + num_cpus;
+  new_dist = maps + 2 * num_cpus;
+  new_len = maps + 3 * num_cpus;
+
+  /* collect the timings and find a better distribution */
+  MPI_Gatherv(conf_time, myconf, MPI_DOUBLE, all_time, conf_len, conf_dist, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  if (0 == myid) {
+    for (p = 0; p < num_cpus; p++) {
+      old_dist[p] = conf_dist[p];
+      old_len[p] = conf_len[p];
+    }
+    old_ratio = load_ratio(all_time);
+    /* check the effect of the last migration */
+    if (last_ratio > 0.0) {
+      if (old_ratio > (1.0 - BALANCE_GAIN) * last_ratio)
+	backoff = MIN(2 * backoff, BALANCE_BACKOFF);
+      else
+	backoff = 1;
+      last_ratio = 0.0;
+    }
+    if (old_ratio <= MAX(balance_threshold, (1.0 + BALANCE_GAIN) * best_ratio(all_time)))
+      uneven = 0;
+    else if (!uneven)
+      uneven = 1;
+    else {
+      uneven = 0;
+      new_ratio = partition_configs(all_time);
+      /* keep the old distribution unless the new one is clearly better */
+      if (new_ratio > (1.0 - BALANCE_GAIN) * old_ratio) {
+	for (p = 0; p < num_cpus; p++) {
+	  conf_dist[p] = old_dist[p];
+	  conf_len[p] = old_len[p];
+	}
+	set_atom_dist();
+      }
+    }
+    for (p = 0; p < num_cpus; p++) {
+      new_dist[p] = conf_dist[p];
+      new_len[p] = conf_len[p];
+    }
+  }
+  MPI_Bcast(maps, 4 * num_cpus, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&backoff, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  for (i = 0; i < myconf; i++)
+    conf_time[i] = 0.0;
+  for (p = 0; p < num_cpus; p++)
+    if (old_dist[p] != new_dist[p] || old_len[p] != new_len[p])
+      break;
+  if (p == num_cpus)
+    return;
+  last_ratio = old_ratio;
+
+  /* the neighbors and angles are moved in one block per configuration */
+#ifdef NEIGH_TABLE
+  unpack_neighbors();
+#endif /* NEIGH_TABLE */
+#if defined STIWEB || defined TERSOFF
+  unprune_neighbors();
+#endif /* STIWEB || TERSOFF */
+
+  new_firstconf = new_dist[myid];
+  new_myconf = new_len[myid];
+  new_firstatom = (new_firstconf < nconf) ? cnfstart[new_firstconf] : natoms;
+  for (new_myatoms = 0, h = new_firstconf; h < new_firstconf + new_myconf; h++)
+    new_myatoms += inconf[h];
+  new_atoms = (atom_t *)malloc(MAX(new_myatoms, 1) * sizeof(atom_t));
+  req = (MPI_Request *)malloc(3 * MAX(myconf, 1) * sizeof(MPI_Request));
+  old_blocks = (void **)malloc(2 * MAX(myconf, 1) * sizeof(void *));
+  if (NULL == new_atoms || NULL == req || NULL == old_blocks)
+    error(1, "Cannot allocate memory for moving the configurations");
+
+  /* send the configurations which leave this process, the order of
+     the messages between two processes is kept for each tag */
+  for (h = firstconf; h < firstconf + myconf; h++) {
+    p = conf_owner(h, new_dist, new_len);
+    if (p == myid)
+      continue;
+    first = cnfstart[h] - firstatom;
+    MPI_Isend(conf_atoms + first, inconf[h] * sizeof(atom_t), MPI_BYTE, p, 0, MPI_COMM_WORLD, req + nreq++);
+    for (n = 0, i = first; i < first + inconf[h]; i++)
+      n += conf_atoms[i].num_neigh;
+    MPI_Isend(conf_atoms[first].neigh, n * sizeof(neigh_t), MPI_BYTE, p, 1, MPI_COMM_WORLD, req + nreq++);
+    old_blocks[nold++] = conf_atoms[first].neigh;
+#ifdef THREEBODY
+    for (n = 0, i = first; i < first + inconf[h]; i++)
+      n += conf_atoms[i].num_angl;
+    MPI_Isend(conf_atoms[first].angl_part, n * sizeof(angl), MPI_BYTE, p, 2, MPI_COMM_WORLD, req + nreq++);
+    old_blocks[nold++] = conf_atoms[first].angl_part;
+#endif /* THREEBODY */
+  }
+
+  /* keep or receive the configurations of the new distribution */
+  for (h = new_firstconf; h < new_firstconf + new_myconf; h++) {
+    first = cnfstart[h] - new_firstatom;
+    p = conf_owner(h, old_dist, old_len);
+    if (p == myid) {
+      memcpy(new_atoms + first, conf_atoms + cnfstart[h] - firstatom, inconf[h] * sizeof(atom_t));
+      continue;
+    }
+    MPI_Recv(new_atoms + first, inconf[h] * sizeof(atom_t), MPI_BYTE, p, 0, MPI_COMM_WORLD, &status);
+    for (n = 0, i = first; i < first + inconf[h]; i++)
+      n += new_atoms[i].num_neigh;
+    nblock = (neigh_t *)malloc(MAX(n, 1) * sizeof(neigh_t));
+    if (NULL == nblock)
+      error(1, "Cannot allocate memory for neighbor table of configuration %d", h);
+#ifndef NEIGH_TABLE
+    /* with NEIGH_TABLE it is released by pack_neighbors() */
+    reg_for_free(nblock, "local neighbor table configuration %d", h);
+#endif /* !NEIGH_TABLE */
+    MPI_Recv(nblock, n * sizeof(neigh_t), MPI_BYTE, p, 1, MPI_COMM_WORLD, &status);
+    for (i = first; i < first + inconf[h]; i++) {
+      new_atoms[i].neigh = nblock;
+      nblock += new_atoms[i].num_neigh;
+    }
+#ifdef THREEBODY
+    for (n = 0, i = first; i < first + inconf[h]; i++)
+      n += new_atoms[i].num_angl;
+    ablock = (angl *) malloc(MAX(n, 1) * sizeof(angl));
+    if (NULL == ablock)
+      error(1, "Cannot allocate memory for angular part of configuration %d", h);
+    reg_for_free(ablock, "local angular part configuration %d", h);
+    MPI_Recv(ablock, n * sizeof(angl), MPI_BYTE, p, 2, MPI_COMM_WORLD, &status);
+    for (i = first; i < first + inconf[h]; i++) {
+      new_atoms[i].angl_part = ablock;
+      ablock += new_atoms[i].num_angl;
+    }
 #endif /* THREEBODY */
+  }
+
+  MPI_Waitall(nreq, req, MPI_STATUSES_IGNORE);
+  free_registered(old_blocks, nold);
+  free(old_blocks);
+  free(req);
+
+  /* switch to the new distribution */
+  p_old[0] = conf_atoms;
+  p_old[1] = conf_vol;
+  p_old[2] = conf_uf;
+  p_old[3] = conf_us;
+  p_old[4] = conf_time;
+  free_registered(p_old, 5);
+  conf_atoms = new_atoms;
+  firstconf = new_firstconf;
+  myconf = new_myconf;
+  firstatom = new_firstatom;
+  myatoms = new_myatoms;
+  conf_vol = (double *)malloc(MAX(myconf, 1) * sizeof(double));
+  conf_uf = (int *)malloc(MAX(myconf, 1) * sizeof(int));
+  conf_us = (int *)malloc(MAX(myconf, 1) * sizeof(int));
+  conf_time = (double *)calloc(MAX(myconf, 1), sizeof(double));
+  if (NULL == conf_vol || NULL == conf_uf || NULL == conf_us || NULL == conf_time)
+    error(1, "Cannot allocate memory for the local configurations");
+  MPI_Scatterv(volume, conf_len, conf_dist, MPI_DOUBLE, conf_vol, myconf, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Scatterv(useforce, conf_len, conf_dist, MPI_INT, conf_uf, myconf, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Scatterv(usestress, conf_len, conf_dist, MPI_INT, conf_us, myconf, MPI_INT, 0, MPI_COMM_WORLD);
+  reg_for_free(conf_atoms, "conf_atoms");
+  reg_for_free(conf_vol, "conf_vol");
+  reg_for_free(conf_uf, "conf_uf");
+  reg_for_free(conf_us, "conf_us");
+  reg_for_free(conf_time, "conf_time");
+
+#ifdef NEIGH_TABLE
+  pack_neighbors();
+#endif /* NEIGH_TABLE */
+
+#ifdef COULOMB
+  /* the received tails may belong to another kappa */
+  tail_kappa = -1.;
+#endif /* COULOMB */
+
+  if (0 == myid) {
+    for (h = 0; h < nconf; h++)
+      if (conf_owner(h, old_dist, old_len) != conf_owner(h, new_dist, new_len)) {
+	moved++;
+	moved_atoms += inconf[h];
+      }
+    printf("Moved %d configurations (%d atoms) in %.3f seconds, largest load %.1f%% -> %.1f%% of the average.\n",
+      moved, moved_atoms, wall_time() - t_start, 100.0 * old_ratio, 100.0 * new_ratio);
+    fflush(stdout);
+  }
+
+  return;
+}
 
 #ifndef APOT
 
@@ -162,6 +162,24 @@ void check_parameters_complete(char *paramfile)
 #endif /* PAIR */
 #endif /* APOT */
 
+#ifdef COULOMB
+  if (dp_tail_tol < 0)
+    error(1, "Missing parameter or invalid value in %s : dp_tail_tol is \"%f\"", paramfile, dp_tail_tol);
+  if (ewald < 0 || ewald > 3)
+    error(1, "Missing parameter or invalid value in %s : ewald is \"%d\"", paramfile, ewald);
+  if (ewald_tol <= 0 || ewald_tol >= 1)
+    error(1, "Missing parameter or invalid value in %s : ewald_tol is \"%f\"", paramfile, ewald_tol);
+#ifdef DIPOLE
+  if (ewald)
+    error(1, "The Ewald sum is not available for induced dipoles, please set ewald to 0");
+#endif /* DIPOLE */
+#endif /* COULOMB */
+
+#ifdef DIPOLE
+  if (dp_hist < 0)
+    error(1, "Missing parameter or invalid value in %s : dp_hist is \"%d\"", paramfile, dp_hist);
+#endif /* DIPOLE */
+
 #ifdef PDIST
   if (strcmp(distfile, "\0") == 0)
     error(1, "Missing parameter or invalid value in %s : distfile is \"%s\"", paramfile, distfile);
@@ -291,6 +309,14 @@ void read_paramfile(FILE *pf)
     else if (strcasecmp(token, "config") == 0) {
       getparam("config", config, PARAM_STR, 1, 255);
     }
+    /* binary cache of the configurations and neighbor tables */
+    else if (strcasecmp(token, "config_cache") == 0) {
+      getparam("config_cache", config_cache, PARAM_STR, 1, 255);
+    }
+    /* use cell lists for the neighbor tables */
+    else if (strcasecmp(token, "neigh_cells") == 0) {
+      getparam("neigh_cells", &neigh_cells, PARAM_INT, 1, 1);
+    }
     /* Optimization flag */
     else if (strcasecmp(token, "opt") == 0) {
       getparam("opt", &opt, PARAM_INT, 1, 1);
@@ -307,6 +333,16 @@ void read_paramfile(FILE *pf)
     else if (strcasecmp(token, "plotpointfile") == 0) {
       getparam("plotpointfile", plotpointfile, PARAM_STR, 1, 255);
     }
+    /* wall-clock profile */
+    else if (strcasecmp(token, "profile") == 0) {
+      getparam("profile", &profile, PARAM_INT, 1, 1);
+    }
+    /* trace of the profile, one line per force calculation */
+    else if (strcasecmp(token, "profile_file") == 0) {
+      getparam("profile_file", profile_file, PARAM_STR, 1, 255);
+      if (strcmp(profile_file, "") != 0)
+	profile = 1;
+    }
     /* temporary potential file */
     else if (strcasecmp(token, "tempfile") == 0) {
       getparam("tempfile", tempfile, PARAM_STR, 1, 255);
@@ -325,6 +361,10 @@ void read_paramfile(FILE *pf)
     else if (strcasecmp(token, "anneal_temp") == 0) {
       getparam("anneal_temp", &anneal_temp, PARAM_STR, 1, 20);
     }
+    /* number of replicas at different temperatures for annealing */
+    else if (strcasecmp(token, "anneal_chains") == 0) {
+      getparam("anneal_chains", &anneal_chains, PARAM_INT, 1, 1);
+    }
 #endif /* EVO */
 #ifdef APOT
     /* Scaling Constant for APOT Punishment */
@@ -355,6 +395,18 @@ void read_paramfile(FILE *pf)
     else if (strcasecmp(token, "dp_cut") == 0) {
       getparam("dp_cut", &dp_cut, PARAM_DOUBLE, 1, 1);
     }
+    /* relative accuracy of the tabulated electrostatic tail */
+    else if (strcasecmp(token, "dp_tail_tol") == 0) {
+      getparam("dp_tail_tol", &dp_tail_tol, PARAM_DOUBLE, 1, 1);
+    }
+    /* reciprocal space part of the Ewald sum */
+    else if (strcasecmp(token, "ewald") == 0) {
+      getparam("ewald", &ewald, PARAM_INT, 1, 1);
+    }
+    /* accuracy of the reciprocal space sum */
+    else if (strcasecmp(token, "ewald_tol") == 0) {
+      getparam("ewald_tol", &ewald_tol, PARAM_DOUBLE, 1, 1);
+    }
 #endif /* COULOMB */
 #ifdef DIPOLE
     /* dipole iteration precision */
@@ -365,7 +417,21 @@ void read_paramfile(FILE *pf)
     else if (strcasecmp(token, "dp_mix") == 0) {
       getparam("dp_mix", &dp_mix, PARAM_DOUBLE, 1, 1);
     }
+    /* number of previous iterations used for Anderson mixing */
+    else if (strcasecmp(token, "dp_hist") == 0) {
+      getparam("dp_hist", &dp_hist, PARAM_INT, 1, 1);
+    }
 #endif /* DIPOLE */
+#ifdef MPI
+    /* number of force calculations between checks of the load balance */
+    else if (strcasecmp(token, "balance_steps") == 0) {
+      getparam("balance_steps", &balance_steps, PARAM_INT, 1, 1);
+    }
+    /* tolerated ratio of the largest to the average load of a process */
+    else if (strcasecmp(token, "balance_threshold") == 0) {
+      getparam("balance_threshold", &balance_threshold, PARAM_DOUBLE, 1, 1);
+    }
+#endif /* MPI */
     /* unknown tag */
     else {
       fprintf(stderr, "Unknown tag <%s> in parameter file ignored!\n", token);
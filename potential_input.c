@@ -217,6 +217,7 @@ void read_pot_table(pot_table_t *pt, char *filename)
   apt->end = (double *)malloc(size * sizeof(double));
   apt->param_name = (char ***)malloc(size * sizeof(char **));
   apt->fvalue = (fvalue_pointer *) malloc(size * sizeof(fvalue_pointer));
+  apt->fgrad = (fgrad_pointer *) malloc(size * sizeof(fgrad_pointer));
 #ifdef PAIR
   if (enable_cp) {
     apt->values = (double **)malloc((size + 1) * sizeof(double *));
@@ -283,7 +284,7 @@ void read_pot_table(pot_table_t *pt, char *filename)
     apt->names[i] = (char *)malloc(20 * sizeof(char));
   }
   if ((apt->n_par == NULL) || (apt->begin == NULL) || (apt->end == NULL)
-    || (apt->fvalue == NULL) || (apt->names == NULL) || (apt->pmin == NULL)
+    || (apt->fvalue == NULL) || (apt->fgrad == NULL) || (apt->names == NULL) || (apt->pmin == NULL)
     || (apt->pmax == NULL) || (apt->param_name == NULL)
     || (apt->values == NULL))
     error(1, "Cannot allocate info block for analytic potential table %s", filename);
@@ -370,6 +371,7 @@ void read_pot_table(pot_table_t *pt, char *filename)
   reg_for_free(apt->end, "apt->end");
   reg_for_free(apt->param_name, "apt->param_name");
   reg_for_free(apt->fvalue, "apt->fvalue");
+  reg_for_free(apt->fgrad, "apt->fgrad");
   reg_for_free(apt->values, "apt->values");
   reg_for_free(apt->invar_par, "apt->invar_par");
   reg_for_free(apt->pmin, "apt->pmin");
@@ -44,17 +44,27 @@
 /****************************************************************
  *
  *  calculate tail of coulomb-potential and its first derivative
+ *  for the neighbors of the local configurations
  *
  ****************************************************************/
 
 void init_tails(double dp_kappa)
 {
-  int   i, j;
+  int   h, i, j;
+  atom_t *atom;
+  neigh_t *neigh;
 
-  for (i = 0; i < natoms; i++)
-    for (j = 0; j < atoms[i].num_neigh; j++)
-      elstat_shift(atoms[i].neigh[j].r, dp_kappa, &atoms[i].neigh[j].fnval_el,
-	&atoms[i].neigh[j].grad_el, &atoms[i].neigh[j].ggrad_el);
+  elstat_table(dp_kappa);
+
+  for (h = firstconf; h < firstconf + myconf; h++)
+    for (i = 0; i < inconf[h]; i++) {
+      atom = conf_atoms + i + cnfstart[h] - firstatom;
+      for (j = 0; j < atom->num_neigh; j++) {
+	neigh = atom->neigh + j;
+	elstat_tail(neigh->r, &neigh->fnval_el, &neigh->grad_el, &neigh->ggrad_el);
+      }
+    }
+  tail_kappa = dp_kappa;
 
   return;
 }
@@ -1754,6 +1764,23 @@ void write_pairdist(pot_table_t *pt, char *filename)
       typ1 = atom->type;
 
       /* pair potentials */
+#ifdef NEIGH_TABLE
+      for (j = neigh_tab.start[i + cnfstart[h] - firstatom];
+	j < neigh_tab.start[i + cnfstart[h] - firstatom + 1]; j++) {
+	typ2 = neigh_tab.type[j];
+	col = (typ1 <= typ2) ? typ1 * ntypes + typ2 - ((typ1 * (typ1 + 1)) / 2)
+	  : typ2 * ntypes + typ1 - ((typ2 * (typ2 + 1)) / 2);
+	/* this has already been calculated */
+	if (neigh_tab.r[j] < pt->end[col])
+	  freq[neigh_tab.slot[0][j]]++;
+#ifdef EAM
+	/* transfer function */
+	col = paircol + typ2;
+	if (neigh_tab.r[j] < pt->end[col])
+	  freq[neigh_tab.slot[1][j]]++;
+#endif /* EAM */
+      }
+#else
       for (j = 0; j < atom->num_neigh; j++) {
 	neigh = atom->neigh + j;
 	typ2 = neigh->type;
@@ -1769,6 +1796,7 @@ void write_pairdist(pot_table_t *pt, char *filename)
 	  freq[neigh->slot[1]]++;
 #endif /* EAM */
       }
+#endif /* NEIGH_TABLE */
 #ifdef EAM
       /* embedding function - get index first */
       col = paircol + ntypes + typ1;
@@ -38,6 +38,7 @@
 #include "functions.h"
 #include "optimize.h"
 #include "potential.h"
+#include "profile.h"
 #include "splines.h"
 #include "utils.h"
 #include "version.h"
@@ -57,6 +58,7 @@ int main(int argc, char **argv)
   double *force;
   double rms[3];
   time_t t_begin, t_end;
+  double t_prof;
 #if defined EAM || defined ADP || defined MEAM
   double *totdens = NULL;
 #endif /* EAM || ADP || MEAM */
@@ -70,6 +72,9 @@ int main(int argc, char **argv)
 #ifdef MPI
     printf("Starting up MPI with %d processes.\n", num_cpus);
 #endif /* MPI */
+#ifdef _OPENMP
+    printf("Using %d OpenMP threads per process.\n", omp_get_max_threads());
+#endif /* _OPENMP */
   }
 
   /* assign correct force routine */
@@ -109,11 +114,6 @@ int main(int argc, char **argv)
     printf("Global stress weight: %f\n", sweight);
 #endif /* STRESS */
 
-#ifdef COULOMB
-    if (apot_table.sw_kappa)
-      init_tails(apot_table.dp_kappa[0]);
-#endif /* COULOMB */
-
     /* Select correct spline interpolation and other functions */
 #ifdef APOT
     if (format == 0) {
@@ -191,6 +191,11 @@ int main(int argc, char **argv)
   conf_us = usestress;
 #endif /* MPI */
 
+#ifdef NEIGH_TABLE
+  /* copy the neighbors of the local atoms into one packed table */
+  pack_neighbors();
+#endif /* NEIGH_TABLE */
+
   ndim = opt_pot.idxlen;
   ndimtot = opt_pot.len;
   idx = opt_pot.idx;
@@ -203,6 +208,24 @@ int main(int argc, char **argv)
     force[i] = 0.0;
   reg_for_free(force, "force");
 
+#if (defined EAM || defined ADP) && !defined NORESCALE && !defined APOT
+  /* range of the atomic densities, collected by the force routine for rescale() */
+  rho_min = (double *)malloc(2 * ntypes * sizeof(double));
+  if (NULL == rho_min)
+    error(1, "Could not allocate memory for the range of the atomic densities.");
+  reg_for_free(rho_min, "rho_min");
+  rho_max = rho_min + ntypes;
+#endif /* (EAM || ADP) && !NORESCALE && !APOT */
+
+#ifdef DIPOLE
+  /* iterations of the dipole solver, counted for each configuration */
+  dp_iter_sum = (long *)calloc(2 * nconf, sizeof(long));
+  if (NULL == dp_iter_sum)
+    error(1, "Could not allocate memory for the dipole iteration counters.");
+  reg_for_free(dp_iter_sum, "dp_iter_sum");
+  dp_iter_calls = dp_iter_sum + nconf;
+#endif /* DIPOLE */
+
   /* starting positions for the force vector */
   energy_p = 3 * natoms;
 #ifdef STRESS
@@ -278,7 +301,12 @@ int main(int argc, char **argv)
 #endif /* PARABOLA */
 #endif /* !APOT */
     }
+  }
+
+  /* start the wall-clock profile on all processes */
+  prof_init();
 
+  if (myid > 0) {
     /* all but root go to calc_forces */
 #ifndef APOT
     calc_forces(calc_pot.table, force, 0);
@@ -292,17 +320,33 @@ int main(int argc, char **argv)
       warning(1, "While this will not do any harm, you are wasting %d CPUs\n", num_cpus - nconf);
     }
 #endif /* MPI */
+#ifdef BENCH
+    /* the first force calculation sets up the spline coefficients */
+    i = fcalls;
+#ifndef APOT
+    calc_forces(calc_pot.table, force, 0);
+#else
+    calc_forces(opt_pot.table, force, 0);
+#endif /* !APOT */
+    fcalls = i;
+    spline_bench(&calc_pot);
+#endif /* BENCH */
     time(&t_begin);
     if (opt && ndim != 0) {
       printf("\nStarting optimization with %d parameters.\n", ndim);
       fflush(stdout);
+      t_prof = prof_start();
 #ifdef EVO
       diff_evo(opt_pot.table);
+      prof_stop(PROF_EVO, t_prof);
 #else /* EVO */
       anneal(opt_pot.table);
+      prof_stop(PROF_ANNEAL, t_prof);
 #endif /* EVO */
       printf("\nStarting powell minimization ...\n");
+      t_prof = prof_start();
       powell_lsq(opt_pot.table);
+      prof_stop(PROF_POWELL, t_prof);
       printf("\nFinished powell minimization, calculating errors ...\n");
     } else if (ndim == 0) {
       printf("\nOptimization disabled due to 0 free parameters. Calculating errors.\n");
@@ -728,7 +772,36 @@ int main(int argc, char **argv)
 	  t_begin) % 3600) / 60, (int)difftime(t_end, t_begin) % 60);
     printf("%d force calculations, each took %f seconds\n", fcalls, (double)difftime(t_end,
 	t_begin) / fcalls);
+    if (spline_calls > 0)
+      printf("%ld of %ld spline initializations were skipped (unchanged columns)\n",
+	spline_skipped, spline_calls);
+  }
+
+#ifdef DIPOLE
+  /* collect the dipole iterations of all processes */
+#ifdef MPI
+  if (0 == myid)
+    MPI_Reduce(MPI_IN_PLACE, dp_iter_sum, 2 * nconf, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  else
+    MPI_Reduce(dp_iter_sum, NULL, 2 * nconf, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+#endif /* MPI */
+  if (0 == myid) {
+    long  it_sum = 0, it_calls = 0;
+    printf("\nDipole iterations per force calculation:\n");
+    printf("#conf\titerations\n");
+    for (i = 0; i < nconf; i++) {
+      if (dp_iter_calls[i] > 0)
+	printf("%3d\t%.2f\n", i, (double)dp_iter_sum[i] / dp_iter_calls[i]);
+      it_sum += dp_iter_sum[i];
+      it_calls += dp_iter_calls[i];
+    }
+    if (it_calls > 0)
+      printf("average\t%.2f (history depth %d)\n", (double)it_sum / it_calls, dp_hist);
   }
+#endif /* DIPOLE */
+
+  /* times of the phases, needs all processes */
+  prof_summary();
 
   /* do some cleanups before exiting */
 #ifdef MPI
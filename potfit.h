@@ -51,8 +51,17 @@
 #include <mpi.h>
 #endif /* MPI */
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif /* _OPENMP */
+
 #include "random.h"
 
+/* force routines reading the packed neighbor table instead of atom->neigh */
+#if defined PAIR || (defined EAM && !defined COULOMB)
+#define NEIGH_TABLE
+#endif /* PAIR || (EAM && !COULOMB) */
+
 /* general flag for threebody potentials (MEAM, Tersoff, SW, ...) */
 #if defined MEAM || defined STIWEB || defined TERSOFF
 #define THREEBODY
@@ -171,8 +180,18 @@ typedef struct {
   double drho;
 #endif
 
+#ifdef STIWEB
+  double power[2];		/* r^-p and r^-q */
+  double f_cut;			/* exp(delta / (r - a1)) */
+#endif
+
 #ifdef TERSOFF
   vector dzeta;
+  double exp_lambda;		/* exp(-lambda * r) */
+  double exp_mu;		/* exp(-mu * r) */
+  double zeta;			/* zeta of the last bond order */
+  double zeta_n;		/* (gamma * zeta)^n */
+  double b_ij;			/* bond order (1 + (gamma * zeta)^n)^(-1/2n) */
 #endif
 } neigh_t;
 
@@ -187,6 +206,10 @@ typedef struct {
   double g;
   double dg;
 #endif
+#ifdef TERSOFF
+  double g;			/* angular term g(theta) */
+  double dg;			/* 2 c^2 (h - cos) / (d^2 + (h - cos)^2)^2 */
+#endif
 } angl;
 #endif
 
@@ -256,9 +279,7 @@ typedef struct {
   vector E_stat;		/* static field-contribution */
   vector p_sr;			/* short-range dipole moment */
   vector E_ind;			/* induced field-contribution */
-  vector p_ind;			/* induced dipole moment */
-  vector E_old;			/* stored old induced field */
-  vector E_tot;			/* temporary induced field */
+  vector p_ind;			/* induced dipole moment, kept for the next call */
 #endif
 
 #ifdef THREEBODY
@@ -274,6 +295,24 @@ typedef struct {
 #endif
 } atom_t;
 
+#ifdef NEIGH_TABLE
+/* packed neighbor table of the local atoms, one array per property,
+   the neighbors of atom i are found at [start[i], start[i + 1]) */
+typedef struct {
+  int   len;			/* total number of neighbors */
+  int  *start;			/* offset of the first neighbor of each atom */
+  int  *type;			/* type of neighboring atom */
+  int  *nr;			/* number of neighboring atom */
+  double *r;			/* r */
+  vector *dist_r;		/* distance divided by r */
+  int  *col[SLOTS];		/* coloumn of interaction for this neighbor */
+  int  *slot[SLOTS];		/* the slot, belonging to the neighbor distance */
+  double *shift[SLOTS];		/* how far into the slot we have to go, in [0..1] */
+  double *step[SLOTS];		/* step size */
+  int   gen;			/* incremented every time the table is packed */
+} neigh_table_t;
+#endif /* NEIGH_TABLE */
+
 typedef struct {
   int   len;			/* total length of the table */
   int   idxlen;			/* number of changeable potential values */
@@ -287,12 +326,15 @@ typedef struct {
   double *xcoord;		/* the x-coordinates of sampling points */
   double *table;		/* the actual data */
   double *d2tab;		/* second derivatives of table data for spline int */
+  double *coef;			/* table[k], table[k+1], d2tab[k], d2tab[k+1] for each k */
   int  *idx;			/* indirect indexing */
 } pot_table_t;
 
 #ifdef APOT
 /* function pointer for analytic potential evaluation */
 typedef void (*fvalue_pointer) (double, double *, double *);
+/* function pointer for the derivatives with respect to r and the parameters */
+typedef void (*fgrad_pointer) (double, double *, double *, double *);
 
 typedef struct {
   /* potentials */
@@ -347,12 +389,14 @@ typedef struct {
 #endif
 
   fvalue_pointer *fvalue;	/* function pointers for analytic potentials */
+  fgrad_pointer *fgrad;		/* analytic derivatives, NULL if not available */
 } apot_table_t;
 
 typedef struct {
   char **name;			/* identifier of the potential */
   int  *n_par;			/* number of parameters */
   fvalue_pointer *fvalue;	/* function pointer */
+  fgrad_pointer *fgrad;		/* analytic derivatives, NULL if not available */
 } function_table_t;
 
 #endif /* APOT */
@@ -407,10 +451,15 @@ EXTERN MPI_Datatype MPI_ANGL;
 #endif
 EXTERN MPI_Datatype MPI_STENS;
 EXTERN MPI_Datatype MPI_VECTOR;
+EXTERN int local_forces INIT(0);	/* calc_forces without communication */
+EXTERN double *conf_time;	/* time spent on each local configuration */
+EXTERN int balance_steps INIT(100);	/* force calculations between load checks */
+EXTERN double balance_threshold INIT(1.1);	/* tolerated ratio of largest to average load */
 #endif /* MPI */
 
 /* general settings (from parameter file) */
 EXTERN char config[255] INIT("\0");	/* file with atom configuration */
+EXTERN char config_cache[255] INIT("\0");	/* binary cache of the configurations */
 EXTERN char distfile[255] INIT("\0");	/* file for distributions */
 EXTERN char endpot[255] INIT("\0");	/* file for end potential */
 EXTERN char flagfile[255] INIT("\0");	/* break if file exists */
@@ -420,11 +469,14 @@ EXTERN char output_prefix[255] INIT("\0");	/* prefix for all output files */
 EXTERN char output_lammps[255] INIT("\0");	/* lammps output files */
 EXTERN char plotfile[255] INIT("\0");	/* file for plotting */
 EXTERN char plotpointfile[255] INIT("\0");	/* write points for plotting */
+EXTERN char profile_file[255] INIT("\0");	/* trace of the wall-clock profile */
 EXTERN char startpot[255] INIT("\0");	/* file with start potential */
 EXTERN char tempfile[255] INIT("\0");	/* backup potential file */
 EXTERN int imdpotsteps INIT(1000);	/* resolution of IMD potential */
+EXTERN int neigh_cells INIT(0);	/* build neighbor tables with cell lists */
 EXTERN int ntypes INIT(-1);	/* number of atom types */
 EXTERN int opt INIT(0);		/* optimization flag */
+EXTERN int profile INIT(0);	/* wall-clock profile of the phases */
 EXTERN int seed INIT(4);	/* seed for RNG */
 EXTERN int usemaxch INIT(0);	/* use maximal changes file */
 EXTERN int write_output_files INIT(0);
@@ -436,6 +488,7 @@ EXTERN int write_lammps INIT(0);	/* write output also in LAMMPS format */
 EXTERN double evo_threshold INIT(1.e-6);
 #else /* EVO */
 EXTERN char anneal_temp[20] INIT("\0");
+EXTERN int anneal_chains INIT(1);	/* number of replicas for annealing */
 #endif /* EVO */
 EXTERN double eweight INIT(-1.);
 EXTERN double sweight INIT(-1.);
@@ -460,6 +513,9 @@ EXTERN int *useforce;		/* Should we use force/stress */
 EXTERN int *usestress;		/* Should we use force/stress */
 EXTERN int have_elements INIT(0);	/* do we have the elements ? */
 EXTERN int maxneigh INIT(0);	/* maximum number of neighbors */
+#ifdef NEIGH_TABLE
+EXTERN neigh_table_t neigh_tab;	/* packed neighbors of conf_atoms */
+#endif /* NEIGH_TABLE */
 EXTERN int natoms INIT(0);	/* number of atoms */
 EXTERN int nconf INIT(0);	/* number of configurations */
 #ifdef CONTRIB
@@ -485,9 +541,13 @@ EXTERN vector cbox_a, cbox_b, cbox_c;	/* box vectors for box of contrib. atoms *
 EXTERN vector *sphere_centers;	/* centers of the spheres of contrib. atoms */
 #endif /* CONTRIB */
 EXTERN vector tbox_x, tbox_y, tbox_z;
+#ifdef _OPENMP
+/* each thread of read_config() reads its own configurations */
+#pragma omp threadprivate(box_x, box_y, box_z, tbox_x, tbox_y, tbox_z)
+#endif /* _OPENMP */
 
 /* potential variables */
-EXTERN char interaction_name[10] INIT("\0");
+EXTERN char interaction_name[20] INIT("\0");
 EXTERN int *gradient;		/* Gradient of potential fns.  */
 EXTERN int *invar_pot;
 EXTERN int format INIT(-1);	/* format of potential table */
@@ -517,6 +577,8 @@ EXTERN function_table_t function_table;	/* table with all functions */
 
 /* optimization variables */
 EXTERN int fcalls INIT(0);
+EXTERN long spline_calls INIT(0);	/* initializations of spline columns */
+EXTERN long spline_skipped INIT(0);	/* unchanged spline columns */
 EXTERN int mdim INIT(0);
 EXTERN int ndim INIT(0);
 EXTERN int ndimtot INIT(0);
@@ -560,6 +622,10 @@ EXTERN int *idx;
 EXTERN int init_done INIT(0);
 EXTERN int plot INIT(0);	/* plot output flag */
 EXTERN double *lambda;		/* embedding energy slope... */
+#if (defined EAM || defined ADP) && !defined NORESCALE && !defined APOT
+EXTERN double *rho_min;		/* smallest atomic density of each type */
+EXTERN double *rho_max;		/* largest atomic density of each type */
+#endif /* (EAM || ADP) && !NORESCALE && !APOT */
 EXTERN double *maxchange;	/* Maximal permissible change */
 EXTERN dsfmt_t dsfmt;		/* random number generator */
 EXTERN char *component[6];	/* componentes of vectors and tensors */
@@ -568,10 +634,18 @@ EXTERN char *component[6];	/* componentes of vectors and tensors */
 #ifdef COULOMB
 EXTERN double dp_eps INIT(14.40);	/* this is e^2/(4*pi*epsilon_0) in eV A */
 EXTERN double dp_cut INIT(10);	/* cutoff-radius for long-range interactions */
+EXTERN double dp_tail_tol INIT(1.e-10);	/* accuracy of the tabulated electrostatic tail */
+EXTERN double tail_kappa INIT(-1.);	/* kappa of the tails in the neighbor tables */
+EXTERN int ewald INIT(0);	/* reciprocal space sum: 0 off, 1 auto, 2 Ewald, 3 PME */
+EXTERN double ewald_tol INIT(1.e-6);	/* accuracy of the reciprocal space sum */
+EXTERN vector *boxes;		/* box vectors of each configuration */
 #endif /* COULOMB */
 #ifdef DIPOLE
 EXTERN double dp_tol INIT(1.e-7);	/* dipole iteration precision */
 EXTERN double dp_mix INIT(0.2);	/* mixing parameter (other than that one in IMD) */
+EXTERN int dp_hist INIT(5);	/* history depth of the Anderson mixing */
+EXTERN long *dp_iter_sum;	/* dipole iterations of each configuration */
+EXTERN long *dp_iter_calls;	/* dipole solutions of each configuration */
 #endif /* DIPOLE */
 
 /****************************************************************
@@ -614,6 +688,7 @@ void  read_paramfile(FILE *);
 /* force routines for different potential models [force_xxx.c] */
 #ifdef PAIR
 double calc_forces_pair(double *, double *, int);
+int   calc_dforces_pair(double *, int, double, double *);
 #elif defined EAM && !defined COULOMB
 double calc_forces_eam(double *, double *, int);
 #elif defined ADP
@@ -646,6 +721,15 @@ void  broadcast_params(void);
 void  broadcast_neighbors(void);
 void  broadcast_angles(void);
 void  potsync(void);
+
+/* columns of the jacobian for powell_lsq [powell_lsq.c] */
+void  gamma_columns(double *);
+
+/* dynamic load balancing of the configurations [mpi_utils.c] */
+void  balance_configs(void);
+
+/* batch of parameter vectors for calc_forces_batch [utils.c] */
+void  batch_forces(void);
 #endif /* MPI */
 
 #endif /* POTFIT_H */
@@ -47,8 +47,10 @@
 #include "potfit.h"
 
 #include "bracket.h"
+#include "functions.h"
 #include "optimize.h"
 #include "potential.h"
+#include "profile.h"
 #include "utils.h"
 
 #define EPS .001
@@ -349,20 +351,316 @@ void powell_lsq(double *xi)
 }
 
 
+/****************************************************************
+ *
+ * gamma_step: step size for the numerical derivative
+ *            with respect to the free parameter xi[idx[i]]
+ *
+ ****************************************************************/
+
+static double gamma_step(int i)
+{
+#ifdef APOT
+  return EPS * (apot_table.pmax[apot_table.idxpot[i]][apot_table.idxparam[i]] -
+    apot_table.pmin[apot_table.idxpot[i]][apot_table.idxparam[i]]);
+#else
+  return EPS;
+#endif /* APOT */
+}
+
+/****************************************************************
+ *
+ * gamma_linear: returns 1 if the force vector is linear in the
+ *            free parameters, i.e. tabulated pair potentials
+ *
+ ****************************************************************/
+
+static int gamma_linear(void)
+{
+#if defined PAIR && !defined APOT
+  return (3 == format || 4 == format);
+#else
+  return 0;
+#endif /* PAIR && !APOT */
+}
+
+#ifdef APOT
+
+/****************************************************************
+ *
+ * gamma_punish: numerical derivatives of the punishment terms
+ *            of analytic potentials with respect to xi[k],
+ *            same as for the columns from calc_forces
+ *
+ ****************************************************************/
+
+static void gamma_punish(double *xi, int k, double scale, double *force_xi, double *force,
+  double *dforce)
+{
+  int   j;
+  double store;
+
+  store = xi[k];
+  xi[k] += scale;
+  (void)apot_punish(xi, force);
+  xi[k] = store;
+  for (j = punish_par_p; j < mdim; j++)
+    dforce[j] = (force[j] - force_xi[j]) / scale;
+
+  return;
+}
+
+#endif /* APOT */
+
+/****************************************************************
+ *
+ * gamma_column: derivatives of the force vector with respect to
+ *            xi[k], written to dforce; force_xi is the force vector
+ *            at xi, force receives the force vector at xi[k] + scale
+ *            (may be the same array as dforce)
+ *
+ *            returns 1 if a force calculation was necessary
+ *
+ ****************************************************************/
+
+static int gamma_column(double *xi, int k, double scale, double *force_xi, double *force,
+  double *dforce)
+{
+  int   j;
+  double store;
+
+#ifdef PAIR
+  /* exact derivatives from the affected neighbors only */
+  if (calc_dforces_pair(xi, k, scale, dforce)) {
+#if defined APOT && !defined MPI
+    gamma_punish(xi, k, scale, force_xi, force, dforce);
+#endif /* APOT && !MPI */
+    return 0;
+  }
+#endif /* PAIR */
+
+  store = xi[k];
+  xi[k] += scale;		/*increase xi[k]... */
+  (void)(*calc_forces) (xi, force, 0);
+  xi[k] = store;		/*...and reset xi[k] again */
+  for (j = 0; j < mdim; j++)
+    dforce[j] = (force[j] - force_xi[j]) / scale;
+
+  return 1;
+}
+
+#ifdef MPI
+
+/* columns of the jacobian, filled by gamma_columns() */
+static int jac_ncols = 0;	/* number of columns */
+static int *jac_idx = NULL;	/* parameter of each column */
+static double *jac_step = NULL;	/* step size of each column */
+static double *jac_force = NULL;	/* derivatives, one vector per column, root only */
+static double *jac_ref = NULL;	/* local force vector at xi */
+static double *jac_col = NULL;	/* force vector of a single column */
+static double *jac_local = NULL;	/* local entries of all columns, see jac_pack() */
+
+/****************************************************************
+ *
+ * jac_local_len: number of entries of the force vector that belong
+ *            to the configurations of this process
+ *
+ ****************************************************************/
+
+static int jac_local_len(void)
+{
+  int   len = 3 * myatoms + myconf;
+
+#ifdef STRESS
+  len += 6 * myconf;
+#endif /* STRESS */
+#if defined EAM || defined ADP || defined MEAM
+  len += myconf;
+#endif /* EAM || ADP || MEAM */
+
+  return len;
+}
+
+/****************************************************************
+ *
+ * jac_pack: copy the local forces, energies, stresses and limiting
+ *            constraints of col to the contiguous array loc
+ *
+ ****************************************************************/
+
+static void jac_pack(const double *col, double *loc)
+{
+  memcpy(loc, col + 3 * firstatom, 3 * myatoms * sizeof(double));
+  loc += 3 * myatoms;
+  memcpy(loc, col + energy_p + firstconf, myconf * sizeof(double));
+  loc += myconf;
+#ifdef STRESS
+  memcpy(loc, col + stress_p + 6 * firstconf, 6 * myconf * sizeof(double));
+  loc += 6 * myconf;
+#endif /* STRESS */
+#if defined EAM || defined ADP || defined MEAM
+  memcpy(loc, col + limit_p + firstconf, myconf * sizeof(double));
+#endif /* EAM || ADP || MEAM */
+
+  return;
+}
+
+/****************************************************************
+ *
+ * jac_gather: collect one column of the jacobian on the root
+ *            process, root has its entries already in place in col,
+ *            all others send their packed entries loc
+ *
+ ****************************************************************/
+
+static void jac_gather(double *col, double *loc)
+{
+  if (0 == myid) {
+    MPI_Gatherv(MPI_IN_PLACE, myatoms, MPI_VECTOR, col, atom_len, atom_dist, MPI_VECTOR, 0,
+      MPI_COMM_WORLD);
+    MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, col + energy_p, conf_len, conf_dist, MPI_DOUBLE, 0,
+      MPI_COMM_WORLD);
+#ifdef STRESS
+    MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_STENS, col + stress_p, conf_len, conf_dist, MPI_STENS, 0,
+      MPI_COMM_WORLD);
+#endif /* STRESS */
+#if defined EAM || defined ADP || defined MEAM
+    MPI_Gatherv(MPI_IN_PLACE, myconf, MPI_DOUBLE, col + limit_p, conf_len, conf_dist, MPI_DOUBLE, 0,
+      MPI_COMM_WORLD);
+#endif /* EAM || ADP || MEAM */
+  } else {
+    MPI_Gatherv(loc, myatoms, MPI_VECTOR, NULL, NULL, NULL, MPI_VECTOR, 0, MPI_COMM_WORLD);
+    loc += 3 * myatoms;
+    MPI_Gatherv(loc, myconf, MPI_DOUBLE, NULL, NULL, NULL, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    loc += myconf;
+#ifdef STRESS
+    MPI_Gatherv(loc, myconf, MPI_STENS, NULL, NULL, NULL, MPI_STENS, 0, MPI_COMM_WORLD);
+    loc += 6 * myconf;
+#endif /* STRESS */
+#if defined EAM || defined ADP || defined MEAM
+    MPI_Gatherv(loc, myconf, MPI_DOUBLE, NULL, NULL, NULL, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#endif /* EAM || ADP || MEAM */
+  }
+
+  return;
+}
+
+/****************************************************************
+ *
+ * gamma_columns: Calculate the derivatives of all columns of the
+ *            jacobian at once. Every process evaluates all columns
+ *            on its own configurations without any communication
+ *            and keeps only their local entries. The columns are
+ *            gathered on the root process one at a time in the end,
+ *            only root holds the whole jacobian.
+ *            Called by all processes from calc_forces with flag 3.
+ *
+ ****************************************************************/
+
+void gamma_columns(double *xi_opt)
+{
+  static int size = 0;
+  static int ncols = 0;
+  static int local_size = 0;
+  int   i, len, n = 0;
+  double *col;
+  double t_prof;
+
+  if (0 == myid)
+    jac_ncols = ndim;
+  MPI_Bcast(&jac_ncols, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  if (jac_ncols > ncols) {
+    ncols = jac_ncols;
+    jac_idx = (int *)realloc(jac_idx, ncols * sizeof(int));
+    jac_step = (double *)realloc(jac_step, ncols * sizeof(double));
+    if (NULL == jac_idx || NULL == jac_step)
+      error(1, "Cannot allocate memory for the jacobian columns");
+  }
+  if (NULL == jac_ref) {
+    jac_ref = (double *)malloc(mdim * sizeof(double));
+    jac_col = (double *)malloc(mdim * sizeof(double));
+    if (NULL == jac_ref || NULL == jac_col)
+      error(1, "Cannot allocate memory for the jacobian columns");
+  }
+  if (0 == myid && jac_ncols * mdim > size) {
+    size = jac_ncols * mdim;
+    jac_force = (double *)realloc(jac_force, size * sizeof(double));
+    if (NULL == jac_force)
+      error(1, "Cannot allocate memory for the jacobian columns");
+  }
+  /* the local part changes with the load balancing */
+  len = jac_local_len();
+  if (0 != myid && jac_ncols * len > local_size) {
+    local_size = jac_ncols * len;
+    jac_local = (double *)realloc(jac_local, local_size * sizeof(double));
+    if (NULL == jac_local)
+      error(1, "Cannot allocate memory for the jacobian columns");
+  }
+
+  if (0 == myid)
+    for (i = 0; i < jac_ncols; i++) {
+      jac_idx[i] = idx[i];
+      jac_step[i] = gamma_step(i);
+    }
+  MPI_Bcast(jac_idx, jac_ncols, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(jac_step, jac_ncols, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+  /* only the local entries and on root the constraints are written,
+     all others have to be zero on root until they are gathered */
+  if (0 == myid)
+    for (i = 0; i < jac_ncols * mdim; i++)
+      jac_force[i] = 0.0;
+  for (i = 0; i < mdim; i++)
+    jac_ref[i] = 0.0;
+
+  local_forces = 1;
+  if (!gamma_linear())
+    (void)(*calc_forces) (xi_opt, jac_ref, 0);
+  for (i = 0; i < jac_ncols; i++) {
+    col = (0 == myid) ? jac_force + i * mdim : jac_col;
+    n += gamma_column(xi_opt, jac_idx[i], jac_step[i], jac_ref, col, col);
+    if (0 != myid)
+      jac_pack(col, jac_local + i * len);
+  }
+  local_forces = 0;
+
+  t_prof = prof_start();
+  for (i = 0; i < jac_ncols; i++)
+    if (0 == myid)
+      jac_gather(jac_force + i * mdim, NULL);
+    else
+      jac_gather(NULL, jac_local + i * len);
+  if (0 == myid)
+    fcalls += n;
+  prof_stop(PROF_MPI, t_prof);
+  /* one line of the trace for all columns */
+  if (0 == myid)
+    prof_force();
+
+  return;
+}
+
+#endif /* MPI */
+
 /****************************************************************
  *
  * gamma_init: (Re-)Initialize gamma[j][i] (Gradient Matrix) after
  *            (Re-)Start or whenever necessary by calculating numerical
  *            gradients in coordinate directions. Includes re-setting the
  *            direction vectors to coordinate directions.
+ *            With MPI all columns are calculated in a single call
+ *            of calc_forces, see gamma_columns(). Pair potentials
+ *            use the derivatives from calc_dforces_pair() if possible.
  *
  ****************************************************************/
 
 int gamma_init(double **gamma, double **d, double *xi, double *force_xi)
 {
-  static double *force;
+  static double *force, *dforce;
   int   i, j;			/* Auxiliary vars: Counters */
-  double sum, temp, scale, store;	/* Auxiliary var: Sum */
+  double sum, temp;		/* Auxiliary var: Sum */
+  double *col;			/* derivatives of the current column */
 /*   Set direction vectors to coordinate directions d_ij=KroneckerDelta_ij */
   /*Initialize direction vectors */
   for (i = 0; i < ndim; i++) {
@@ -377,28 +675,37 @@ int gamma_init(double **gamma, double **d, double *xi, double *force_xi)
     for (i = 0; i < mdim; i++)
       force[i] = 0;
     reg_for_free(force, "force from init_gamma");
+#ifndef MPI
+    dforce = (double *)malloc(mdim * sizeof(double));
+    if (dforce == NULL)
+      error(1, "Error in double vector allocation");
+    reg_for_free(dforce, "dforce from init_gamma");
+#endif /* !MPI */
   }
 
+#ifdef MPI
+  /* wake the other processes, they evaluate all columns at once */
+  (void)(*calc_forces) (xi, force, 3);
+#endif /* MPI */
+
   for (i = 0; i < ndim; i++) {	/*initialize gamma */
-    store = xi[idx[i]];
+#ifdef MPI
+    col = jac_force + i * mdim;
 #ifdef APOT
-    scale =
-      apot_table.pmax[apot_table.idxpot[i]][apot_table.idxparam[i]] -
-      apot_table.pmin[apot_table.idxpot[i]][apot_table.idxparam[i]];
-    xi[idx[i]] += (EPS * scale);
-#else
-    scale = 1.;
-    xi[idx[i]] += EPS;		/*increase xi[idx[i]]... */
+    /* the punishment terms are only known on the root process */
+    gamma_punish(xi, idx[i], gamma_step(i), force_xi, force, col);
 #endif /* APOT */
+#else
+    col = dforce;
+    (void)gamma_column(xi, idx[i], gamma_step(i), force_xi, force, col);
+#endif /* MPI */
     sum = 0.;
-    (void)(*calc_forces) (xi, force, 0);
     for (j = 0; j < mdim; j++) {
-      temp = (force[j] - force_xi[j]) / (EPS * scale);
+      temp = col[j];
       gamma[j][i] = temp;
       sum += dsquare(temp);
     }
     temp = sqrt(sum);
-    xi[idx[i]] = store;		/*...and reset [idx[i]] again */
 /* scale gamma so that sum_j(gamma^2)=1                      */
     if (temp > NOTHING) {
       for (j = 0; j < mdim; j++)
@@ -0,0 +1,220 @@
+/****************************************************************
+ *
+ * profile.c: wall-clock profile of the phases of a run
+ *
+ ****************************************************************
+ *
+ * Copyright 2002-2013
+ *	Institute for Theoretical and Applied Physics
+ *	University of Stuttgart, D-70550 Stuttgart, Germany
+ *	http://potfit.sourceforge.net/
+ *
+ ****************************************************************
+ *
+ *   This file is part of potfit.
+ *
+ *   potfit is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   potfit is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with potfit; if not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************/
+
+#include <time.h>
+
+#include "potfit.h"
+
+#include "profile.h"
+
+/* name in the summary and column of the trace file */
+static const char *prof_name[PROF_PHASES][2] = {
+  {"potential setup", "setup"},
+  {"pair and density loop", "pair"},
+  {"many-body forces", "many"},
+  {"induced dipoles", "dipole"},
+  {"reciprocal space", "ewald"},
+  {"error sums", "sum"},
+  {"communication", "mpi"},
+  {"simulated annealing", "anneal"},
+  {"differential evolution", "evo"},
+  {"powell_lsq", "powell"}
+};
+
+static double prof_sum[PROF_PHASES];	/* accumulated time of each phase */
+static long prof_calls[PROF_PHASES];	/* number of timed regions of each phase */
+static double prof_last[PROF_PHASES + 1];	/* sums at the last line of the trace */
+static double prof_begin;	/* start of the profile */
+static FILE *prof_file = NULL;	/* trace of the force calculations */
+
+/****************************************************************
+ *
+ * monotonic wall clock in seconds
+ *
+ ****************************************************************/
+
+static double prof_clock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/****************************************************************
+ *
+ * start the profile and open the trace file on the root process
+ *
+ ****************************************************************/
+
+void prof_init(void)
+{
+  int   i;
+
+  if (!profile)
+    return;
+
+  prof_begin = prof_clock();
+  prof_last[PROF_PHASES] = prof_begin;
+
+  if (0 == myid && strcmp(profile_file, "") != 0) {
+    prof_file = fopen(profile_file, "w");
+    if (NULL == prof_file)
+      error(1, "Could not open file %s\n", profile_file);
+    fprintf(prof_file, "# wall-clock time [s] of each force calculation on the root process,\n");
+    fprintf(prof_file, "# with MPI one line per jacobian or batch of parameter vectors, see fcall\n");
+    fprintf(prof_file, "fcall,total");
+    for (i = 0; i <= PROF_MPI; i++)
+      fprintf(prof_file, ",%s", prof_name[i][1]);
+    fprintf(prof_file, "\n");
+  }
+}
+
+/****************************************************************
+ *
+ * start of a timed region, returns 0 if profiling is off
+ *
+ ****************************************************************/
+
+double prof_start(void)
+{
+  return profile ? prof_clock() : 0.;
+}
+
+/****************************************************************
+ *
+ * end of a timed region that started at t0, returns the current
+ * time so the next region can start right away
+ *
+ * Inside the parallel loops over configurations the times of
+ * all threads are added up.
+ *
+ ****************************************************************/
+
+double prof_stop(prof_t phase, double t0)
+{
+  double t;
+
+  if (!profile)
+    return 0.;
+
+  t = prof_clock();
+#ifdef _OPENMP
+#pragma omp atomic
+#endif /* _OPENMP */
+  prof_sum[phase] += t - t0;
+#ifdef _OPENMP
+#pragma omp atomic
+#endif /* _OPENMP */
+  prof_calls[phase]++;
+
+  return t;
+}
+
+/****************************************************************
+ *
+ * end of a force calculation on the root process,
+ * writes the phases since the previous one to the trace file;
+ * the jacobian columns and batches of parameter vectors under
+ * MPI are written as a single line
+ *
+ ****************************************************************/
+
+void prof_force(void)
+{
+  int   i;
+  double t;
+
+  if (NULL == prof_file)
+    return;
+
+  t = prof_clock();
+  fprintf(prof_file, "%d,%e", fcalls, t - prof_last[PROF_PHASES]);
+  prof_last[PROF_PHASES] = t;
+  for (i = 0; i <= PROF_MPI; i++) {
+    fprintf(prof_file, ",%e", prof_sum[i] - prof_last[i]);
+    prof_last[i] = prof_sum[i];
+  }
+  fprintf(prof_file, "\n");
+}
+
+/****************************************************************
+ *
+ * print the accumulated times, has to be called by all processes
+ *
+ ****************************************************************/
+
+void prof_summary(void)
+{
+  int   i;
+  double total = 0.;
+#ifdef MPI
+  double max_sum[PROF_PHASES];
+#endif /* MPI */
+
+  if (!profile)
+    return;
+
+  total = prof_clock() - prof_begin;
+#ifdef MPI
+  MPI_Reduce(prof_sum, max_sum, PROF_PHASES, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+#endif /* MPI */
+
+  if (NULL != prof_file) {
+    fclose(prof_file);
+    prof_file = NULL;
+  }
+
+  if (0 != myid)
+    return;
+
+  printf("\nWall-clock profile of the root process (%.3f seconds in total):\n", total);
+  printf("%-24s %10s %12s %8s %14s", "#phase", "calls", "time [s]", "share", "per call [ms]");
+#ifdef MPI
+  printf(" %14s", "max. proc [s]");
+#endif /* MPI */
+  printf("\n");
+  for (i = 0; i < PROF_PHASES; i++) {
+    if (0 == prof_calls[i])
+      continue;
+    printf("%-24s %10ld %12.4f %7.2f%% %14.4f", prof_name[i][0], prof_calls[i], prof_sum[i],
+      100. * prof_sum[i] / total, 1000. * prof_sum[i] / prof_calls[i]);
+#ifdef MPI
+    printf(" %14.4f", max_sum[i]);
+#endif /* MPI */
+    printf("\n");
+  }
+  if (prof_calls[PROF_ANNEAL] + prof_calls[PROF_EVO] + prof_calls[PROF_POWELL] > 0)
+    printf("The optimizers include their force calculations.\n");
+#ifdef _OPENMP
+  printf("The loops over configurations are summed over %d threads.\n", omp_get_max_threads());
+#endif /* _OPENMP */
+}
@@ -0,0 +1,55 @@
+/****************************************************************
+ *
+ * profile.h: wall-clock profile of the phases of a run
+ *
+ ****************************************************************
+ *
+ * Copyright 2002-2013
+ *	Institute for Theoretical and Applied Physics
+ *	University of Stuttgart, D-70550 Stuttgart, Germany
+ *	http://potfit.sourceforge.net/
+ *
+ ****************************************************************
+ *
+ *   This file is part of potfit.
+ *
+ *   potfit is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   potfit is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with potfit; if not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* the phases up to PROF_MPI belong to the force calculation */
+typedef enum Prof_T {
+  PROF_SETUP,			/* potential update, splines, load balancing */
+  PROF_PAIR,			/* pair and density loop, embedding energies */
+  PROF_MANY,			/* EAM, ADP and angular forces */
+  PROF_DIPOLE,			/* induced dipoles and their forces */
+  PROF_EWALD,			/* reciprocal space sum */
+  PROF_SUM,			/* error sums and punishments */
+  PROF_MPI,			/* broadcasts, reductions and gathers */
+  PROF_ANNEAL,			/* simulated annealing */
+  PROF_EVO,			/* differential evolution */
+  PROF_POWELL,			/* powell_lsq */
+  PROF_PHASES
+} prof_t;
+
+void  prof_init(void);
+double prof_start(void);
+double prof_stop(prof_t, double);
+void  prof_force(void);
+void  prof_summary(void);
+
+#endif /* PROFILE_H */
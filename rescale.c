@@ -33,6 +33,7 @@
 
 #include "potfit.h"
 #include "splines.h"
+#include "utils.h"
 
 /* Doesn't make much sense without EAM (or ADP?)  */
 
@@ -48,26 +49,19 @@
 
 double rescale(pot_table_t *pt, double upper, int flag)
 {
-  int   mincol, maxcol, col, col2, first, vals, h, i, j, typ1, typ2, sign, dimneuxi;
+  int   mincol, maxcol, col, col2, first, vals, h, i, j, sign, dimneuxi;
   double *xi, *neuxi, *neuord, *neustep, *maxrho, *minrho, *left, *right;
-  atom_t *atom;
-  neigh_t *neigh;
-  double fnval, pos, grad, a;
+  double pos, grad, a;
   double min = 1e100, max = -1e100;
+  static double *rho_force = NULL;	/* scratch force vector */
 
   xi = pt->table;
   dimneuxi = pt->last[paircol + 2 * ntypes - 1] - pt->last[paircol + ntypes - 1];
   neuxi = (double *)malloc(dimneuxi * sizeof(double));
   neuord = (double *)malloc(dimneuxi * sizeof(double));
   neustep = (double *)malloc(ntypes * sizeof(double));
-  maxrho = (double *)malloc(ntypes * sizeof(double));
-  minrho = (double *)malloc(ntypes * sizeof(double));
   left = (double *)malloc(ntypes * sizeof(double));
   right = (double *)malloc(ntypes * sizeof(double));
-  for (i = 0; i < ntypes; i++) {
-    maxrho[i] = -1e100;
-    minrho[i] = 1e100;
-  }
   /* find Max/Min rho  */
   /* init splines - better safe than sorry */
   /* init second derivatives for splines */
@@ -112,38 +106,18 @@ double rescale(pot_table_t *pt, double upper, int flag)
 	pt->d2tab + first);
   }
 
-  /* re-calculate atom_rho (might be a waste...) */
-  for (h = 0; h < nconf; h++) {
-    for (i = 0; i < inconf[h]; i++)
-      atoms[cnfstart[h] + i].rho = 0.0;
-    for (i = 0; i < inconf[h]; i++) {
-      atom = atoms + i + cnfstart[h];
-      typ1 = atom->type;
-      for (j = 0; j < atom->num_neigh; j++) {
-	neigh = atom->neigh + j;
-	if (neigh->nr > i + cnfstart[h]) {
-	  typ2 = neigh->type;
-	  col2 = paircol + typ2;
-	  if (typ2 == typ1) {
-	    if (neigh->r < pt->end[col2]) {
-	      fnval = splint_dir(pt, xi, neigh->slot[1], neigh->shift[1], neigh->step[1]);
-	      atom->rho += fnval;
-	      atoms[neigh->nr].rho += fnval;
-	    }
-	  } else {
-	    col = paircol + typ1;
-	    if (neigh->r < pt->end[col2]) {
-	      atom->rho += splint_dir(pt, xi, neigh->slot[1], neigh->shift[1], neigh->step[1]);
-	    }
-	    if (neigh->r < pt->end[col])
-	      atoms[neigh->nr].rho += splint(pt, xi, col, neigh->r);
-	  }
-	}
-      }
-      maxrho[typ1] = MAX(maxrho[typ1], atom->rho);
-      minrho[typ1] = MIN(minrho[typ1], atom->rho);
-    }
+  /* re-calculate atom_rho in the force routine, which collects the range
+     of the densities, with MPI every process handles its own configurations */
+  if (NULL == rho_force) {
+    rho_force = (double *)malloc(mdim * sizeof(double));
+    if (NULL == rho_force)
+      error(1, "Cannot allocate memory for the densities in rescale()");
+    reg_for_free(rho_force, "rescale force vector");
   }
+  (*calc_forces) (xi, rho_force, 5);
+  maxrho = rho_max;
+  minrho = rho_min;
+
   for (i = 0; i < ntypes; i++) {
     /* printf("maxrho[%d]=%f\tminrho[%d]=%f\n",i,maxrho[i],i,minrho[i]); */
     if (maxrho[i] > max) {
@@ -378,8 +352,6 @@ double rescale(pot_table_t *pt, double upper, int flag)
 
   free(neuxi);
   free(neustep);
-  free(maxrho);
-  free(minrho);
   free(left);
   free(right);
 
@@ -45,6 +45,7 @@
 #define STEPVAR 2.0
 #define TEMPVAR 0.85
 #define KMAX 1000
+#define TLADDER 1.5		/* temperature ratio of neighboring replicas */
 #define GAUSS(a) (1.0/sqrt(2*M_PI)*(exp(-((a)*(a))/2.)))
 
 #ifdef APOT
@@ -123,6 +124,281 @@ void makebump(double *x, double width, double height, int center)
 
 #endif /* APOT */
 
+/****************************************************************
+ *
+ * double anneal_temperature(double *xi, double F, double *v);
+ * 	double *xi: 	pointer to all parameters
+ * 	double F: 	function value at xi
+ * 	double *v: 	pointer to step vector
+ *
+ * Determines the starting temperature from the fraction of
+ * accepted random steps around xi.
+ *
+ ****************************************************************/
+
+static double anneal_temperature(double *xi, double F, double *v)
+{
+  int   e = 0, h, n;
+  int   u = 10 * ndim;
+  int   m1 = 0;
+  double dF = 0.;
+  double chi = .8;
+  double T, F2;
+  double *xi2, *fxi1;
+#ifndef APOT
+  double width, height;		/* gaussian bump size */
+#endif /* APOT */
+
+  xi2 = vect_double(ndimtot);
+  fxi1 = vect_double(mdim);
+
+  printf("Determining optimal starting temperature T ...\n");
+  for (e = 0; e < u; e++) {
+    for (n = 0; n < ndimtot; n++)
+      xi2[n] = xi[n];
+    h = (int)(eqdist() * ndim);
+#ifdef APOT
+    randomize_parameter(h, xi2, v);
+#else
+    /* Create a gaussian bump,
+       width & hight distributed normally */
+    width = fabs(normdist());
+    height = normdist() * v[h];
+    makebump(xi2, width, height, h);
+#endif /* APOT */
+    F2 = (*calc_forces) (xi2, fxi1, 0);
+    if (F2 <= F) {
+      m1++;
+    } else {
+      dF += F2 - F;
+    }
+  }
+  printf("Did %d steps, %d were accepted\n", u, m1);
+  u -= m1;
+  dF /= u;
+
+  T = dF / log(u / (u * chi + (1 - chi) * m1));
+  if (isnan(T) || isinf(T))
+    error(1, "Simann failed because T was %f, please set it manually.", T);
+  if (T < 0)
+    T = -T;
+  printf("Setting T=%f\n\n", T);
+
+  free_vect_double(xi2);
+  free_vect_double(fxi1);
+
+  return T;
+}
+
+/****************************************************************
+ *
+ * void anneal_replicas(double *xi, double T, int auto_T);
+ * 	double *xi: 	pointer to all parameters
+ * 	double T: 	starting temperature of the coldest chain
+ * 	int auto_T: 	determine the starting temperature
+ *
+ * Replica exchange annealing with anneal_chains Metropolis
+ * chains at the temperatures T, TLADDER * T, TLADDER^2 * T, ...
+ * All chains make their steps together, the trial vectors of all
+ * chains are evaluated with one call of calc_forces_batch().
+ * Neighboring chains try to swap their states after every NSTEP
+ * sweeps, the coldest chain controls the stopping criterion.
+ *
+ ****************************************************************/
+
+static void anneal_replicas(double *xi, double T, int auto_T)
+{
+  int   c, h, j, k = 0, m, n;	/* counters */
+  int   nc = anneal_chains;	/* number of chains */
+  int   nswap = 0;		/* number of exchanged states */
+  int   loopagain;		/* loop flag */
+  int **naccept;		/* number of accepted changes in dir */
+  double Fopt, dF;		/* Fn value */
+  double *Fvar;			/* backlog of Fn vals of the coldest chain */
+  double *F, *F2;		/* Fn values of all chains */
+  double *Tc;			/* temperatures of all chains */
+  double *xopt;			/* optimal value */
+  double *swap;
+  double **x, **x2;		/* current and trial vectors of all chains */
+  double **v;			/* step vectors of all chains */
+#ifndef APOT
+  double width, height;		/* gaussian bump size */
+#endif /* APOT */
+  FILE *ff;			/* exit flagfile */
+
+  Fvar = vect_double(KMAX + 5 + NEPS);
+  F = vect_double(nc);
+  F2 = vect_double(nc);
+  Tc = vect_double(nc);
+  xopt = vect_double(ndimtot);
+  x = (double **)malloc(nc * sizeof(double *));
+  x2 = (double **)malloc(nc * sizeof(double *));
+  v = (double **)malloc(nc * sizeof(double *));
+  naccept = (int **)malloc(nc * sizeof(int *));
+  if (NULL == x || NULL == x2 || NULL == v || NULL == naccept)
+    error(1, "Could not allocate memory for the annealing chains!\n");
+  for (c = 0; c < nc; c++) {
+    x[c] = vect_double(ndimtot);
+    x2[c] = vect_double(ndimtot);
+    v[c] = vect_double(ndim);
+    naccept[c] = vect_int(ndim);
+    for (n = 0; n < ndimtot; n++)
+      x[c][n] = xi[n];
+    for (n = 0; n < ndim; n++)
+      v[c][n] = .1;
+  }
+
+  /* all chains start at xi */
+  calc_forces_batch(x, 1, F);
+  for (c = 1; c < nc; c++)
+    F[c] = F[0];
+  Fopt = F[0];
+  for (n = 0; n < ndimtot; n++)
+    xopt[n] = xi[n];
+
+  if (auto_T)
+    T = anneal_temperature(xi, F[0], v[0]);
+  for (c = 0; c < nc; c++)
+    Tc[c] = T * pow(TLADDER, c);
+
+  printf("Annealing with %d chains at T=%f ... %f\n", nc, Tc[0], Tc[nc - 1]);
+  printf("  k\tT        \t  m\tF          \tFopt       \tswaps\n");
+  printf("%3d\t%f\t%3d\t%f\t%f\t%d\n", 0, Tc[0], 0, F[0], Fopt, nswap);
+  fflush(stdout);
+  for (n = 0; n <= NEPS; n++)
+    Fvar[n] = F[0];
+
+  /* annealing loop */
+  do {
+    for (m = 0; m < NTEMP; m++) {
+      for (j = 0; j < NSTEP; j++) {
+	for (h = 0; h < ndim; h++) {
+	  /* one trial step for every chain */
+	  for (c = 0; c < nc; c++) {
+	    for (n = 0; n < ndimtot; n++)
+	      x2[c][n] = x[c][n];
+#ifdef APOT
+	    randomize_parameter(h, x2[c], v[c]);
+#else
+	    width = fabs(normdist());
+	    height = normdist() * v[c][h];
+	    makebump(x2[c], width, height, h);
+#endif /* APOT */
+	  }
+	  calc_forces_batch(x2, nc, F2);
+	  for (c = 0; c < nc; c++) {
+	    if (F2[c] <= F[c] || eqdist() < (exp((F[c] - F2[c]) / Tc[c]))) {
+	      SWAP(x[c], x2[c], swap);
+	      F[c] = F2[c];
+	      naccept[c][h]++;
+	      if (F[c] < Fopt) {
+		for (n = 0; n < ndimtot; n++)
+		  xopt[n] = x[c][n];
+		Fopt = F[c];
+		if (*tempfile != '\0') {
+#ifndef APOT
+		  for (n = 0; n < ndimtot; n++)
+		    xi[n] = xopt[n];
+		  write_pot_table(&opt_pot, tempfile);
+#else
+		  update_apot_table(xopt);
+		  write_pot_table(&apot_table, tempfile);
+#endif /* APOT */
+		}
+	      }
+	    }
+	  }
+	}
+      }
+
+      /* Step adjustment */
+      for (c = 0; c < nc; c++)
+	for (n = 0; n < ndim; n++) {
+	  if (naccept[c][n] > (0.6 * NSTEP))
+	    v[c][n] *= (1 + STEPVAR * ((double)naccept[c][n] / NSTEP - 0.6) / 0.4);
+	  else if (naccept[c][n] < (0.4 * NSTEP))
+	    v[c][n] /= (1 + STEPVAR * (0.4 - (double)naccept[c][n] / NSTEP) / 0.4);
+	  naccept[c][n] = 0;
+	}
+
+      /* replica exchange between neighboring temperatures */
+      for (c = nc - 2; c >= 0; c--) {
+	dF = (F[c] - F[c + 1]) * (1. / Tc[c] - 1. / Tc[c + 1]);
+	if (dF >= 0. || eqdist() < exp(dF)) {
+	  SWAP(x[c], x[c + 1], swap);
+	  SWAP(F[c], F[c + 1], dF);
+	  nswap++;
+	}
+      }
+
+      printf("%3d\t%f\t%3d\t%f\t%f\t%d\n", k, Tc[0], m + 1, F[0], Fopt, nswap);
+      fflush(stdout);
+
+      /* End annealing if break flagfile exists */
+      if (*flagfile != '\0') {
+	ff = fopen(flagfile, "r");
+	if (NULL != ff) {
+	  printf("Annealing terminated in presence of break flagfile \"%s\"!\n", flagfile);
+	  printf("Temperature was %f, returning optimum configuration\n", Tc[0]);
+	  k = KMAX + 1;
+	  fclose(ff);
+	  remove(flagfile);
+	  break;
+	}
+      }
+    }
+
+    /*Temp adjustment */
+    for (c = 0; c < nc; c++)
+      Tc[c] *= TEMPVAR;
+    k++;
+    Fvar[k + NEPS] = F[0];
+    loopagain = 0;
+    for (n = 1; n <= NEPS; n++) {
+      if (fabs(F[0] - Fvar[k - n + NEPS]) > (EPS * F[0] * 0.01))
+	loopagain = 1;
+    }
+    /* restart the coldest chain at the optimum */
+    if (!loopagain && ((F[0] - Fopt) > (EPS * F[0] * 0.01))) {
+      for (n = 0; n < ndimtot; n++)
+	x[0][n] = xopt[n];
+      F[0] = Fopt;
+      loopagain = 1;
+    }
+  } while (k < KMAX && loopagain);
+  for (n = 0; n < ndimtot; n++)
+    xi[n] = xopt[n];
+
+  printf("Finished annealing, starting powell minimization ...\n");
+
+  if (*tempfile != '\0') {
+#ifndef APOT
+    write_pot_table(&opt_pot, tempfile);
+#else
+    update_apot_table(xopt);
+    write_pot_table(&apot_table, tempfile);
+#endif /* APOT */
+  }
+
+  for (c = 0; c < nc; c++) {
+    free_vect_double(x[c]);
+    free_vect_double(x2[c]);
+    free_vect_double(v[c]);
+    free_vect_int(naccept[c]);
+  }
+  free(x);
+  free(x2);
+  free(v);
+  free(naccept);
+  free_vect_double(Fvar);
+  free_vect_double(F);
+  free_vect_double(F2);
+  free_vect_double(Tc);
+  free_vect_double(xopt);
+
+  return;
+}
+
 /****************************************************************
  *
  * void anneal(double *x);
@@ -130,6 +406,7 @@ void makebump(double *x, double width, double height, int center)
  *
  * Anneals a vector xi to minimize a function F(xi).
  * Algorithm according to Corana et al.
+ * With anneal_chains > 1 see anneal_replicas().
  *
  ****************************************************************/
 
@@ -165,6 +442,15 @@ void anneal(double *xi)
   if (T == 0. && auto_T != 1)
     return;			/* don't anneal if starttemp equal zero */
 
+  if (anneal_chains < 1)
+    error(1, "The value for anneal_chains (%d) is invalid!\n", anneal_chains);
+
+  /* several chains with replica exchange */
+  if (anneal_chains > 1) {
+    anneal_replicas(xi, T, auto_T);
+    return;
+  }
+
   Fvar = vect_double(KMAX + 5 + NEPS);	/* Backlog of old F values */
   v = vect_double(ndim);
   xopt = vect_double(ndimtot);
@@ -211,45 +497,8 @@ void anneal(double *xi)
   }
 #endif /* APOT */
   /* determine optimum temperature for annealing */
-  if (auto_T) {
-    int   e = 0;
-    int   u = 10 * ndim;
-    int   m1 = 0;
-    double dF = 0.;
-    double chi = .8;
-
-    printf("Determining optimal starting temperature T ...\n");
-    for (e = 0; e < u; e++) {
-      for (n = 0; n < ndimtot; n++)
-	xi2[n] = xi[n];
-      h = (int)(eqdist() * ndim);
-#ifdef APOT
-      randomize_parameter(h, xi2, v);
-#else
-      /* Create a gaussian bump,
-         width & hight distributed normally */
-      width = fabs(normdist());
-      height = normdist() * v[h];
-      makebump(xi2, width, height, h);
-#endif /* APOT */
-      F2 = (*calc_forces) (xi2, fxi1, 0);
-      if (F2 <= F) {
-	m1++;
-      } else {
-	dF += F2 - F;
-      }
-    }
-    printf("Did %d steps, %d were accepted\n", u, m1);
-    u -= m1;
-    dF /= u;
-
-    T = dF / log(u / (u * chi + (1 - chi) * m1));
-    if (isnan(T) || isinf(T))
-      error(1, "Simann failed because T was %f, please set it manually.", T);
-    if (T < 0)
-      T = -T;
-    printf("Setting T=%f\n\n", T);
-  }
+  if (auto_T)
+    T = anneal_temperature(xi, F, v);
 
   printf("  k\tT        \t  m\tF          \tFopt\n");
   printf("%3d\t%f\t%3d\t%f\t%f\n", 0, T, 0, F, Fopt);
@@ -29,9 +29,21 @@
  *
  ****************************************************************/
 
+#if defined __AVX2__ || defined __AVX512F__
+#include <immintrin.h>
+#endif /* __AVX2__ || __AVX512F__ */
+
 #include "potfit.h"
 
 #include "splines.h"
+#include "utils.h"
+
+/* doubles per interval in the coefficient table of spline_col() */
+#ifdef HORNER
+#define NCOEF 8
+#else
+#define NCOEF 4
+#endif /* HORNER */
 
 /****************************************************************
  *
@@ -292,6 +304,307 @@ void spline_ne(double *x, double *y, int n, double yp1, double ypn, double *y2)
     y2[k] = y2[k] * y2[k + 1] + u[k];
 }
 
+/****************************************************************
+ *
+ * spline_col: initializes the second derivatives of column col
+ *            of pt with spline_ed (format 0 and 3) or spline_ne,
+ *            a column that did not change since the last call
+ *            gets its cached second derivatives back instead
+ *
+ ****************************************************************/
+
+void spline_col(pot_table_t *pt, double *xi, int col, double yp1, double ypn)
+{
+  int   i, n, first, same;
+  int   equi = (0 == format || 3 == format);
+  static pot_table_t *cache_pt = NULL;	/* table the cache belongs to */
+  static int cache_len = 0;
+  static int *valid = NULL;	/* cache of the column is valid */
+  static double *grad = NULL;	/* boundary gradients, two per column */
+  static double *step = NULL;	/* step of equidistant columns */
+  static double *x = NULL, *y = NULL, *d2 = NULL;
+
+  first = pt->first[col];
+  n = pt->last[col] - first + 1;
+  spline_calls++;
+
+  if (NULL == cache_pt) {
+    cache_pt = pt;
+    cache_len = pt->len;
+    valid = (int *)malloc(pt->ncols * sizeof(int));
+    grad = (double *)malloc(2 * pt->ncols * sizeof(double));
+    step = (double *)malloc(pt->ncols * sizeof(double));
+    x = (double *)malloc(pt->len * sizeof(double));
+    y = (double *)malloc(pt->len * sizeof(double));
+    d2 = (double *)malloc(pt->len * sizeof(double));
+    if (NULL == valid || NULL == grad || NULL == step || NULL == x || NULL == y || NULL == d2)
+      error(1, "Cannot allocate memory for the spline cache");
+    reg_for_free(valid, "spline cache");
+    reg_for_free(grad, "spline cache");
+    reg_for_free(step, "spline cache");
+    reg_for_free(x, "spline cache");
+    reg_for_free(y, "spline cache");
+    reg_for_free(d2, "spline cache");
+    for (i = 0; i < pt->ncols; i++)
+      valid[i] = 0;
+    /* aligned, every interval sits in one cache line */
+    if (0 != posix_memalign((void **)&pt->coef, NCOEF * sizeof(double),
+	NCOEF * pt->len * sizeof(double)))
+      error(1, "Cannot allocate memory for the spline coefficients");
+    reg_for_free(pt->coef, "%s coefficients", "spline");
+    for (i = 0; i < NCOEF * pt->len; i++)
+      pt->coef[i] = 0.0;
+  }
+
+  /* no cache for other tables */
+  if (pt != cache_pt || pt->len != cache_len) {
+    if (equi)
+      spline_ed(pt->step[col], xi + first, n, yp1, ypn, pt->d2tab + first);
+    else
+      spline_ne(pt->xcoord + first, xi + first, n, yp1, ypn, pt->d2tab + first);
+    return;
+  }
+
+  same = valid[col] && yp1 == grad[2 * col] && ypn == grad[2 * col + 1];
+  if (same && equi)
+    same = (pt->step[col] == step[col]);
+  for (i = first; same && i < first + n; i++)
+    if (xi[i] != y[i] || (!equi && pt->xcoord[i] != x[i]))
+      same = 0;
+
+  if (same) {
+    memcpy(pt->d2tab + first, d2 + first, n * sizeof(double));
+    spline_skipped++;
+    return;
+  }
+
+  if (equi)
+    spline_ed(pt->step[col], xi + first, n, yp1, ypn, pt->d2tab + first);
+  else
+    spline_ne(pt->xcoord + first, xi + first, n, yp1, ypn, pt->d2tab + first);
+
+  valid[col] = 1;
+  grad[2 * col] = yp1;
+  grad[2 * col + 1] = ypn;
+  step[col] = pt->step[col];
+  for (i = first; i < first + n; i++) {
+    x[i] = pt->xcoord[i];
+    y[i] = xi[i];
+  }
+  memcpy(d2 + first, pt->d2tab + first, n * sizeof(double));
+
+#ifdef HORNER
+  /* polynomial in b = (r - x[i]) / h for splint_comb_vec():
+     value c0 + b * (c1 + b * (c2 + b * c3)), gradient g0 + b * (g1 + b * g2) */
+  for (i = first; i < first + n - 1; i++) {
+    double h = equi ? pt->step[col] : pt->xcoord[i + 1] - pt->xcoord[i];
+    double *c = pt->coef + NCOEF * i;
+
+    c[0] = xi[i];
+    c[1] = xi[i + 1] - xi[i] - (2.0 * pt->d2tab[i] + pt->d2tab[i + 1]) * (h * h) / 6.0;
+    c[2] = pt->d2tab[i] * (h * h) / 2.0;
+    c[3] = (pt->d2tab[i + 1] - pt->d2tab[i]) * (h * h) / 6.0;
+    c[4] = c[1] / h;
+    c[5] = 2.0 * c[2] / h;
+    c[6] = 3.0 * c[3] / h;
+    c[7] = 0.0;
+  }
+#else
+  /* interleaved coefficients for splint_comb_vec() */
+  for (i = first; i < first + n - 1; i++) {
+    pt->coef[4 * i + 0] = xi[i];
+    pt->coef[4 * i + 1] = xi[i + 1];
+    pt->coef[4 * i + 2] = pt->d2tab[i];
+    pt->coef[4 * i + 3] = pt->d2tab[i + 1];
+  }
+#endif /* HORNER */
+
+  return;
+}
+
+/****************************************************************
+ *
+ * splint_comb_vec: spline interpolation (val) and gradient (grad)
+ *            for n points with known index positions slot, shift
+ *            and step, e.g. a block of the neighbor table;
+ *            needs the coefficients from spline_col()
+ *
+ *            the slots are only clamped to the table, so points
+ *            outside of their column give undefined results
+ *
+ *            with HORNER the intervals are stored as polynomials,
+ *            step is not needed then
+ *
+ ****************************************************************/
+
+#ifdef HORNER
+
+/* a * b + c, -mavx2 does not imply FMA */
+#ifdef __FMA__
+#define MM256_MADD(a, b, c) _mm256_fmadd_pd(a, b, c)
+#else
+#define MM256_MADD(a, b, c) _mm256_add_pd(_mm256_mul_pd(a, b), c)
+#endif /* __FMA__ */
+
+void splint_comb_vec(pot_table_t *pt, int n, const int *slot, const double *shift,
+  const double *step, double *val, double *grad)
+{
+  int   i = 0, k;
+  int   kmax = pt->len - 1;
+  const double *c = pt->coef;
+  double b;
+
+  /* also used with AVX-512, seven gathers per block are slower */
+#ifdef __AVX2__
+  __m256d r0, r1, r2, r3, t0, t1, t2, t3;
+  __m256d vb, vc0, vc1, vc2, vc3;
+
+  for (; i + 4 <= n; i += 4) {
+    const double *c0 = c + 8 * MIN(slot[i + 0], kmax);
+    const double *c1 = c + 8 * MIN(slot[i + 1], kmax);
+    const double *c2 = c + 8 * MIN(slot[i + 2], kmax);
+    const double *c3 = c + 8 * MIN(slot[i + 3], kmax);
+    vb = _mm256_loadu_pd(shift + i);
+    /* value coefficients, one load per interval, then transpose */
+    r0 = _mm256_load_pd(c0);
+    r1 = _mm256_load_pd(c1);
+    r2 = _mm256_load_pd(c2);
+    r3 = _mm256_load_pd(c3);
+    t0 = _mm256_unpacklo_pd(r0, r1);
+    t1 = _mm256_unpackhi_pd(r0, r1);
+    t2 = _mm256_unpacklo_pd(r2, r3);
+    t3 = _mm256_unpackhi_pd(r2, r3);
+    vc0 = _mm256_permute2f128_pd(t0, t2, 0x20);
+    vc1 = _mm256_permute2f128_pd(t1, t3, 0x20);
+    vc2 = _mm256_permute2f128_pd(t0, t2, 0x31);
+    vc3 = _mm256_permute2f128_pd(t1, t3, 0x31);
+    _mm256_storeu_pd(val + i, MM256_MADD(vb, MM256_MADD(vb, MM256_MADD(vb, vc3, vc2), vc1), vc0));
+    /* gradient coefficients from the upper half of the cache line */
+    r0 = _mm256_load_pd(c0 + 4);
+    r1 = _mm256_load_pd(c1 + 4);
+    r2 = _mm256_load_pd(c2 + 4);
+    r3 = _mm256_load_pd(c3 + 4);
+    t0 = _mm256_unpacklo_pd(r0, r1);
+    t1 = _mm256_unpackhi_pd(r0, r1);
+    t2 = _mm256_unpacklo_pd(r2, r3);
+    t3 = _mm256_unpackhi_pd(r2, r3);
+    vc0 = _mm256_permute2f128_pd(t0, t2, 0x20);
+    vc1 = _mm256_permute2f128_pd(t1, t3, 0x20);
+    vc2 = _mm256_permute2f128_pd(t0, t2, 0x31);
+    _mm256_storeu_pd(grad + i, MM256_MADD(vb, MM256_MADD(vb, vc2, vc1), vc0));
+  }
+#endif /* __AVX2__ */
+
+  /* remainder and portable version */
+  for (; i < n; i++) {
+    k = 8 * MIN(slot[i], kmax);
+    b = shift[i];
+    val[i] = c[k] + b * (c[k + 1] + b * (c[k + 2] + b * c[k + 3]));
+    grad[i] = c[k + 4] + b * (c[k + 5] + b * c[k + 6]);
+  }
+
+  return;
+}
+
+#else
+
+void splint_comb_vec(pot_table_t *pt, int n, const int *slot, const double *shift,
+  const double *step, double *val, double *grad)
+{
+  int   i = 0, k;
+  int   kmax = pt->len - 1;
+  const double *c = pt->coef;
+  double a, b, h, p1, p2, d21, d22;
+
+#ifdef __AVX512F__
+  const __m512d one = _mm512_set1_pd(1.0);
+  const __m512d three = _mm512_set1_pd(3.0);
+  const __m512d sixth = _mm512_set1_pd(1.0 / 6.0);
+  const __m256i vkmax = _mm256_set1_epi32(kmax);
+  __m512i vk;
+  __m512d va, vb, vh, vp1, vp2, vd1, vd2, va3, vb3;
+
+  for (; i + 8 <= n; i += 8) {
+    vk = _mm512_cvtepi32_epi64(_mm256_min_epi32(_mm256_loadu_si256((const __m256i *)(slot + i)), vkmax));
+    vk = _mm512_slli_epi64(vk, 2);
+    vp1 = _mm512_i64gather_pd(vk, c, 8);
+    vp2 = _mm512_i64gather_pd(vk, c + 1, 8);
+    vd1 = _mm512_i64gather_pd(vk, c + 2, 8);
+    vd2 = _mm512_i64gather_pd(vk, c + 3, 8);
+    vb = _mm512_loadu_pd(shift + i);
+    vh = _mm512_loadu_pd(step + i);
+    va = _mm512_sub_pd(one, vb);
+    /* a^3 - a and b^3 - b */
+    va3 = _mm512_mul_pd(va, _mm512_fmsub_pd(va, va, one));
+    vb3 = _mm512_mul_pd(vb, _mm512_fmsub_pd(vb, vb, one));
+    _mm512_storeu_pd(val + i, _mm512_add_pd(_mm512_fmadd_pd(va, vp1, _mm512_mul_pd(vb, vp2)),
+	_mm512_mul_pd(_mm512_fmadd_pd(va3, vd1, _mm512_mul_pd(vb3, vd2)),
+	  _mm512_mul_pd(_mm512_mul_pd(vh, vh), sixth))));
+    /* 3 a^2 - 1 and 3 b^2 - 1 */
+    va3 = _mm512_fmsub_pd(three, _mm512_mul_pd(va, va), one);
+    vb3 = _mm512_fmsub_pd(three, _mm512_mul_pd(vb, vb), one);
+    _mm512_storeu_pd(grad + i, _mm512_add_pd(_mm512_div_pd(_mm512_sub_pd(vp2, vp1), vh),
+	_mm512_mul_pd(_mm512_fmsub_pd(vb3, vd2, _mm512_mul_pd(va3, vd1)), _mm512_mul_pd(vh, sixth))));
+  }
+#elif defined __AVX2__
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d three = _mm256_set1_pd(3.0);
+  const __m256d sixth = _mm256_set1_pd(1.0 / 6.0);
+  __m256d r0, r1, r2, r3, t0, t1, t2, t3;
+  __m256d va, vb, vh, vp1, vp2, vd1, vd2, va3, vb3;
+
+  for (; i + 4 <= n; i += 4) {
+    /* one load per interval, then transpose */
+    r0 = _mm256_load_pd(c + 4 * MIN(slot[i + 0], kmax));
+    r1 = _mm256_load_pd(c + 4 * MIN(slot[i + 1], kmax));
+    r2 = _mm256_load_pd(c + 4 * MIN(slot[i + 2], kmax));
+    r3 = _mm256_load_pd(c + 4 * MIN(slot[i + 3], kmax));
+    t0 = _mm256_unpacklo_pd(r0, r1);
+    t1 = _mm256_unpackhi_pd(r0, r1);
+    t2 = _mm256_unpacklo_pd(r2, r3);
+    t3 = _mm256_unpackhi_pd(r2, r3);
+    vp1 = _mm256_permute2f128_pd(t0, t2, 0x20);
+    vd1 = _mm256_permute2f128_pd(t0, t2, 0x31);
+    vp2 = _mm256_permute2f128_pd(t1, t3, 0x20);
+    vd2 = _mm256_permute2f128_pd(t1, t3, 0x31);
+    vb = _mm256_loadu_pd(shift + i);
+    vh = _mm256_loadu_pd(step + i);
+    va = _mm256_sub_pd(one, vb);
+    /* a^3 - a and b^3 - b */
+    va3 = _mm256_mul_pd(va, _mm256_sub_pd(_mm256_mul_pd(va, va), one));
+    vb3 = _mm256_mul_pd(vb, _mm256_sub_pd(_mm256_mul_pd(vb, vb), one));
+    _mm256_storeu_pd(val + i,
+      _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(va, vp1), _mm256_mul_pd(vb, vp2)),
+	_mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(va3, vd1), _mm256_mul_pd(vb3, vd2)),
+	  _mm256_mul_pd(_mm256_mul_pd(vh, vh), sixth))));
+    /* 3 a^2 - 1 and 3 b^2 - 1 */
+    va3 = _mm256_sub_pd(_mm256_mul_pd(three, _mm256_mul_pd(va, va)), one);
+    vb3 = _mm256_sub_pd(_mm256_mul_pd(three, _mm256_mul_pd(vb, vb)), one);
+    _mm256_storeu_pd(grad + i, _mm256_add_pd(_mm256_div_pd(_mm256_sub_pd(vp2, vp1), vh),
+	_mm256_mul_pd(_mm256_sub_pd(_mm256_mul_pd(vb3, vd2), _mm256_mul_pd(va3, vd1)),
+	  _mm256_mul_pd(vh, sixth))));
+  }
+#endif /* __AVX512F__ */
+
+  /* remainder and portable version */
+  for (; i < n; i++) {
+    k = 4 * MIN(slot[i], kmax);
+    p1 = c[k];
+    p2 = c[k + 1];
+    d21 = c[k + 2];
+    d22 = c[k + 3];
+    b = shift[i];
+    h = step[i];
+    a = 1.0 - b;
+    val[i] = a * p1 + b * p2 + ((a * a * a - a) * d21 + (b * b * b - b) * d22) * (h * h) / 6.0;
+    grad[i] = (p2 - p1) / h + ((3 * (b * b) - 1) * d22 - (3 * (a * a) - 1) * d21) * h / 6.0;
+  }
+
+  return;
+}
+
+#endif /* HORNER */
+
 /****************************************************************
  *
  * splint_ne: interpolates the function with splines
@@ -457,3 +770,77 @@ double splint_grad_ne(pot_table_t *pt, double *xi, int col, double r)
 
   return (p2 - p1) / h + ((3 * (b * b) - 1) * d22 - (3 * (a * a) - 1) * d21) * h / 6.0;
 }
+
+#ifdef BENCH
+
+/****************************************************************
+ *
+ * spline_bench: compares the throughput of splint_comb_dir() and
+ *            splint_comb_vec() on the current coefficients of pt,
+ *            the points are spread over all columns
+ *
+ ****************************************************************/
+
+#define BENCH_POINTS 65536
+#define BENCH_REPS 200
+
+void spline_bench(pot_table_t *pt)
+{
+  int   i, j, col, n;
+  int  *slot;
+  double *shift, *step, *val, *grad, *vval, *vgrad;
+  double t_dir, t_vec, dev = 0.0, gdev = 0.0;
+
+  slot = (int *)malloc(BENCH_POINTS * sizeof(int));
+  shift = (double *)malloc(6 * BENCH_POINTS * sizeof(double));
+  if (NULL == slot || NULL == shift)
+    error(1, "Cannot allocate memory for the spline benchmark");
+  step = shift + BENCH_POINTS;
+  val = step + BENCH_POINTS;
+  grad = val + BENCH_POINTS;
+  vval = grad + BENCH_POINTS;
+  vgrad = vval + BENCH_POINTS;
+
+  /* fixed pseudo-random pattern, the PRNG of the fit is not touched */
+  for (i = 0; i < BENCH_POINTS; i++) {
+    col = i % pt->ncols;
+    n = pt->last[col] - pt->first[col];
+    slot[i] = pt->first[col] + (int)((7919L * i) % n);
+    shift[i] = ((31 * i) % 997 + 0.5) / 997.0;
+    step[i] = pt->xcoord[slot[i] + 1] - pt->xcoord[slot[i]];
+  }
+
+  t_dir = wall_time();
+  for (j = 0; j < BENCH_REPS; j++)
+    for (i = 0; i < BENCH_POINTS; i++)
+      val[i] = splint_comb_dir(pt, pt->table, slot[i], shift[i], step[i], grad + i);
+  t_dir = wall_time() - t_dir;
+
+  t_vec = wall_time();
+  for (j = 0; j < BENCH_REPS; j++)
+    splint_comb_vec(pt, BENCH_POINTS, slot, shift, step, vval, vgrad);
+  t_vec = wall_time() - t_vec;
+
+  for (i = 0; i < BENCH_POINTS; i++) {
+    dev = MAX(dev, fabs(val[i] - vval[i]) / (1.0 + fabs(val[i])));
+    gdev = MAX(gdev, fabs(grad[i] - vgrad[i]) / (1.0 + fabs(grad[i])));
+  }
+
+#ifdef HORNER
+  printf("\nSpline benchmark (%d points, horner coefficients):\n", BENCH_POINTS);
+#else
+  printf("\nSpline benchmark (%d points, interleaved coefficients):\n", BENCH_POINTS);
+#endif /* HORNER */
+  printf("splint_comb_dir: %8.2f Mpoints/s\n", 1e-6 * BENCH_POINTS * BENCH_REPS / t_dir);
+  printf("splint_comb_vec: %8.2f Mpoints/s (speedup %.2f)\n",
+    1e-6 * BENCH_POINTS * BENCH_REPS / t_vec, t_dir / t_vec);
+  printf("max. relative deviation: value %e, gradient %e\n\n", dev, gdev);
+  fflush(stdout);
+
+  free(slot);
+  free(shift);
+
+  return;
+}
+
+#endif /* BENCH */
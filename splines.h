@@ -43,5 +43,11 @@ double splint_ne(pot_table_t *, double *, int, double);
 double splint_ne_lin(pot_table_t *, double *, int, double);
 double splint_comb_ne(pot_table_t *, double *, int, double, double *);
 double splint_grad_ne(pot_table_t *, double *, int, double);
+void  spline_col(pot_table_t *, double *, int, double, double);
+void  splint_comb_vec(pot_table_t *, int, const int *, const double *, const double *, double *,
+  double *);
+#ifdef BENCH
+void  spline_bench(pot_table_t *);
+#endif /* BENCH */
 
 #endif /* SPLINES_H */
@@ -53,7 +53,12 @@
 
 #endif /* UINTPTR_MAX */
 
+#include <sys/time.h>
+
 #include "potfit.h"
+
+#include "functions.h"
+#include "profile.h"
 #include "utils.h"
 
 int  *vect_int(long dim)
@@ -146,6 +151,44 @@ void reg_for_free(void *p, char *name, ...)
   return;
 }
 
+static int cmp_pointer(const void *a, const void *b)
+{
+  uintptr_t x = (uintptr_t) * (void *const *)a;
+  uintptr_t y = (uintptr_t) * (void *const *)b;
+
+  return (x > y) - (x < y);
+}
+
+/****************************************************************
+ *
+ *  free_registered: free the n pointers p[] before the end of the
+ *	program and remove them from the list of reg_for_free(),
+ *	pointers which were not registered are freed as well
+ *
+ ****************************************************************/
+
+void free_registered(void **p, int n)
+{
+  int   i, j;
+
+  if (n < 1)
+    return;
+
+  qsort(p, n, sizeof(void *), cmp_pointer);
+  for (i = 0, j = 0; i < num_pointers; i++)
+    if (NULL != all_pointers[i] && NULL != bsearch(all_pointers + i, p, n, sizeof(void *), cmp_pointer))
+      free(pointer_names[i]);
+    else {
+      all_pointers[j] = all_pointers[i];
+      pointer_names[j++] = pointer_names[i];
+    }
+  num_pointers = j;
+  for (i = 0; i < n; i++)
+    free(p[i]);
+
+  return;
+}
+
 void free_all_pointers()
 {
   int   i;
@@ -172,6 +215,21 @@ vector vec_prod(vector u, vector v)
   return w;
 }
 
+/****************************************************************
+ *
+ *  double wall_time(): Returns the wall clock time in seconds
+ *
+ ****************************************************************/
+
+double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
 /****************************************************************
  *
  *  double eqdist(): Returns an equally distributed random number in [0,1[
@@ -327,6 +385,132 @@ void swap_population(double *a, double *b)
 
 #endif /* APOT && EVO */
 
+#ifdef MPI
+
+/* population handed over from calc_forces_batch() to batch_forces() */
+static int batch_n = 0;		/* number of parameter vectors */
+static double **batch_pop = NULL;	/* parameter vectors on root */
+static double *batch_cost = NULL;	/* resulting cost on root */
+
+#endif /* MPI */
+
+/****************************************************************
+ *
+ *  calc_forces_batch: Cost of n parameter vectors pop[0..n-1],
+ *	the results are stored in cost. With MPI the whole batch
+ *	is evaluated with a single call of calc_forces, see
+ *	batch_forces(). Only called by the root process.
+ *
+ ****************************************************************/
+
+void calc_forces_batch(double **pop, int n, double *cost)
+{
+  static double *fxi = NULL;
+#ifndef MPI
+  int   i;
+#endif /* !MPI */
+
+  if (n < 1)
+    return;
+
+  if (NULL == fxi) {
+    fxi = vect_double(mdim);
+    reg_for_free(fxi, "batch force vector");
+  }
+#ifdef MPI
+  batch_n = n;
+  batch_pop = pop;
+  batch_cost = cost;
+  (void)(*calc_forces) (pop[0], fxi, 4);
+  batch_n = 0;
+  batch_pop = NULL;
+  batch_cost = NULL;
+#else
+  for (i = 0; i < n; i++)
+    cost[i] = (*calc_forces) (pop[i], fxi, 0);
+#endif /* MPI */
+
+  return;
+}
+
+#ifdef MPI
+
+/****************************************************************
+ *
+ *  batch_forces: Evaluate the batch of calc_forces_batch().
+ *	The parameter vectors are broadcast once, every process
+ *	calculates the cost of all of them on its own configurations
+ *	and the partial sums are reduced on the root process.
+ *	Called by all processes from calc_forces with flag 4.
+ *
+ ****************************************************************/
+
+void batch_forces(void)
+{
+  static int size = 0;
+  static int len = 0;
+  static double *pop = NULL;
+  static double *cost = NULL;
+  static double *fxi = NULL;
+  int   i, j, n, nlen;
+  double t_prof;
+
+  /* ndimtot is not known on all processes for tabulated potentials */
+  if (0 == myid) {
+    n = batch_n;
+    nlen = ndimtot;
+  }
+  MPI_Bcast(&n, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&nlen, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  if (n > size || nlen != len) {
+    size = n;
+    len = nlen;
+    pop = (double *)realloc(pop, size * len * sizeof(double));
+    cost = (double *)realloc(cost, size * sizeof(double));
+    if (NULL == pop || NULL == cost)
+      error(1, "Cannot allocate memory for the batch of parameter vectors");
+  }
+  if (NULL == fxi)
+    fxi = (double *)malloc(mdim * sizeof(double));
+  if (NULL == fxi)
+    error(1, "Cannot allocate memory for the batch force vector");
+
+  if (0 == myid)
+    for (i = 0; i < n; i++) {
+#ifdef APOT
+      /* all processes need the corrected parameters */
+      apot_check_params(batch_pop[i]);
+#endif /* APOT */
+      for (j = 0; j < len; j++)
+	pop[i * len + j] = batch_pop[i][j];
+    }
+  MPI_Bcast(pop, n * len, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+  local_forces = 1;
+  for (i = 0; i < n; i++)
+    cost[i] = (*calc_forces) (pop + i * len, fxi, 0);
+  local_forces = 0;
+
+  t_prof = prof_start();
+  if (0 == myid) {
+    MPI_Reduce(cost, batch_cost, n, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    for (i = 0; i < n; i++)
+      if (isnan(batch_cost[i]))
+	batch_cost[i] = 10e10;
+    fcalls += n;
+  } else
+    MPI_Reduce(cost, NULL, n, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  prof_stop(PROF_MPI, t_prof);
+  /* one line of the trace for the whole batch */
+  if (0 == myid)
+    prof_force();
+
+  return;
+}
+
+#endif /* MPI */
+
 #ifdef _32BIT
 #undef _32BIT
 #endif /* _32BIT */
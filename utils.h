@@ -42,14 +42,21 @@ void  free_mat_double(double **matrix);
 /* memory management */
 void  reg_for_free(void *p, char *name, ...);
 void  free_all_pointers();
+void  free_registered(void **, int);
 
 /* vector procuct */
 vector vec_prod(vector, vector);
 
+/* wall clock time in seconds */
+double wall_time(void);
+
 /* pRNG with equal or normal distribution */
 double eqdist();
 double normdist();
 
+/* cost of a whole population of parameter vectors */
+void  calc_forces_batch(double **, int, double *);
+
 /* different power functions */
 inline int isquare(int);
 inline double dsquare(double);